@@ -0,0 +1,86 @@
+//
+//  BallLight.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "BallLight.h"
+
+// generic RGB values of the NSColor constants the plugin used to pick from
+static const LightColor kDefaultBallColors[] = {
+    LightColor(1.0f, 0.0f, 0.0f),   // red
+    LightColor(1.0f, 0.5f, 0.0f),   // orange
+    LightColor(0.0f, 1.0f, 0.0f),   // green
+    LightColor(0.0f, 0.0f, 1.0f),   // blue
+    LightColor(0.5f, 0.0f, 0.5f),   // purple
+};
+
+static const uint32_t kNumDefaultBallColors = sizeof(kDefaultBallColors) / sizeof(kDefaultBallColors[0]);
+
+static uint8_t randomBallColorIndex(LightRandom& rng)
+{
+    return (uint8_t)rng.uniform(kNumDefaultBallColors);
+}
+
+void BallLight::reset(LightRandom& rng)
+{
+    m_animStart = 0;
+    m_animEnd = 0;
+    m_currColor = LightColor(1, 1, 1);
+
+    m_startColorIdx = randomBallColorIndex(rng);
+    m_endColorIdx = randomBallColorIndex(rng);
+    while (m_startColorIdx == m_endColorIdx) {
+        m_endColorIdx = randomBallColorIndex(rng);
+    }
+}
+
+double BallLight::getRandomOffset(bool useOffset, LightRandom& rng) const
+{
+    if (!useOffset) {
+        return 0.0;
+    }
+
+    uint32_t offset_ms = rng.uniform((uint32_t)(kBallLightAnimationPeriod * 0.75 * 1000.0));
+    return (double)offset_ms / 1000.0;
+}
+
+void BallLight::updateForTime(double t, LightRandom& rng)
+{
+    bool bUseOffset = false;
+
+    if (m_animStart == 0 || m_animEnd == 0 || m_animStart >= m_animEnd) {
+        m_animStart = t;
+        m_animEnd = t + kBallLightAnimationDuration;
+        bUseOffset = true;
+    }
+
+    const LightColor& startColor = kDefaultBallColors[m_startColorIdx];
+    const LightColor& endColor = kDefaultBallColors[m_endColorIdx];
+
+    if (t <= m_animStart) {
+        m_animStart = t;
+        m_animEnd = t + kBallLightAnimationDuration + getRandomOffset(bUseOffset, rng);
+        m_currColor = startColor;
+
+    } else if (t >= m_animEnd) {
+
+        m_currColor = endColor;
+
+        if (m_startColorIdx == m_endColorIdx) {
+            while (m_startColorIdx == m_endColorIdx) {
+                m_endColorIdx = randomBallColorIndex(rng);
+            }
+            m_animStart = t;
+            m_animEnd = t + kBallLightAnimationDuration + getRandomOffset(bUseOffset, rng);
+        } else {
+            m_startColorIdx = m_endColorIdx;
+            m_animStart = t;
+            m_animEnd = t + kBallLightAnimationHold + getRandomOffset(bUseOffset, rng);
+        }
+
+    } else {
+
+        float inter = (float)((t - m_animStart) / (m_animEnd - m_animStart));
+        m_currColor = startColor.blended(inter, endColor);
+    }
+}
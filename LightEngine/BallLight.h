@@ -0,0 +1,61 @@
+//
+//  BallLight.h
+//  ChristmasTreeVisualizer
+//
+//  Color animation for one WiFi ball light: fade from a start color to a
+//  random end color, hold it, then pick a new end color.  Time is in seconds
+//  on whatever clock the caller uses, as long as it never goes backwards.
+//
+
+#ifndef LIGHTENGINE_BALLLIGHT_H
+#define LIGHTENGINE_BALLLIGHT_H
+
+#include "LightEngineTypes.h"
+
+// Small xorshift generator so the engine does not depend on arc4random and
+// a given seed always replays the same show.
+class LightRandom {
+public:
+
+    explicit LightRandom(uint32_t seed = 0x2545F491) : m_state(seed ? seed : 1) {}
+
+    uint32_t next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+    // like arc4random_uniform, returns [0, bound)
+    uint32_t uniform(uint32_t bound) {
+        return bound ? (next() % bound) : 0;
+    }
+
+private:
+
+    uint32_t m_state;
+};
+
+class BallLight {
+public:
+
+    void reset(LightRandom& rng);
+
+    void updateForTime(double t, LightRandom& rng);
+
+    const LightColor& color() const { return m_currColor; }
+
+private:
+
+    double getRandomOffset(bool useOffset, LightRandom& rng) const;
+
+    double m_animStart = 0;
+    double m_animEnd = 0;
+
+    LightColor m_currColor = LightColor(1, 1, 1);
+
+    uint8_t m_startColorIdx = 0;
+    uint8_t m_endColorIdx = 0;
+};
+
+#endif // LIGHTENGINE_BALLLIGHT_H
@@ -0,0 +1,132 @@
+//
+//  HistoryRing.h
+//  ChristmasTreeVisualizer
+//
+//  Fixed-capacity history of frames, each Bins values wide, kept in one
+//  contiguous block.  Storage is bin-major: the history of a single bin is
+//  Frames consecutive values, so per-bin reductions over time (maxima,
+//  averages) walk memory linearly.  Pushing a frame overwrites the oldest
+//  one once the ring is full and never allocates.
+//
+//  Every pushed frame gets a sequence number that stays valid for as long
+//  as the frame is in the ring, which lets other structures refer to frames
+//  without copying them.
+//
+
+#ifndef HISTORYRING_H
+#define HISTORYRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+
+template <typename T, size_t Frames, size_t Bins>
+class HistoryRing {
+public:
+
+    typedef std::array<T, Bins> Frame;
+
+    static_assert(Frames > 0 && Bins > 0, "empty history");
+
+    // One frame; bins are Frames apart in memory.
+    class RowView {
+    public:
+        RowView(const T* base) : m_base(base) {}
+
+        T operator[](size_t bin) const { return m_base[bin * Frames]; }
+        size_t size() const { return Bins; }
+
+        Frame frame() const {
+            Frame f;
+            for (size_t b=0; b<Bins; b++) {
+                f[b] = m_base[b * Frames];
+            }
+            return f;
+        }
+
+    private:
+        const T* m_base;
+    };
+
+    // One bin over time, oldest first.  The values are at most two
+    // contiguous runs, firstRun() then secondRun().
+    class ColumnView {
+    public:
+        ColumnView(const T* column, size_t start, size_t count)
+        : m_column(column), m_start(start), m_count(count) {}
+
+        T operator[](size_t i) const { return m_column[(m_start + i) % Frames]; }
+        size_t size() const { return m_count; }
+
+        const T* firstRun(size_t& length) const {
+            length = std::min(m_count, Frames - m_start);
+            return m_column + m_start;
+        }
+
+        const T* secondRun(size_t& length) const {
+            length = m_count - std::min(m_count, Frames - m_start);
+            return m_column;
+        }
+
+    private:
+        const T* m_column;
+        size_t m_start;
+        size_t m_count;
+    };
+
+    HistoryRing() { clear(); }
+
+    void clear() {
+        m_next = 0;
+        m_count = 0;
+    }
+
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    bool full() const { return m_count == Frames; }
+    static size_t capacity() { return Frames; }
+    static size_t bins() { return Bins; }
+
+    // sequence of the oldest frame still held, and of the next push
+    uint32_t oldestSequence() const { return m_next - (uint32_t)m_count; }
+    uint32_t nextSequence() const { return m_next; }
+
+    // returns the sequence number of the new frame
+    uint32_t push(const T* frame) {
+        const uint32_t sequence = m_next++;
+        T* slot = m_data.data() + sequence % Frames;
+        for (size_t b=0; b<Bins; b++) {
+            slot[b * Frames] = frame[b];
+        }
+        if (m_count < Frames) {
+            m_count++;
+        }
+        return sequence;
+    }
+
+    uint32_t push(const Frame& frame) { return push(frame.data()); }
+
+    // sequence must be in [oldestSequence(), nextSequence())
+    T at(uint32_t sequence, size_t bin) const {
+        return m_data[bin * Frames + sequence % Frames];
+    }
+
+    // age 0 is the newest frame
+    RowView row(size_t age) const {
+        return RowView(m_data.data() + (m_next - 1 - (uint32_t)age) % Frames);
+    }
+
+    ColumnView column(size_t bin) const {
+        return ColumnView(m_data.data() + bin * Frames, oldestSequence() % Frames, m_count);
+    }
+
+private:
+
+    std::array<T, Frames * Bins> m_data;
+    uint32_t m_next = 0;
+    size_t m_count = 0;
+};
+
+#endif // HISTORYRING_H
@@ -0,0 +1,390 @@
+//
+//  LightEngine.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "LightEngine.h"
+
+#include <algorithm>
+#include <numeric>
+
+// a glide never stretches past this, e.g. after a pause in the frames
+static const double kMaxOutputGlide = 0.25;
+
+static float glideFraction(double currTime, double start, double duration)
+{
+    if (duration <= 0) {
+        return 1.f;
+    }
+    return (float)std::min(1.0, std::max(0.0, (currTime - start) / duration));
+}
+
+static uint8_t GetTreeByte(const TreeDisplayBits& treeBits)
+{
+    uint8_t r = 0;
+    for (size_t i=0; i<kNumTreeBits; i++) {
+        if (treeBits[i]) {
+            r = r | (1<<i);
+        }
+    }
+    return r;
+}
+
+//-------------------------------------------------------------------------------------------------
+//	LightEngine
+//-------------------------------------------------------------------------------------------------
+
+LightEngine::LightEngine(const LightEngineConfig& config)
+: m_config(config)
+{
+    m_simple.recentSpectrumSums.push(0);
+    m_simple.currentCount = 1;
+
+    m_balls.rng = LightRandom(config.randomSeed);
+    for (auto& ball : m_balls.balls) {
+        ball.reset(m_balls.rng);
+    }
+}
+
+void LightEngine::trackChanged()
+{
+    m_simple.recentLevels.clear();
+    m_simple.recentSpectrumSums.clear();
+    m_simple.currentLevelsMax.fill(0);
+    m_simple.currentSpectrumSumMax = 0;
+    m_simple.currentCount = 0;
+
+    m_ribbon.maxAvgIntensity = 0;
+    m_ribbon.addIntensity = 0;
+    m_ribbon.heldUpSum.fill(0);
+    m_ribbon.heldUpCount = 0;
+    m_ribbon.bHaveMaxSpectrumVals = false;
+
+    m_balls.currRibbonSum.fill(0);
+    m_balls.currRibbonCount = 0;
+    m_balls.recentRibbons.clear();
+}
+
+const LightEngineOutput& LightEngine::processSpectrum(const uint8_t* leftChannel,
+                                                      const uint8_t* rightChannel,
+                                                      double timestamp)
+{
+    SpectrumAnalysis& analysis = m_output.analysis;
+    generateSpectrumData(leftChannel, rightChannel, analysis);
+
+    m_output.silence = (analysis.spectSum / (analysis.spectrum.size() + 1)) < 3;
+
+    const uint8_t* spectrum = analysis.spectrum.data();
+    size_t specStart = analysis.fivePercentMin;
+    size_t specWidth = analysis.fivePercentMax - analysis.fivePercentMin;
+
+    // the band shrinks to the tree and ball counts, the ribbon grows from the balls
+    std::array<uint8_t, kNumTreeBits> simpleData;
+    SmallRibbonData smallRibbon;
+    RibbonData ribbonData;
+    m_resampler.resample(spectrum, specStart, specWidth, simpleData.data(), simpleData.size(), kResampleFilterBox);
+    m_resampler.resample(spectrum, specStart, specWidth, smallRibbon.data(), smallRibbon.size(), kResampleFilterBox);
+    if (m_config.emitRibbonIntensity) {
+        m_resampler.resample(smallRibbon.data(), 0, smallRibbon.size(), ribbonData.data(), ribbonData.size(), kResampleFilterLinear);
+    }
+
+    OutputLevels outputVals;
+    for (size_t i=0; i<kNumTreeBits; i++) {
+        outputVals[i] = simpleData[i]/256.f;
+    }
+
+    updateSimpleLights(outputVals, analysis.spectSum, timestamp);
+
+    m_output.ribbonWantsSend = false;
+    if (m_config.emitRibbonIntensity && analysis.spectSum > 0) {
+        updateRibbonLights(ribbonData, timestamp, m_output.treeWantsSend, m_output.beatDetected);
+    }
+
+    updateBallLights(smallRibbon, timestamp, m_output.beatDetected);
+
+    renderLights(timestamp);
+
+    return m_output;
+}
+
+const LightEngineOutput& LightEngine::advanceOutput(double timestamp)
+{
+    m_output.treeWantsSend = false;
+    m_output.ribbonWantsSend = false;
+    m_output.ballsWantSend = false;
+
+    renderLights(timestamp);
+
+    return m_output;
+}
+
+//-------------------------------------------------------------------------------------------------
+//	updateSimpleLights
+//-------------------------------------------------------------------------------------------------
+//
+void LightEngine::updateSimpleLights(const OutputLevels& outputVals, uint32_t spectSum, double currTime)
+{
+    SimpleLightsState& s = m_simple;
+
+    TreeDisplayBits treeBits(0);
+    bool beatDetected = false;
+
+    m_output.treeWantsSend = false;
+
+    double delta = currTime - s.prevTime;
+
+    OutputLevels currLevels = s.currentLevelsMax;
+    OutputLevels avgRecentLevels = s.recentLevels.mean();
+
+    for (size_t i=0; i<kNumTreeBits; i++) {
+        bool bAboveAvg = (currLevels[i] >= avgRecentLevels[i]);
+        bool bMinThreshold = currLevels[i] > 0.05;
+
+        if (bAboveAvg && bMinThreshold) {
+            treeBits.set(i);
+        }
+    }
+
+    uint32_t currSpectSum = spectSum;
+    if (!s.recentSpectrumSums.empty() && s.currentCount)
+    {
+        uint32_t maxSpectSum = s.recentSpectrumSums.max();
+        uint32_t minSpectSum = s.recentSpectrumSums.min();
+        uint32_t avgSpectSum = s.recentSpectrumSums.mean();
+
+        currSpectSum = s.currentSpectrumSumMax;
+
+        double range = maxSpectSum - minSpectSum;
+        double spectOffset = currSpectSum - minSpectSum;
+        bool bThreshold = spectOffset > 0.6 * range;
+        bool bAboveAvg = currSpectSum >= avgSpectSum;
+        beatDetected = bAboveAvg && bThreshold;
+
+        if (beatDetected) {
+            treeBits.set();
+        }
+    }
+
+    if ((delta * 1000 >= 150)) {
+
+        s.prevTime = currTime;
+
+        s.recentLevels.push(currLevels);
+        s.recentSpectrumSums.push(currSpectSum);
+
+        s.currentLevelsMax.fill(0);
+        s.currentSpectrumSumMax = 0;
+        s.currentCount = 0;
+
+        s.lastSetLevels = currLevels;
+        s.lastSetTreeBits = treeBits;
+        s.lastSetBeatDetected = beatDetected;
+
+        m_output.treeWantsSend = true;
+    }
+
+    for (size_t i=0; i<kNumTreeBits; i++) {
+        s.currentLevelsMax[i] = std::max(s.currentLevelsMax[i], outputVals[i]);
+    }
+    s.currentSpectrumSumMax = std::max(s.currentSpectrumSumMax, spectSum);
+    s.currentCount++;
+
+    m_output.beatDetected = s.lastSetBeatDetected;
+    m_output.treeBits = s.lastSetTreeBits;
+    m_output.treeByte = GetTreeByte(s.lastSetTreeBits) & 0xF;
+    m_output.treeLevels = s.lastSetLevels;
+}
+
+//-------------------------------------------------------------------------------------------------
+//	updateRibbonLights
+//-------------------------------------------------------------------------------------------------
+//
+void LightEngine::updateRibbonLights(const RibbonData& ribbonData, double currTime,
+                                     bool bForceUpdate, bool beatDetected)
+{
+    RibbonLightsState& s = m_ribbon;
+
+    double delta = currTime - s.prevTime;
+
+    if ((delta * 1000) >= 50 || bForceUpdate) {
+
+        s.prevTime = currTime;
+
+        RibbonData outIntensities = ribbonData;
+
+        if (s.heldUpCount) {
+            size_t numArr = s.heldUpCount + 1;
+            for (size_t i=0; i<kRibbonSize; i++) {
+                uint32_t sum = s.heldUpSum[i] + ribbonData[i];
+                outIntensities[i] = sum / numArr;
+            }
+        }
+
+        s.heldUpSum.fill(0);
+        s.heldUpCount = 0;
+
+        uint32_t totalIntensity = std::accumulate(outIntensities.begin(), outIntensities.end(), 0);
+        float avgIntensity = (float)totalIntensity / (float)outIntensities.size() / 255.f;
+        s.maxAvgIntensity = std::max(s.maxAvgIntensity, avgIntensity);
+
+        if (avgIntensity >= 0.5 || avgIntensity >= (0.75 * s.maxAvgIntensity)) {
+            s.addIntensity = 64;
+        } else {
+            s.addIntensity = (float)s.addIntensity * 0.3;
+        }
+
+        if (s.addIntensity < 10) {
+            s.addIntensity = 0;
+        }
+
+        if (s.bHaveMaxSpectrumVals) {
+            for (size_t i=0; i<kRibbonSize; i++) {
+                s.maxSpectrumVals[i] = std::max(outIntensities[i], s.maxSpectrumVals[i]);
+            }
+        } else {
+            s.maxSpectrumVals = outIntensities;
+            s.bHaveMaxSpectrumVals = true;
+        }
+
+        for (size_t i=0; i<kRibbonSize; i++) {
+
+            float maxVal = s.maxSpectrumVals[i];
+            maxVal = std::max(maxVal, 16.f);
+
+            float val = (float)outIntensities[i] / maxVal;
+
+            if (beatDetected) {
+                val = val * 2;
+            }
+
+            val = std::min(1.f, std::max(0.f, val));
+            outIntensities[i] = (val * 64) + s.addIntensity;
+        }
+
+        std::reverse(outIntensities.begin(),outIntensities.end());
+
+        s.fromRotatedOutput = m_output.ribbon;
+        s.lastSetRotatedOutput = outIntensities;
+        s.glideStart = currTime;
+        s.glideDuration = glides() ? std::min(delta, kMaxOutputGlide) : 0;
+        m_output.ribbonWantsSend = true;
+
+    } else {
+        for (size_t i=0; i<kRibbonSize; i++) {
+            s.heldUpSum[i] += ribbonData[i];
+        }
+        s.heldUpCount++;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------
+//	updateBallLights
+//-------------------------------------------------------------------------------------------------
+//
+void LightEngine::updateBallLights(const SmallRibbonData& smallRibbon, double currTime,
+                                   bool beatDetected)
+{
+    BallLightsState& s = m_balls;
+
+    for (size_t i=0; i<kNumBallLights; i++) {
+        s.currRibbonSum[i] += smallRibbon[i];
+    }
+    s.currRibbonCount++;
+
+    double deltaUpdate = currTime - s.prevTimeUpdate;
+
+    m_output.ballsWantSend = false;
+
+    if ((deltaUpdate * 1000) >= 100) {
+
+        s.prevTimeUpdate = currTime;
+
+        SmallRibbonData avgRibbon;
+        for (size_t i=0; i<kNumBallLights; i++) {
+            avgRibbon[i] = s.currRibbonSum[i] / s.currRibbonCount;
+        }
+        s.recentRibbons.push(avgRibbon);
+
+        s.currRibbonSum.fill(0);
+        s.currRibbonCount = 0;
+
+        SmallRibbonData recentMaxRibbon = s.recentRibbons.max();
+
+        for (size_t i=0; i<kNumBallLights; i++) {
+            s.fromIntensities[i] = ballIntensity(i, currTime);
+        }
+        s.glideStart = currTime;
+        s.glideDuration = glides() ? std::min(deltaUpdate, kMaxOutputGlide) : 0;
+
+        for (size_t i=0; i<kNumBallLights; i++) {
+            float inten = 0;
+            if (recentMaxRibbon[i]) {
+                inten = (float)avgRibbon[i] / (float)recentMaxRibbon[i];
+            }
+            if (beatDetected) {
+                inten *= 1.5;
+            }
+            s.lastSetIntensities[i] = std::min(1.f, std::max(0.f, inten));
+        }
+    }
+}
+
+float LightEngine::ballIntensity(size_t i, double currTime) const
+{
+    const BallLightsState& s = m_balls;
+    float f = glideFraction(currTime, s.glideStart, s.glideDuration);
+    if (f >= 1.f) {
+        return s.lastSetIntensities[i];
+    }
+    return s.fromIntensities[i] + (s.lastSetIntensities[i] - s.fromIntensities[i]) * f;
+}
+
+//-------------------------------------------------------------------------------------------------
+//	renderLights
+//-------------------------------------------------------------------------------------------------
+//
+// Output side of the ribbon and ball stages: the values the strand and the
+// balls show at currTime, between or right after analysis updates.
+//
+void LightEngine::renderLights(double currTime)
+{
+    if (m_config.emitRibbonIntensity) {
+        const RibbonLightsState& r = m_ribbon;
+        float f = glideFraction(currTime, r.glideStart, r.glideDuration);
+
+        RibbonData ribbon;
+        for (size_t i=0; i<kRibbonSize; i++) {
+            float from = r.fromRotatedOutput[i];
+            ribbon[i] = (uint8_t)(from + (r.lastSetRotatedOutput[i] - from) * f + 0.5f);
+        }
+        if (ribbon != m_output.ribbon) {
+            m_output.ribbon = ribbon;
+            m_output.ribbonWantsSend = true;
+        }
+    }
+
+    BallLightsState& s = m_balls;
+
+    if (((currTime - s.prevTimeAnimate) * 1000) >= 16) {
+
+        s.prevTimeAnimate = currTime;
+
+        for (size_t i=0; i<kNumBallLights; i++) {
+            BallLight& ball = s.balls[i];
+            ball.updateForTime(currTime, s.rng);
+
+            LightColor intenCol = ball.color();
+            if (!m_output.silence) {
+                intenCol = intenCol.scaled(ballIntensity(i, currTime));
+            }
+            m_output.ballColors[i] = intenCol;
+
+            m_output.ballFrame[i * 3 + 0] = (uint8_t)(intenCol.r * 255.0f);
+            m_output.ballFrame[i * 3 + 1] = (uint8_t)(intenCol.g * 255.0f);
+            m_output.ballFrame[i * 3 + 2] = (uint8_t)(intenCol.b * 255.0f);
+        }
+
+        m_output.ballsValid = true;
+        m_output.ballsWantSend = true;
+    }
+}
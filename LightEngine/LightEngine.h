@@ -0,0 +1,162 @@
+//
+//  LightEngine.h
+//  ChristmasTreeVisualizer
+//
+//  Platform-neutral analysis core of the visualizer.  Feed it one
+//  RenderVisualData frame and a timestamp (seconds, monotonic) and it
+//  produces the tree bits, LED ribbon intensities and ball light colors for
+//  that moment.  All state lives in fixed-size members so that, once
+//  constructed, processing a frame never touches the heap, and any number
+//  of engines can run side by side, each driving its own show.
+//
+
+#ifndef LIGHTENGINE_H
+#define LIGHTENGINE_H
+
+#include "LightEngineTypes.h"
+#include "SpectrumAnalysis.h"
+#include "SpectrumResampler.h"
+#include "BallLight.h"
+#include "SlidingWindowStats.h"
+
+struct LightEngineConfig {
+    bool emitRibbonIntensity = false;       // drive the 75 LED ribbon in addition to the tree bits
+    uint32_t randomSeed = 0x2545F491;       // seed for the ball light color picks
+
+    // When > 0, advanceOutput() is expected this many times a second in
+    // between frames and the ball and ribbon intensities glide from one
+    // analysis update to the next instead of stepping.
+    double outputRateHz = 0;
+};
+
+struct LightEngineOutput {
+    // analysis of the current frame, mostly for drawing
+    SpectrumAnalysis analysis;
+    bool silence = false;
+
+    // simple tree lights
+    TreeDisplayBits treeBits;
+    uint8_t treeByte = 0;
+    bool beatDetected = false;
+    OutputLevels treeLevels = {{0, 0, 0}};
+    bool treeWantsSend = false;
+
+    // LED ribbon, already reversed into strand order
+    RibbonData ribbon = {{0}};
+    bool ribbonWantsSend = false;
+
+    // WiFi ball lights
+    BallColors ballColors;
+    BallFrame ballFrame = {{0}};
+    bool ballsValid = false;
+    bool ballsWantSend = false;
+};
+
+class LightEngine {
+public:
+
+    explicit LightEngine(const LightEngineConfig& config = LightEngineConfig());
+
+    const LightEngineConfig& config() const { return m_config; }
+
+    // drop all history so the next frames start a fresh show
+    void trackChanged();
+
+    // RenderData is anything laid out like RenderVisualData
+    template <typename RenderData>
+    const LightEngineOutput& processRenderData(const RenderData& renderData, double timestamp) {
+        return processSpectrum(renderData.spectrumData[0], renderData.spectrumData[1], timestamp);
+    }
+
+    const LightEngineOutput& processSpectrum(const uint8_t* leftChannel,
+                                             const uint8_t* rightChannel,
+                                             double timestamp);
+
+    // Move the ball animation and the intensity glides on to timestamp
+    // without a new frame.  Only the ball and ribbon outputs change; the
+    // tree is only ever sent from processSpectrum().
+    const LightEngineOutput& advanceOutput(double timestamp);
+
+    const LightEngineOutput& output() const { return m_output; }
+
+private:
+
+    void updateSimpleLights(const OutputLevels& outputVals, uint32_t spectSum, double currTime);
+    void updateRibbonLights(const RibbonData& ribbonData, double currTime, bool bForceUpdate, bool beatDetected);
+    void updateBallLights(const SmallRibbonData& smallRibbon, double currTime, bool beatDetected);
+    void renderLights(double currTime);
+
+    bool glides() const { return m_config.outputRateHz > 0; }
+    float ballIntensity(size_t i, double currTime) const;
+
+    struct SimpleLightsState {
+        // the last 9 levels and 19 spectrum sums stored at the 150 ms ticks
+        SlidingWindowStats<OutputLevels, kLPFSize - 1, kWindowStatMean> recentLevels;
+        SlidingWindowStats<uint32_t, 19> recentSpectrumSums;
+
+        // running maxima of the frames since the last 150 ms tick
+        OutputLevels currentLevelsMax = {{0, 0, 0}};
+        uint32_t currentSpectrumSumMax = 0;
+        size_t currentCount = 0;
+
+        double prevTime = 0;
+
+        OutputLevels lastSetLevels = {{0, 0, 0}};
+        TreeDisplayBits lastSetTreeBits;
+        bool lastSetBeatDetected = false;
+    };
+
+    struct RibbonLightsState {
+        // frames held up between 50 ms ticks, kept as a running sum
+        std::array<uint32_t, kRibbonSize> heldUpSum = {{0}};
+        size_t heldUpCount = 0;
+
+        RibbonData maxSpectrumVals = {{0}};
+        bool bHaveMaxSpectrumVals = false;
+        float maxAvgIntensity = 0;
+        uint8_t addIntensity = 0;
+
+        double prevTime = 0;
+
+        // the strand glides from fromRotatedOutput to lastSetRotatedOutput
+        RibbonData fromRotatedOutput = {{0}};
+        RibbonData lastSetRotatedOutput = {{0}};
+        double glideStart = 0;
+        double glideDuration = 0;
+    };
+
+    struct BallLightsState {
+        // frames since the last 100 ms tick, kept as a running sum
+        std::array<uint32_t, kNumBallLights> currRibbonSum = {{0}};
+        size_t currRibbonCount = 0;
+
+        // per ball maximum of the last 60 averaged ribbons
+        SlidingWindowStats<SmallRibbonData, 60, kWindowStatMax> recentRibbons;
+
+        // intensities glide from fromIntensities to lastSetIntensities
+        std::array<float, kNumBallLights> fromIntensities = {{0}};
+        std::array<float, kNumBallLights> lastSetIntensities = {{0}};
+        double glideStart = 0;
+        double glideDuration = 0;
+
+        double prevTimeUpdate = 0;
+        double prevTimeAnimate = 0;
+
+        std::array<BallLight, kNumBallLights> balls;
+        LightRandom rng;
+    };
+
+    // Everything an instance needs is in here, nothing is shared between
+    // engines.  The small per-stage state every frame walks comes first,
+    // the larger output and resampler tables after it.
+    LightEngineConfig m_config;
+
+    SimpleLightsState m_simple;
+    RibbonLightsState m_ribbon;
+    BallLightsState m_balls;
+
+    LightEngineOutput m_output;
+    SpectrumResampler m_resampler;
+};
+
+#endif // LIGHTENGINE_H
@@ -0,0 +1,70 @@
+//
+//  LightEngineTypes.h
+//  ChristmasTreeVisualizer
+//
+//  Shared constants and value types for the platform-neutral light engine.
+//  Nothing in here may depend on AppKit, CoreGraphics or the iTunes SDK so
+//  the engine can be built and profiled on Linux.
+//
+
+#ifndef LIGHTENGINETYPES_H
+#define LIGHTENGINETYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <bitset>
+
+//-------------------------------------------------------------------------------------------------
+//	constants
+//-------------------------------------------------------------------------------------------------
+
+// mirror kVisualMaxDataChannels / kVisualNumSpectrumEntries from iTunesVisualAPI.h
+static const size_t kLightEngineMaxDataChannels = 2;
+static const size_t kLightEngineNumSpectrumEntries = 512;
+
+static const size_t kNumTreeBits = 3;
+static const size_t kRibbonSize = 75;
+static const size_t kSmallRibbonSize = 25;
+static const size_t kNumBallLights = 25;
+static const size_t kLPFSize = 10;
+
+static const double kBallLightAnimationDuration = 0.75;
+static const double kBallLightAnimationHold = kBallLightAnimationDuration * 4;
+static const double kBallLightAnimationPeriod = kBallLightAnimationDuration + kBallLightAnimationHold;
+
+//-------------------------------------------------------------------------------------------------
+//	typedefs
+//-------------------------------------------------------------------------------------------------
+
+typedef std::array<uint8_t, kLightEngineNumSpectrumEntries> MonoSpectrum;
+typedef std::array<uint8_t, kSmallRibbonSize> SmallRibbonData;
+typedef std::array<uint8_t, kRibbonSize> RibbonData;
+typedef std::array<float, kNumTreeBits> OutputLevels;
+typedef std::bitset<kNumTreeBits> TreeDisplayBits;
+
+struct LightColor {
+    float r = 0;
+    float g = 0;
+    float b = 0;
+
+    LightColor() {}
+    LightColor(float _r, float _g, float _b) : r(_r), g(_g), b(_b) {}
+
+    // same math as -[NSColor blendedColorWithFraction:ofColor:]
+    LightColor blended(float fraction, const LightColor& other) const {
+        return LightColor(r + (other.r - r) * fraction,
+                          g + (other.g - g) * fraction,
+                          b + (other.b - b) * fraction);
+    }
+
+    LightColor scaled(float s) const {
+        return LightColor(r * s, g * s, b * s);
+    }
+};
+
+typedef std::array<LightColor, kNumBallLights> BallColors;
+typedef std::array<uint8_t, kNumBallLights * 3> BallFrame;
+
+#endif // LIGHTENGINETYPES_H
@@ -0,0 +1,170 @@
+//
+//  LightThread.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "LightThread.h"
+
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+// Lights are audible-latency work; ask for the scheduler's fast lane.
+// Failing (e.g. no permission for SCHED_FIFO) just leaves the default.
+static void raiseThreadPriority()
+{
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+#elif defined(__linux__)
+    sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+LightThread::LightThread(const LightEngineConfig& config)
+: m_engine(config)
+{
+    m_thread = std::thread(&LightThread::run, this);
+}
+
+LightThread::~LightThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void LightThread::setOutputHandler(const OutputHandler& handler)
+{
+    std::lock_guard<std::mutex> lock(m_handlerMutex);
+    m_handler = handler;
+}
+
+uint64_t LightThread::submitFrame(const uint8_t* leftChannel, const uint8_t* rightChannel,
+                                  double timestamp, bool trackChanged)
+{
+    Frame& frame = m_frames.back();
+    memcpy(frame.left.data(), leftChannel, frame.left.size());
+    memcpy(frame.right.data(), rightChannel, frame.right.size());
+    frame.timestamp = timestamp;
+
+    if (trackChanged) {
+        m_trackChanged.store(true, std::memory_order_relaxed);
+    }
+    uint64_t sequence = m_frames.publish();
+
+    // taking the lock, however briefly, keeps the wake-up from slipping in
+    // between the lighting thread's check and its wait
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+    }
+    m_wake.notify_one();
+
+    return sequence;
+}
+
+const LightEngineOutput* LightThread::latestOutput(uint64_t* sequence)
+{
+    m_outputs.refresh();
+    if (m_outputs.frontSequence() == 0) {
+        return NULL;
+    }
+    const PublishedOutput& published = m_outputs.front();
+    if (sequence) {
+        *sequence = published.frameSequence;
+    }
+    return &published.output;
+}
+
+void LightThread::emit(const LightEngineOutput& output, uint64_t frameSequence)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_handlerMutex);
+        if (m_handler) {
+            m_handler(output);
+        }
+    }
+
+    PublishedOutput& published = m_outputs.back();
+    published.output = output;
+    published.frameSequence = frameSequence;
+    m_outputs.publish();
+}
+
+void LightThread::run()
+{
+    raiseThreadPriority();
+
+    const double outputRate = m_engine.config().outputRateHz;
+    const bool ticking = outputRate > 0;
+    const Clock::duration tickPeriod = ticking ?
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / outputRate)) :
+        Clock::duration::zero();
+
+    uint64_t lastSequence = 0;
+
+    // ties the output clock to the caller's timestamps
+    double lastFrameTimestamp = 0;
+    Clock::time_point lastFrameArrival;
+    Clock::time_point nextTick;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            auto wakeUp = [this] { return m_stop || m_frames.hasFresh(); };
+            if (ticking && lastSequence) {
+                m_wake.wait_until(lock, nextTick, wakeUp);
+            } else {
+                m_wake.wait(lock, wakeUp);
+            }
+            if (m_stop) {
+                return;
+            }
+        }
+
+        Clock::time_point now = Clock::now();
+
+        if (m_frames.refresh()) {
+            const Frame& frame = m_frames.front();
+            uint64_t sequence = m_frames.frontSequence();
+
+            if (sequence > lastSequence + 1) {
+                m_framesDropped.fetch_add(sequence - lastSequence - 1, std::memory_order_relaxed);
+            }
+            lastSequence = sequence;
+            lastFrameTimestamp = frame.timestamp;
+            lastFrameArrival = now;
+
+            if (m_trackChanged.exchange(false, std::memory_order_relaxed)) {
+                m_engine.trackChanged();
+            }
+            const LightEngineOutput& output = m_engine.processSpectrum(frame.left.data(), frame.right.data(), frame.timestamp);
+            emit(output, sequence);
+            m_framesProcessed.fetch_add(1, std::memory_order_relaxed);
+
+            double cost = std::chrono::duration<double>(Clock::now() - now).count();
+            double smoothedCost = m_frameCost.load(std::memory_order_relaxed);
+            smoothedCost = (smoothedCost == 0) ? cost : smoothedCost * 0.875 + cost * 0.125;
+            m_frameCost.store(smoothedCost, std::memory_order_relaxed);
+            m_meanLevel.store((double)output.analysis.spectSum / output.analysis.spectrum.size(), std::memory_order_relaxed);
+
+            nextTick = now + tickPeriod;
+
+        } else if (ticking && now >= nextTick) {
+            double timestamp = lastFrameTimestamp + std::chrono::duration<double>(now - lastFrameArrival).count();
+            emit(m_engine.advanceOutput(timestamp), lastSequence);
+            m_outputTicks.fetch_add(1, std::memory_order_relaxed);
+
+            // a late tick is not made up for, the next one is a period on
+            nextTick += tickPeriod;
+            if (nextTick <= now) {
+                nextTick = now + tickPeriod;
+            }
+        }
+    }
+}
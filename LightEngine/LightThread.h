@@ -0,0 +1,119 @@
+//
+//  LightThread.h
+//  ChristmasTreeVisualizer
+//
+//  Runs a LightEngine on its own high priority thread.  The host thread
+//  hands over spectrum frames with submitFrame(), which only copies the
+//  frame and wakes the thread; analysis and the output handler (the serial
+//  and UDP sends) then run on the lighting thread, so light timing no
+//  longer depends on when the UI gets around to drawing.
+//
+//  Frames go in and results come out through TripleBuffers, so neither the
+//  host thread nor the drawing thread ever waits on the lighting thread.
+//  Frames are latest-wins: one the lighting thread had no time for is
+//  skipped and counted, found by the gap in the frame sequence numbers.
+//
+//  With config.outputRateHz set the thread also keeps its own output clock
+//  and calls LightEngine::advanceOutput() at that rate between frames, so
+//  the ball and ribbon output rate does not depend on the host's pulse.
+//  Those ticks are timed from the latest frame's timestamp, so the caller's
+//  clock and the thread's do not need to agree.
+//
+
+#ifndef LIGHTTHREAD_H
+#define LIGHTTHREAD_H
+
+#include "LightEngine.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class LightThread {
+public:
+
+    // called on the lighting thread after every processed frame
+    typedef std::function<void(const LightEngineOutput&)> OutputHandler;
+
+    explicit LightThread(const LightEngineConfig& config = LightEngineConfig());
+    ~LightThread();
+
+    LightThread(const LightThread&) = delete;
+    LightThread& operator=(const LightThread&) = delete;
+
+    // Replaces the output handler.  Once this returns the previous handler
+    // is no longer running and will not be called again.
+    void setOutputHandler(const OutputHandler& handler);
+
+    // Copy one frame (kLightEngineNumSpectrumEntries bytes per channel) for
+    // the lighting thread.  timestamp is in seconds on a monotonic clock.
+    // Call from one thread only.  Returns the frame's sequence number.
+    uint64_t submitFrame(const uint8_t* leftChannel, const uint8_t* rightChannel,
+                         double timestamp, bool trackChanged);
+
+    // Newest published output, or NULL before the first frame.  Call from
+    // one thread only; the result stays valid until the next call.
+    // sequence, if given, receives the number of the last frame analysed
+    // for it; output ticks in between frames keep that number.
+    const LightEngineOutput* latestOutput(uint64_t* sequence = NULL);
+
+    uint64_t framesProcessed() const { return m_framesProcessed.load(std::memory_order_relaxed); }
+    uint64_t framesDropped() const { return m_framesDropped.load(std::memory_order_relaxed); }
+    uint64_t outputTicks() const { return m_outputTicks.load(std::memory_order_relaxed); }
+
+    // Seconds an analysed frame takes, output handler included, smoothed
+    // over the last few frames.  Readable from any thread.
+    double frameCost() const { return m_frameCost.load(std::memory_order_relaxed); }
+
+    // mean spectrum level (0-255) of the latest frame
+    double meanLevel() const { return m_meanLevel.load(std::memory_order_relaxed); }
+
+private:
+
+    struct Frame {
+        std::array<uint8_t, kLightEngineNumSpectrumEntries> left;
+        std::array<uint8_t, kLightEngineNumSpectrumEntries> right;
+        double timestamp = 0;
+    };
+
+    struct PublishedOutput {
+        LightEngineOutput output;
+        uint64_t frameSequence = 0;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    void run();
+    void emit(const LightEngineOutput& output, uint64_t frameSequence);
+
+    LightEngine m_engine;
+
+    // submitFrame() -> lighting thread
+    TripleBuffer<Frame> m_frames;
+    std::atomic<bool> m_trackChanged{false};    // kept apart so a skipped frame cannot lose it
+
+    // only orders the wake-up; the frame itself never waits on it
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+
+    // lighting thread -> drawing
+    TripleBuffer<PublishedOutput> m_outputs;
+
+    std::atomic<uint64_t> m_framesProcessed{0};
+    std::atomic<uint64_t> m_framesDropped{0};
+    std::atomic<uint64_t> m_outputTicks{0};
+    std::atomic<double> m_frameCost{0};
+    std::atomic<double> m_meanLevel{0};
+
+    std::mutex m_handlerMutex;
+    OutputHandler m_handler;
+
+    std::thread m_thread;
+};
+
+#endif // LIGHTTHREAD_H
@@ -0,0 +1,65 @@
+//
+//  PulseRateController.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "PulseRateController.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+PulseRateController::PulseRateController(const PulseRateConfig& config)
+: m_config(config)
+, m_rate(config.idleRateHz)
+{
+}
+
+uint32_t PulseRateController::update(const PulseActivity& activity)
+{
+    double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return update(activity, now);
+}
+
+uint32_t PulseRateController::update(const PulseActivity& activity, double timestamp)
+{
+    const PulseRateConfig& c = m_config;
+
+    if (activity.meanLevel >= c.quietLevel) {
+        m_heardSound = true;
+        m_lastSoundTime = timestamp;
+    }
+
+    m_active = activity.playing && activity.outputsConnected &&
+               m_heardSound && (timestamp - m_lastSoundTime) < c.silenceHold;
+
+    double target = c.idleRateHz;
+    if (m_active) {
+        // jump up with the music, settle back down slowly
+        if (activity.meanLevel > m_smoothedLevel) {
+            m_smoothedLevel = activity.meanLevel;
+        } else {
+            m_smoothedLevel = m_smoothedLevel * 0.9 + activity.meanLevel * 0.1;
+        }
+        double loudness = (m_smoothedLevel - c.quietLevel) / std::max(1.0, c.loudLevel - c.quietLevel);
+        loudness = std::min(1.0, std::max(0.0, loudness));
+        target = c.baseRateHz + (c.maxRateHz - c.baseRateHz) * loudness;
+    } else {
+        m_smoothedLevel = 0;
+    }
+
+    if (activity.frameCost > 0) {
+        target = std::min(target, c.budgetFraction / activity.frameCost);
+    }
+    target = std::min<double>(c.maxRateHz, std::max<double>(c.idleRateHz, target));
+
+    // small wobbles in loudness should not keep re-requesting the rate
+    uint32_t newRate = (uint32_t)std::lround(target);
+    bool bigChange = std::fabs(target - m_rate) >= c.changeThreshold * m_rate;
+    bool toBound = (newRate == c.idleRateHz || newRate == c.maxRateHz);
+    if (newRate != m_rate && (bigChange || toBound)) {
+        m_rate = newRate;
+    }
+
+    return m_rate;
+}
@@ -0,0 +1,61 @@
+//
+//  PulseRateController.h
+//  ChristmasTreeVisualizer
+//
+//  Picks the pulse rate to ask the host for.  Loud music with lights
+//  attached gets frames up to maxRateHz for the lowest latency; silence,
+//  stopped playback or nothing to drive drops to idleRateHz.  Whatever the
+//  activity, the rate is held low enough that the measured cost of a frame
+//  stays within budgetFraction of the time between pulses.
+//
+
+#ifndef PULSERATECONTROLLER_H
+#define PULSERATECONTROLLER_H
+
+#include <stdint.h>
+
+struct PulseRateConfig {
+    uint32_t idleRateHz = 1;
+    uint32_t baseRateHz = 10;           // playing, but quiet
+    uint32_t maxRateHz = 60;            // loud
+
+    double quietLevel = 3;              // mean spectrum level (0-255) below which it is silence, as in LightEngine
+    double loudLevel = 48;              // mean spectrum level at which maxRateHz is reached
+    double silenceHold = 2.0;           // seconds of silence before going idle
+    double budgetFraction = 0.5;        // share of the pulse period a frame may cost
+    double changeThreshold = 0.15;      // only change the rate when it moves by this fraction
+};
+
+struct PulseActivity {
+    bool playing = false;
+    bool outputsConnected = false;      // anything to send the lights to
+    double meanLevel = 0;               // mean spectrum level of the latest frame, 0-255
+    double frameCost = 0;               // seconds a frame takes to process and send, smoothed
+};
+
+class PulseRateController {
+public:
+
+    explicit PulseRateController(const PulseRateConfig& config = PulseRateConfig());
+
+    // timestamp is in seconds on a monotonic clock; the first overload
+    // uses the steady clock
+    uint32_t update(const PulseActivity& activity);
+    uint32_t update(const PulseActivity& activity, double timestamp);
+
+    uint32_t rate() const { return m_rate; }
+    bool active() const { return m_active; }
+
+private:
+
+    PulseRateConfig m_config;
+
+    uint32_t m_rate;
+    bool m_active = false;
+
+    bool m_heardSound = false;
+    double m_lastSoundTime = 0;
+    double m_smoothedLevel = 0;
+};
+
+#endif // PULSERATECONTROLLER_H
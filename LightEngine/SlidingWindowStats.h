@@ -0,0 +1,232 @@
+//
+//  SlidingWindowStats.h
+//  ChristmasTreeVisualizer
+//
+//  Max, min and mean over the last Window samples in amortized O(1) per
+//  push, however long the window is.  Extrema come from monotonic queues of
+//  sample positions, the mean from a running sum.
+//
+//  Sample may be a scalar or a std::array, in which case every lane gets
+//  its own statistics (e.g. one max per ball over the last 60 ribbons).
+//  The Stats mask picks which statistics are tracked; the others cost
+//  nothing.  The samples themselves live in a HistoryRing, available via
+//  history() for anything that wants to look further.
+//
+
+#ifndef SLIDINGWINDOWSTATS_H
+#define SLIDINGWINDOWSTATS_H
+
+#include "HistoryRing.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <type_traits>
+
+enum {
+    kWindowStatMax      = 1 << 0,
+    kWindowStatMin      = 1 << 1,
+    kWindowStatMean     = 1 << 2,
+    kWindowStatAll      = kWindowStatMax | kWindowStatMin | kWindowStatMean,
+};
+
+template <typename T>
+struct WindowSampleTraits {
+    typedef T Element;
+    static const size_t kLanes = 1;
+    static Element& lane(T& v, size_t) { return v; }
+    static const Element& lane(const T& v, size_t) { return v; }
+};
+
+template <typename E, size_t N>
+struct WindowSampleTraits<std::array<E, N> > {
+    typedef E Element;
+    static const size_t kLanes = N;
+    static Element& lane(std::array<E, N>& v, size_t i) { return v[i]; }
+    static const Element& lane(const std::array<E, N>& v, size_t i) { return v[i]; }
+};
+
+template <typename Sample, size_t Window, unsigned Stats = kWindowStatAll>
+class SlidingWindowStats {
+public:
+
+    typedef WindowSampleTraits<Sample> Traits;
+    typedef typename Traits::Element Element;
+    typedef typename std::conditional<std::is_floating_point<Element>::value, double, int64_t>::type Sum;
+
+    static const size_t kLanes = Traits::kLanes;
+
+    typedef HistoryRing<Element, Window, kLanes> History;
+
+    static_assert(Window > 0, "empty window");
+    static_assert(Window < 0x10000, "queue positions are 16 bits");
+
+    SlidingWindowStats() { clear(); }
+
+    void clear() {
+        m_history.clear();
+        m_sums.clear();
+        m_maxQueue.clear();
+        m_minQueue.clear();
+    }
+
+    size_t size() const { return m_history.size(); }
+    bool empty() const { return m_history.empty(); }
+    static size_t window() { return Window; }
+
+    const History& history() const { return m_history; }
+
+    void push(const Sample& sample) {
+        if ((Stats & kWindowStatMean) && m_history.full()) {
+            const uint32_t evicted = m_history.oldestSequence();
+            for (size_t l=0; l<kLanes; l++) {
+                m_sums.values[l] -= m_history.at(evicted, l);
+            }
+        }
+
+        typename History::Frame lanes;
+        for (size_t l=0; l<kLanes; l++) {
+            lanes[l] = Traits::lane(sample, l);
+        }
+        const uint32_t pos = m_history.push(lanes);
+
+        if (Stats & kWindowStatMean) {
+            for (size_t l=0; l<kLanes; l++) {
+                m_sums.values[l] += lanes[l];
+            }
+        }
+        if (Stats & kWindowStatMax) {
+            m_maxQueue.push(m_history, pos, Greater());
+        }
+        if (Stats & kWindowStatMin) {
+            m_minQueue.push(m_history, pos, Less());
+        }
+    }
+
+    // Statistics of an empty window are zero, like the loops they replace.
+
+    Sample max() const {
+        static_assert(Stats & kWindowStatMax, "max is not tracked");
+        return m_maxQueue.front(m_history);
+    }
+
+    Sample min() const {
+        static_assert(Stats & kWindowStatMin, "min is not tracked");
+        return m_minQueue.front(m_history);
+    }
+
+    Sum sum(size_t lane = 0) const {
+        static_assert(Stats & kWindowStatMean, "mean is not tracked");
+        return m_sums.values[lane];
+    }
+
+    // integer samples divide like the integer loops did
+    Sample mean() const {
+        static_assert(Stats & kWindowStatMean, "mean is not tracked");
+        Sample result = Sample();
+        if (!m_history.empty()) {
+            for (size_t l=0; l<kLanes; l++) {
+                Traits::lane(result, l) = (Element)(m_sums.values[l] / (Sum)m_history.size());
+            }
+        }
+        return result;
+    }
+
+private:
+
+    struct Greater { bool operator()(const Element& a, const Element& b) const { return a >= b; } };
+    struct Less { bool operator()(const Element& a, const Element& b) const { return a <= b; } };
+
+    // Per lane ring of sample positions whose values are monotonic from
+    // front to back.  The front is the extremum of the window.  Positions
+    // are the low 16 bits of the history sequence numbers, which is all it
+    // takes to tell their age apart within the window.
+    template <bool Enabled, typename Dummy = void>
+    class MonotonicQueue {
+    public:
+
+        void clear() {
+            m_head.fill(0);
+            m_length.fill(0);
+        }
+
+        template <typename Keep>
+        void push(const History& history, uint32_t sequence, Keep keep) {
+            const uint16_t pos = (uint16_t)sequence;
+            for (size_t l=0; l<kLanes; l++) {
+                const Element v = history.at(sequence, l);
+                std::array<uint16_t, Window>& q = m_positions[l];
+                size_t head = m_head[l];
+                size_t length = m_length[l];
+
+                // drop positions that left the window
+                if (length && (uint16_t)(pos - q[head]) >= Window) {
+                    head = (head + 1) % Window;
+                    length--;
+                }
+
+                // drop positions that can never be the extremum again
+                while (length && !keep(history.at(sequenceOf(sequence, q[(head + length - 1) % Window]), l), v)) {
+                    length--;
+                }
+
+                q[(head + length) % Window] = pos;
+                m_head[l] = (uint16_t)head;
+                m_length[l] = (uint16_t)(length + 1);
+            }
+        }
+
+        Sample front(const History& history) const {
+            Sample result = Sample();
+            if (!history.empty()) {
+                const uint32_t newest = history.nextSequence() - 1;
+                for (size_t l=0; l<kLanes; l++) {
+                    Traits::lane(result, l) = history.at(sequenceOf(newest, m_positions[l][m_head[l]]), l);
+                }
+            }
+            return result;
+        }
+
+    private:
+
+        // full sequence number of a position no older than the window
+        static uint32_t sequenceOf(uint32_t newest, uint16_t pos) {
+            return newest - (uint16_t)((uint16_t)newest - pos);
+        }
+
+        std::array<std::array<uint16_t, Window>, kLanes> m_positions;
+        std::array<uint16_t, kLanes> m_head;
+        std::array<uint16_t, kLanes> m_length;
+    };
+
+    // an untracked statistic takes no room
+    template <typename Dummy>
+    class MonotonicQueue<false, Dummy> {
+    public:
+        void clear() {}
+        template <typename Keep>
+        void push(const History&, uint32_t, Keep) {}
+        Sample front(const History&) const { return Sample(); }
+    };
+
+    template <bool Enabled, typename Dummy = void>
+    struct RunningSums {
+        std::array<Sum, kLanes> values;
+        void clear() { values.fill(0); }
+    };
+
+    template <typename Dummy>
+    struct RunningSums<false, Dummy> {
+        Sum values[1];
+        void clear() {}
+    };
+
+    History m_history;
+
+    RunningSums<(Stats & kWindowStatMean) != 0> m_sums;
+    MonotonicQueue<(Stats & kWindowStatMax) != 0> m_maxQueue;
+    MonotonicQueue<(Stats & kWindowStatMin) != 0> m_minQueue;
+};
+
+#endif // SLIDINGWINDOWSTATS_H
@@ -0,0 +1,122 @@
+//
+//  SpectrumAnalysis.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "SpectrumAnalysis.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static_assert(kLightEngineNumSpectrumEntries % 16 == 0, "the downmix works on 16 bins at a time");
+
+//-------------------------------------------------------------------------------------------------
+//	downmixAndAccumulate
+//-------------------------------------------------------------------------------------------------
+//
+// spectrum[i] = (left[i] + right[i]) / 2 and cumulative[i] = running sum of spectrum
+//
+static void downmixAndAccumulate(const uint8_t* left, const uint8_t* right,
+                                 MonoSpectrum& spectrum, SpectrumPrefixSum& cumulative)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBit = _mm_set1_epi8(1);
+    __m128i base = _mm_setzero_si128();
+
+    for (size_t i=0; i<kLightEngineNumSpectrumEntries; i+=16) {
+        __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+
+        // _mm_avg_epu8 rounds up, take the carried bit back off to truncate like (l + r) / 2
+        __m128i m = _mm_sub_epi8(_mm_avg_epu8(l, r), _mm_and_si128(_mm_xor_si128(l, r), lowBit));
+        _mm_storeu_si128((__m128i*)(spectrum.data() + i), m);
+
+        // 8 bins fit a 16-bit prefix (8 * 255), widen to 32 bits when adding the running base
+        __m128i halves[2] = { _mm_unpacklo_epi8(m, zero), _mm_unpackhi_epi8(m, zero) };
+        for (int h=0; h<2; h++) {
+            __m128i x = halves[h];
+            x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+            x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+
+            __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(x, zero), base);
+            __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(x, zero), base);
+            _mm_storeu_si128((__m128i*)(cumulative.data() + i + h * 8), lo);
+            _mm_storeu_si128((__m128i*)(cumulative.data() + i + h * 8 + 4), hi);
+
+            base = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+    }
+#else
+    uint32_t sum = 0;
+    for (size_t i=0; i<kLightEngineNumSpectrumEntries; i++) {
+        spectrum[i] = (left[i] + right[i]) / 2;
+        sum += spectrum[i];
+        cumulative[i] = sum;
+    }
+#endif
+}
+
+// the old loops compared the running sum against spectSum * fraction as a double
+static uint32_t energyThreshold(uint32_t spectSum, double fraction)
+{
+    return (uint32_t)std::ceil(spectSum * fraction);
+}
+
+size_t spectrumPercentileBin(const SpectrumAnalysis& analysis, double fraction)
+{
+    const SpectrumPrefixSum& cumulative = analysis.cumulative;
+    uint32_t threshold = energyThreshold(analysis.spectSum, fraction);
+
+    auto it = std::lower_bound(cumulative.begin(), cumulative.end(), threshold);
+    if (it == cumulative.end()) {
+        return 0;
+    }
+    return it - cumulative.begin();
+}
+
+size_t spectrumPercentileBinFromTop(const SpectrumAnalysis& analysis, double fraction)
+{
+    const SpectrumPrefixSum& cumulative = analysis.cumulative;
+    uint32_t threshold = energyThreshold(analysis.spectSum, fraction);
+    if (threshold > analysis.spectSum) {
+        return 0;
+    }
+
+    // energy from bin i up is spectSum - cumulative[i - 1]; find the highest i
+    // where that is still >= threshold, i.e. cumulative[i - 1] <= spectSum - threshold
+    uint32_t limit = analysis.spectSum - threshold;
+    auto it = std::upper_bound(cumulative.begin(), cumulative.end() - 1, limit);
+    return it - cumulative.begin();
+}
+
+void findSpectrumPercentiles(const SpectrumAnalysis& analysis,
+                             const double* fractions, size_t* bins, size_t count)
+{
+    for (size_t i=0; i<count; i++) {
+        bins[i] = spectrumPercentileBin(analysis, fractions[i]);
+    }
+}
+
+void generateSpectrumData(const uint8_t* leftChannel,
+                          const uint8_t* rightChannel,
+                          SpectrumAnalysis& analysis)
+{
+    downmixAndAccumulate(leftChannel, rightChannel, analysis.spectrum, analysis.cumulative);
+    analysis.spectSum = analysis.cumulative.back();
+
+    size_t fivePercentMin = spectrumPercentileBin(analysis, 0.05);
+    size_t fivePercentMax = spectrumPercentileBinFromTop(analysis, 0.05);
+
+    if (fivePercentMax <= fivePercentMin) {
+        fivePercentMax = fivePercentMin;
+    }
+
+    analysis.fivePercentMin = fivePercentMin;
+    analysis.fivePercentMax = fivePercentMax;
+}
@@ -0,0 +1,43 @@
+//
+//  SpectrumAnalysis.h
+//  ChristmasTreeVisualizer
+//
+//  Stereo spectrum reduction used by every light stage.  The downmix, the
+//  total and a running (prefix) sum come out of a single SIMD pass, after
+//  which any energy percentile is a binary search over the prefix sum.
+//
+
+#ifndef SPECTRUMANALYSIS_H
+#define SPECTRUMANALYSIS_H
+
+#include "LightEngineTypes.h"
+
+typedef std::array<uint32_t, kLightEngineNumSpectrumEntries> SpectrumPrefixSum;
+
+struct SpectrumAnalysis {
+    MonoSpectrum spectrum;          // (left + right) / 2
+    SpectrumPrefixSum cumulative;   // cumulative[i] = spectrum[0] + ... + spectrum[i]
+    uint32_t spectSum = 0;          // sum of spectrum
+    size_t fivePercentMin = 0;      // first bin where 5% of the energy lies below
+    size_t fivePercentMax = 0;      // first bin where 5% of the energy lies above
+};
+
+// Downmix the two kLightEngineNumSpectrumEntries-long channels and find the
+// band that holds the middle 90% of the spectral energy.
+void generateSpectrumData(const uint8_t* leftChannel,
+                          const uint8_t* rightChannel,
+                          SpectrumAnalysis& analysis);
+
+// First bin, counting up from the lowest, at which the accumulated energy
+// reaches fraction of the total.
+size_t spectrumPercentileBin(const SpectrumAnalysis& analysis, double fraction);
+
+// First bin, counting down from the highest, at which the accumulated energy
+// reaches fraction of the total.
+size_t spectrumPercentileBinFromTop(const SpectrumAnalysis& analysis, double fraction);
+
+// spectrumPercentileBin() for several fractions at once
+void findSpectrumPercentiles(const SpectrumAnalysis& analysis,
+                             const double* fractions, size_t* bins, size_t count);
+
+#endif // SPECTRUMANALYSIS_H
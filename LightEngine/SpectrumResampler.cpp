@@ -0,0 +1,201 @@
+//
+//  SpectrumResampler.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "SpectrumResampler.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static size_t roundUp(size_t v, size_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+SpectrumResampler::SpectrumResampler()
+: m_kernels(kNumCachedKernels)
+{
+}
+
+void SpectrumResampler::resample(const uint8_t* src, size_t srcStart, size_t srcLength,
+                                 uint8_t* dst, size_t dstLength,
+                                 ResampleFilter filter)
+{
+    if (dstLength == 0) {
+        return;
+    }
+
+    if (srcLength == 0 || srcLength > kMaxSourceLength || dstLength > kMaxDestLength) {
+        memset(dst, 0, dstLength);
+        return;
+    }
+
+    if (srcLength == dstLength) {
+        memcpy(dst, src + srcStart, dstLength);
+        return;
+    }
+
+    // rows may read up to kTapAlignment - 1 bytes past the run, keep those zero
+    alignas(16) uint8_t paddedSrc[kMaxSourceLength + kTapAlignment];
+    memcpy(paddedSrc, src + srcStart, srcLength);
+    memset(paddedSrc + srcLength, 0, kTapAlignment);
+
+    applyKernel(kernelFor(srcLength, dstLength, filter), paddedSrc, dst);
+}
+
+const SpectrumResampler::Kernel& SpectrumResampler::kernelFor(size_t srcLength, size_t dstLength, ResampleFilter filter)
+{
+    m_useCounter++;
+
+    const size_t set = (srcLength * 7 + dstLength + filter) % kKernelCacheSets;
+    const size_t firstWay = set * kKernelCacheWays;
+
+    size_t victim = firstWay;
+    for (size_t k=firstWay; k<firstWay + kKernelCacheWays; k++) {
+        KernelKey& key = m_keys[k];
+        if (key.valid &&
+            key.srcLength == srcLength &&
+            key.dstLength == dstLength &&
+            key.filter == filter) {
+            key.lastUse = m_useCounter;
+            m_cacheHits++;
+            return m_kernels[k];
+        }
+        if (!key.valid || (m_keys[victim].valid && key.lastUse < m_keys[victim].lastUse)) {
+            victim = k;
+        }
+    }
+
+    m_cacheMisses++;
+
+    KernelKey& key = m_keys[victim];
+    key.valid = true;
+    key.filter = filter;
+    key.srcLength = (uint16_t)srcLength;
+    key.dstLength = (uint16_t)dstLength;
+    key.lastUse = m_useCounter;
+
+    buildKernel(m_kernels[victim], srcLength, dstLength, filter);
+    return m_kernels[victim];
+}
+
+void SpectrumResampler::buildKernel(Kernel& kernel, size_t srcLength, size_t dstLength, ResampleFilter filter)
+{
+    const double step = (double)srcLength / (double)dstLength;
+    const double scale = std::max(1.0, step);
+
+    // support [lo, hi] of every row, clipped to the source
+    std::array<size_t, kMaxDestLength> lo;
+    std::array<size_t, kMaxDestLength> hi;
+    size_t maxWidth = 1;
+
+    for (size_t i=0; i<dstLength; i++) {
+        double x0, x1;
+        if (filter == kResampleFilterBox) {
+            x0 = i * step;
+            x1 = x0 + step;
+            lo[i] = (size_t)x0;
+            hi[i] = (size_t)std::ceil(x1) - 1;
+        } else {
+            double c = (i + 0.5) * step - 0.5;
+            x0 = c - scale;
+            x1 = c + scale;
+            lo[i] = (size_t)std::max(0.0, std::floor(x0) + 1);
+            hi[i] = (size_t)std::max(0.0, std::ceil(x1) - 1);
+        }
+        hi[i] = std::min(srcLength - 1, hi[i]);
+        lo[i] = std::min(lo[i], hi[i]);
+        maxWidth = std::max(maxWidth, hi[i] - lo[i] + 1);
+    }
+
+    const size_t paddedLength = roundUp(srcLength, kTapAlignment);
+    const size_t tapCount = std::min(paddedLength, roundUp(maxWidth, kTapAlignment));
+
+    kernel.dstLength = (uint16_t)dstLength;
+    kernel.tapCount = (uint16_t)tapCount;
+    std::fill(kernel.weights.begin(), kernel.weights.begin() + dstLength * tapCount, 0);
+
+    const int32_t one = 1 << kWeightBits;
+
+    for (size_t i=0; i<dstLength; i++) {
+
+        // slide the window left if it would read past the padded source
+        size_t first = std::min(lo[i], paddedLength - tapCount);
+        kernel.first[i] = (uint16_t)first;
+
+        const double x0 = i * step;
+        const double x1 = x0 + step;
+        const double c = (i + 0.5) * step - 0.5;
+
+        double rowWeights[kMaxSourceLength];
+        double total = 0;
+        for (size_t j=lo[i]; j<=hi[i]; j++) {
+            double w;
+            if (filter == kResampleFilterBox) {
+                w = std::min(x1, (double)(j + 1)) - std::max(x0, (double)j);
+            } else {
+                w = 1.0 - std::fabs((double)j - c) / scale;
+            }
+            w = std::max(0.0, w);
+            rowWeights[j - lo[i]] = w;
+            total += w;
+        }
+
+        // quantize the running total rather than each weight so the rounding
+        // errors cancel out and every row sums to exactly one
+        int16_t* row = &kernel.weights[i * tapCount];
+        const double norm = (total > 0) ? one / total : 0;
+        double cumulative = 0;
+        int32_t fixedCumulative = 0;
+
+        for (size_t j=lo[i]; j<hi[i]; j++) {
+            cumulative += rowWeights[j - lo[i]] * norm;
+            int32_t next = (int32_t)(cumulative + 0.5);
+            row[j - first] = (int16_t)(next - fixedCumulative);
+            fixedCumulative = next;
+        }
+        row[hi[i] - first] = (int16_t)(one - fixedCumulative);
+    }
+}
+
+void SpectrumResampler::applyKernel(const Kernel& kernel, const uint8_t* paddedSrc, uint8_t* dst)
+{
+    const size_t tapCount = kernel.tapCount;
+    const int32_t rounding = 1 << (kWeightBits - 1);
+
+    for (size_t i=0; i<kernel.dstLength; i++) {
+        const uint8_t* s = paddedSrc + kernel.first[i];
+        const int16_t* w = &kernel.weights[i * tapCount];
+
+        int32_t acc = 0;
+
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i vacc = _mm_setzero_si128();
+        for (size_t k=0; k<tapCount; k+=8) {
+            __m128i bytes = _mm_loadl_epi64((const __m128i*)(s + k));
+            __m128i samples = _mm_unpacklo_epi8(bytes, zero);
+            __m128i weights = _mm_loadu_si128((const __m128i*)(w + k));
+            vacc = _mm_add_epi32(vacc, _mm_madd_epi16(samples, weights));
+        }
+        vacc = _mm_add_epi32(vacc, _mm_shuffle_epi32(vacc, _MM_SHUFFLE(1, 0, 3, 2)));
+        vacc = _mm_add_epi32(vacc, _mm_shuffle_epi32(vacc, _MM_SHUFFLE(2, 3, 0, 1)));
+        acc = _mm_cvtsi128_si32(vacc);
+#else
+        // fixed trip count in multiples of 8 so the compiler vectorizes this (NEON on arm64)
+        for (size_t k=0; k<tapCount; k++) {
+            acc += (int32_t)s[k] * (int32_t)w[k];
+        }
+#endif
+
+        int32_t v = (acc + rounding) >> kWeightBits;
+        dst[i] = (uint8_t)std::min(255, std::max(0, v));
+    }
+}
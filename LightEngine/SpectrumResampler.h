@@ -0,0 +1,82 @@
+//
+//  SpectrumResampler.h
+//  ChristmasTreeVisualizer
+//
+//  Resamples a run of spectrum bytes to a different length.  The weights for
+//  a (srcLength, dstLength, filter) combination are computed once, stored as
+//  14-bit fixed point with every row padded to a multiple of 8 taps, and
+//  then applied with a SIMD multiply-accumulate.  A weight table does not
+//  depend on where the run starts, so any srcStart reuses the same entry.
+//
+//  The band the light stages resample moves a few bins every frame, so an
+//  LRU cache of recent tables is kept.  The table pool is allocated once by
+//  the constructor; resampling itself never allocates.
+//
+
+#ifndef SPECTRUMRESAMPLER_H
+#define SPECTRUMRESAMPLER_H
+
+#include "LightEngineTypes.h"
+
+#include <vector>
+
+enum ResampleFilter {
+    kResampleFilterBox,         // average the source area each output covers
+    kResampleFilterLinear,      // tent filter; plain linear interpolation when growing
+};
+
+class SpectrumResampler {
+public:
+
+    SpectrumResampler();
+
+    static const size_t kMaxSourceLength = kLightEngineNumSpectrumEntries;
+    static const size_t kMaxDestLength = 128;
+    static const size_t kKernelCacheSets = 16;
+    static const size_t kKernelCacheWays = 4;
+    static const size_t kNumCachedKernels = kKernelCacheSets * kKernelCacheWays;
+
+    // Resample src[srcStart, srcStart + srcLength) into dst[0, dstLength).
+    // An empty source, or lengths past the limits above, produce zeros.
+    void resample(const uint8_t* src, size_t srcStart, size_t srcLength,
+                  uint8_t* dst, size_t dstLength,
+                  ResampleFilter filter);
+
+    size_t cacheHits() const { return m_cacheHits; }
+    size_t cacheMisses() const { return m_cacheMisses; }
+
+private:
+
+    static const int kWeightBits = 14;
+    static const size_t kTapAlignment = 8;
+    static const size_t kMaxWeights = 2 * kMaxSourceLength + 10 * kMaxDestLength;
+
+    // kept apart from the weights so a lookup only touches one set of these
+    struct KernelKey {
+        bool valid = false;
+        ResampleFilter filter = kResampleFilterBox;
+        uint16_t srcLength = 0;
+        uint16_t dstLength = 0;
+        uint32_t lastUse = 0;
+    };
+
+    struct Kernel {
+        uint16_t dstLength = 0;
+        uint16_t tapCount = 0;              // taps per row, multiple of kTapAlignment
+
+        std::array<uint16_t, kMaxDestLength> first;
+        std::array<int16_t, kMaxWeights> weights;     // dstLength rows of tapCount
+    };
+
+    const Kernel& kernelFor(size_t srcLength, size_t dstLength, ResampleFilter filter);
+    static void buildKernel(Kernel& kernel, size_t srcLength, size_t dstLength, ResampleFilter filter);
+    static void applyKernel(const Kernel& kernel, const uint8_t* paddedSrc, uint8_t* dst);
+
+    std::array<KernelKey, kNumCachedKernels> m_keys;
+    std::vector<Kernel> m_kernels;
+    uint32_t m_useCounter = 0;
+    size_t m_cacheHits = 0;
+    size_t m_cacheMisses = 0;
+};
+
+#endif // SPECTRUMRESAMPLER_H
@@ -0,0 +1,93 @@
+//
+//  TripleBuffer.h
+//  ChristmasTreeVisualizer
+//
+//  Wait-free hand-off of the latest value from one writer thread to one
+//  reader thread.  The writer fills back() and publish()es it; the reader
+//  calls refresh() and then looks at front().  Neither side ever waits for
+//  the other, and the reader always sees a complete value.
+//
+//  Every published value carries a sequence number (1, 2, 3, ...).  A
+//  reader whose sequence jumps by more than one missed values; one whose
+//  sequence did not move is looking at the same value again.
+//
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+public:
+
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    //---- writer
+
+    T& back() { return m_slots[m_backIndex].value; }
+
+    // returns the sequence number given to the value
+    uint64_t publish() {
+        Slot& slot = m_slots[m_backIndex];
+        slot.sequence = ++m_publishedSequence;
+        m_backIndex = m_middle.exchange(m_backIndex | kFresh, std::memory_order_acq_rel) & kIndexMask;
+        return slot.sequence;
+    }
+
+    //---- reader
+
+    // true if a value newer than front() is waiting
+    bool hasFresh() const { return (m_middle.load(std::memory_order_acquire) & kFresh) != 0; }
+
+    // take the newest published value, if any; returns true if front() changed
+    bool refresh() {
+        if (!hasFresh()) {
+            return false;
+        }
+        m_frontIndex = m_middle.exchange(m_frontIndex, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+
+    const T& front() const { return m_slots[m_frontIndex].value; }
+
+    // 0 until the first refresh() that found a value
+    uint64_t frontSequence() const { return m_slots[m_frontIndex].sequence; }
+
+private:
+
+    static const uint8_t kIndexMask = 0x3;
+    static const uint8_t kFresh = 0x4;
+    static const size_t kCacheLine = 64;
+
+    struct Slot {
+        T value = T();
+        uint64_t sequence = 0;
+    };
+
+    std::array<Slot, 3> m_slots;
+
+    // The shared index and each side's own state sit on separate cache
+    // lines.  Padding rather than alignas, which operator new ignores
+    // before C++17.
+    char m_pad0[kCacheLine];
+    std::atomic<uint8_t> m_middle{1};
+    char m_pad1[kCacheLine];
+
+    // writer only
+    uint8_t m_backIndex = 0;
+    uint64_t m_publishedSequence = 0;
+    char m_pad2[kCacheLine];
+
+    // reader only
+    uint8_t m_frontIndex = 2;
+};
+
+#endif // TRIPLEBUFFER_H
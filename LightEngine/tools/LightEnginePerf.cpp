@@ -0,0 +1,116 @@
+//
+//  LightEnginePerf.cpp
+//  ChristmasTreeVisualizer
+//
+//  Drives the light engine with synthetic spectra so the production hot
+//  path can be run under perf / valgrind without iTunes.
+//
+//  usage: lightengine_perf [frames] [pulseRateHz] [outputRateHz] [instances]
+//
+//  With an output rate, advanceOutput() is called at that rate between
+//  frames the way the lighting thread does, and counted in the time per frame.
+//
+//  With several instances, that many engines are fed the same frames in
+//  turn.  Engines share no state, so every one of them must end up with the
+//  checksum a single engine gets; the time is per frame per engine.
+//
+
+#include "LightEngine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// same layout as RenderVisualData
+struct SyntheticRenderData {
+    uint8_t numSpectrumChannels = kLightEngineMaxDataChannels;
+    uint8_t spectrumData[kLightEngineMaxDataChannels][kLightEngineNumSpectrumEntries];
+};
+
+static void synthesizeFrame(SyntheticRenderData& frame, size_t frameIdx, LightRandom& rng)
+{
+    // a decaying low end with a kick every 5 frames and some hiss on top
+    bool kick = (frameIdx % 5) == 0;
+    for (size_t ch=0; ch<kLightEngineMaxDataChannels; ch++) {
+        for (size_t i=0; i<kLightEngineNumSpectrumEntries; i++) {
+            double base = 160.0 * std::exp(-(double)i / 60.0);
+            if (kick && i < 32) {
+                base += 60.0;
+            }
+            double v = base + (rng.uniform(24)) + 4.0 * std::sin(frameIdx * 0.3 + i * 0.05 + ch);
+            frame.spectrumData[ch][i] = (uint8_t)std::min(255.0, std::max(0.0, v));
+        }
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    size_t numFrames = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200000;
+    double pulseRate = (argc > 2) ? strtod(argv[2], NULL) : 60.0;
+    if (pulseRate <= 0) {
+        pulseRate = 60.0;
+    }
+    double outputRate = (argc > 3) ? strtod(argv[3], NULL) : 0;
+    size_t numInstances = (argc > 4) ? strtoul(argv[4], NULL, 10) : 1;
+    if (numInstances == 0) {
+        numInstances = 1;
+    }
+
+    LightEngineConfig config;
+    config.emitRibbonIntensity = true;
+    config.outputRateHz = outputRate;
+
+    std::vector<std::unique_ptr<LightEngine>> engines;
+    for (size_t e=0; e<numInstances; e++) {
+        engines.emplace_back(new LightEngine(config));
+    }
+    std::vector<uint64_t> checksums(numInstances, 0);
+
+    LightRandom rng(1234);
+    SyntheticRenderData frame;
+
+    std::chrono::nanoseconds busy(0);
+
+    for (size_t f=0; f<numFrames; f++) {
+        synthesizeFrame(frame, f, rng);
+        double t = 1.0 + (double)f / pulseRate;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t e=0; e<numInstances; e++) {
+            LightEngine& engine = *engines[e];
+            uint64_t& checksum = checksums[e];
+
+            const LightEngineOutput& out = engine.processRenderData(frame, t);
+            checksum = checksum * 31 + out.treeByte + out.ballFrame[f % out.ballFrame.size()] + out.ribbon[f % kRibbonSize];
+
+            if (outputRate > pulseRate) {
+                size_t ticks = (size_t)(outputRate / pulseRate);
+                for (size_t k=1; k<ticks; k++) {
+                    const LightEngineOutput& tick = engine.advanceOutput(t + k / outputRate);
+                    checksum = checksum * 31 + tick.ballFrame[(f + k) % tick.ballFrame.size()] + tick.ribbon[(f + k) % kRibbonSize];
+                }
+            }
+        }
+        busy += std::chrono::steady_clock::now() - start;
+    }
+
+    size_t mismatches = 0;
+    for (size_t e=1; e<numInstances; e++) {
+        if (checksums[e] != checksums[0]) {
+            mismatches++;
+        }
+    }
+
+    double nsPerFrame = (double)busy.count() / (double)(numFrames ? numFrames : 1) / numInstances;
+    printf("frames %zu  pulse %.1f Hz  output %.1f Hz  %.1f ns/frame  checksum %016llx\n",
+           numFrames, pulseRate, outputRate, nsPerFrame, (unsigned long long)checksums[0]);
+    if (numInstances > 1) {
+        printf("instances %zu  sizeof(LightEngine) %zu  mismatching %zu\n",
+               numInstances, sizeof(LightEngine), mismatches);
+    }
+    return mismatches ? 1 : 0;
+}
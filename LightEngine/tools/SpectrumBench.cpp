@@ -0,0 +1,170 @@
+//
+//  SpectrumBench.cpp
+//  ChristmasTreeVisualizer
+//
+//  Microbenchmark for generateSpectrumData.  Runs the fused downmix /
+//  prefix sum / percentile kernel next to a copy of the vector-based version
+//  that used to live in iTunesPlugInMac.mm, checks both agree, and prints
+//  the time per call.
+//
+//  usage: spectrum_bench [iterations]
+//
+
+#include "SpectrumAnalysis.h"
+#include "BallLight.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <numeric>
+#include <vector>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------
+//	legacyGenerateSpectrumData, as it was in iTunesPlugInMac.mm
+//-------------------------------------------------------------------------------------------------
+//
+static void legacyGenerateSpectrumData(const uint8_t* left, const uint8_t* right,
+                                       vector<uint8_t>& spectrumData,
+                                       uint32_t& spectSum,
+                                       size_t& fivePercentMin,
+                                       size_t& fivePercentMax)
+{
+    vector<uint8_t> leftSpectrumData, rightSpectrumData;
+    leftSpectrumData.reserve(kLightEngineNumSpectrumEntries);
+    rightSpectrumData.reserve(kLightEngineNumSpectrumEntries);
+    leftSpectrumData.assign(left, left + kLightEngineNumSpectrumEntries);
+    rightSpectrumData.assign(right, right + kLightEngineNumSpectrumEntries);
+
+    for (size_t i=0; i<kLightEngineNumSpectrumEntries; i++) {
+        spectrumData.push_back((leftSpectrumData[i] + rightSpectrumData[i]) / 2);
+    }
+
+    spectSum = accumulate(spectrumData.begin(), spectrumData.end(), 0);
+
+    {
+        uint32_t sumLimit = 0;
+        for(int i=spectrumData.size()-1;i>=0;i--){
+            sumLimit += spectrumData[i];
+            if(sumLimit >= spectSum*0.05){
+                fivePercentMax = i;
+                break;
+            }
+        }
+    }
+
+    {
+        uint32_t sumLimit = 0;
+        for(size_t i=0;i<spectrumData.size();i++){
+            sumLimit += spectrumData[i];
+            if(sumLimit >= spectSum*.05){
+                fivePercentMin = i;
+                break;
+            }
+        }
+    }
+
+    if (fivePercentMax <= fivePercentMin) {
+        fivePercentMax = fivePercentMin;
+    }
+}
+
+static const size_t kNumFrames = 64;
+
+struct StereoFrame {
+    uint8_t left[kLightEngineNumSpectrumEntries];
+    uint8_t right[kLightEngineNumSpectrumEntries];
+};
+
+static void fillFrames(vector<StereoFrame>& frames)
+{
+    LightRandom rng(42);
+    for (size_t f=0; f<frames.size(); f++) {
+        // a mix of quiet, loud, silent and band-limited frames
+        uint32_t ceiling = (f % 8 == 0) ? 1 : ((f % 3 == 0) ? 256 : 64);
+        size_t bandStart = rng.uniform(kLightEngineNumSpectrumEntries);
+        for (size_t i=0; i<kLightEngineNumSpectrumEntries; i++) {
+            bool inBand = (f % 5 != 0) || (i >= bandStart && i < bandStart + 40);
+            frames[f].left[i] = inBand ? (uint8_t)rng.uniform(ceiling) : 0;
+            frames[f].right[i] = inBand ? (uint8_t)rng.uniform(ceiling) : 0;
+        }
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200000;
+
+    vector<StereoFrame> frames(kNumFrames);
+    fillFrames(frames);
+
+    // correctness first
+    size_t mismatches = 0;
+    for (const auto& frame : frames) {
+        vector<uint8_t> legacySpectrum;
+        legacySpectrum.reserve(kLightEngineNumSpectrumEntries);
+        uint32_t legacySum = 0;
+        size_t legacyMin = 0, legacyMax = 0;
+        legacyGenerateSpectrumData(frame.left, frame.right, legacySpectrum, legacySum, legacyMin, legacyMax);
+
+        SpectrumAnalysis analysis;
+        generateSpectrumData(frame.left, frame.right, analysis);
+
+        bool same = (legacySum == analysis.spectSum) &&
+                    (legacyMin == analysis.fivePercentMin) &&
+                    (legacyMax == analysis.fivePercentMax) &&
+                    std::equal(legacySpectrum.begin(), legacySpectrum.end(), analysis.spectrum.begin());
+        if (!same) {
+            mismatches++;
+            printf("mismatch: sum %u/%u min %zu/%zu max %zu/%zu\n",
+                   legacySum, analysis.spectSum, legacyMin, analysis.fivePercentMin, legacyMax, analysis.fivePercentMax);
+        }
+    }
+
+    uint64_t sink = 0;
+
+    auto legacyStart = chrono::steady_clock::now();
+    for (size_t it=0; it<iterations; it++) {
+        const StereoFrame& frame = frames[it % kNumFrames];
+        vector<uint8_t> spectrumData;
+        spectrumData.reserve(kLightEngineNumSpectrumEntries);
+        uint32_t spectSum = 0;
+        size_t fivePercentMin = 0, fivePercentMax = 0;
+        legacyGenerateSpectrumData(frame.left, frame.right, spectrumData, spectSum, fivePercentMin, fivePercentMax);
+        sink += spectSum + fivePercentMin + fivePercentMax;
+    }
+    auto legacyEnd = chrono::steady_clock::now();
+
+    SpectrumAnalysis analysis;
+    auto fusedStart = chrono::steady_clock::now();
+    for (size_t it=0; it<iterations; it++) {
+        const StereoFrame& frame = frames[it % kNumFrames];
+        generateSpectrumData(frame.left, frame.right, analysis);
+        sink += analysis.spectSum + analysis.fivePercentMin + analysis.fivePercentMax;
+    }
+    auto fusedEnd = chrono::steady_clock::now();
+
+    // extra percentiles are only binary searches over the prefix sum
+    static const double kFractions[] = { 0.05, 0.25, 0.5, 0.75, 0.95 };
+    static const size_t kNumFractions = sizeof(kFractions) / sizeof(kFractions[0]);
+    size_t bins[kNumFractions];
+    auto percentileStart = chrono::steady_clock::now();
+    for (size_t it=0; it<iterations; it++) {
+        findSpectrumPercentiles(analysis, kFractions, bins, kNumFractions);
+        sink += bins[it % kNumFractions];
+    }
+    auto percentileEnd = chrono::steady_clock::now();
+
+    double legacyNs = chrono::duration<double, nano>(legacyEnd - legacyStart).count() / iterations;
+    double fusedNs = chrono::duration<double, nano>(fusedEnd - fusedStart).count() / iterations;
+    double percentileNs = chrono::duration<double, nano>(percentileEnd - percentileStart).count() / iterations;
+
+    printf("legacy generateSpectrumData  %8.1f ns/call\n", legacyNs);
+    printf("fused generateSpectrumData   %8.1f ns/call  (%.1fx)\n", fusedNs, legacyNs / fusedNs);
+    printf("%zu extra percentiles         %8.1f ns/call\n", kNumFractions, percentileNs);
+    printf("mismatches %zu of %zu frames  (sink %llu)\n", mismatches, kNumFrames, (unsigned long long)sink);
+
+    return mismatches ? 1 : 0;
+}
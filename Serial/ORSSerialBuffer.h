@@ -13,14 +13,40 @@
 #define NS_DESIGNATED_INITIALIZER
 #endif
 
+/**
+ *  Holds the most recent maximumLength bytes appended to it. Storage is allocated once,
+ *  and appending never moves the bytes already held, however long the buffer runs.
+ */
 @interface ORSSerialBuffer : NSObject
 
 - (instancetype)initWithMaximumLength:(NSUInteger)maxLength NS_DESIGNATED_INITIALIZER;
 
 - (void)appendData:(NSData *)data;
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length;
 - (void)clearBuffer;
 
+/**
+ *  A copy of the bytes held, oldest first.
+ */
 @property (nonatomic, strong, readonly) NSData *data;
+
+/**
+ *  The bytes held, oldest first, in place. They are always contiguous, so they
+ *  can be matched against without copying. Only valid until the buffer next changes.
+ */
+@property (nonatomic, readonly) const void *contiguousBytes;
+
+/**
+ *  The number of bytes held.
+ */
+@property (nonatomic, readonly) NSUInteger length;
+
 @property (nonatomic, readonly) NSUInteger maximumLength;
 
+/**
+ *  Whether appending and clearing send KVO change notifications for data. The default is NO,
+ *  so that a buffer fed a byte at a time doesn't pay for notifications nobody observes.
+ */
+@property (nonatomic) BOOL notifiesChanges;
+
 @end
@@ -9,8 +9,13 @@
 #import "ORSSerialBuffer.h"
 
 @interface ORSSerialBuffer ()
-
-@property (nonatomic, strong) NSMutableData *internalBuffer;
+{
+	// Ring of maximumLength bytes, stored twice over: the byte at ring index i is kept at both
+	// storage[i] and storage[i + maximumLength]. However the ring has wrapped, the bytes held
+	// can then be read in order starting at storage[head].
+	uint8_t *storage;
+	NSUInteger head;
+}
 
 @end
 
@@ -26,31 +31,64 @@
 {
 	self = [super init];
 	if (self) {
-		_internalBuffer = [NSMutableData data];
 		_maximumLength = maxLength;
+		storage = malloc(MAX(2 * maxLength, 1ul));
 	}
 	return self;
 }
 
+- (void)dealloc
+{
+	free(storage);
+}
+
 - (void)appendData:(NSData *)data
 {
-	[self willChangeValueForKey:@"internalBuffer"];
-	[self.internalBuffer appendData:data];
-	if ([self.internalBuffer length] > self.maximumLength) {
-		NSRange rangeToDelete = NSMakeRange(0, [self.internalBuffer length] - self.maximumLength);
-		[self.internalBuffer replaceBytesInRange:rangeToDelete withBytes:NULL length:0];
+	[self appendBytes:[data bytes] length:[data length]];
+}
+
+- (void)appendBytes:(const void *)bytes length:(NSUInteger)length
+{
+	NSUInteger capacity = self.maximumLength;
+	if (length == 0 || capacity == 0) return;
+	
+	if (self.notifiesChanges) [self willChangeValueForKey:@"data"];
+	
+	// Only the last capacity bytes can survive
+	if (length > capacity) {
+		bytes = (const uint8_t *)bytes + (length - capacity);
+		length = capacity;
+	}
+	
+	NSUInteger tail = (head + _length) % capacity;
+	NSUInteger firstRun = MIN(length, capacity - tail);
+	memcpy(storage + tail, bytes, firstRun);
+	memcpy(storage + tail + capacity, bytes, firstRun);
+	memcpy(storage, (const uint8_t *)bytes + firstRun, length - firstRun);
+	memcpy(storage + capacity, (const uint8_t *)bytes + firstRun, length - firstRun);
+	
+	if (_length + length > capacity) {
+		head = (head + _length + length - capacity) % capacity;
+		_length = capacity;
+	} else {
+		_length += length;
 	}
-	[self didChangeValueForKey:@"internalBuffer"];
+	
+	if (self.notifiesChanges) [self didChangeValueForKey:@"data"];
 }
 
 - (void)clearBuffer
 {
-	self.internalBuffer = [NSMutableData data];
+	if (self.notifiesChanges) [self willChangeValueForKey:@"data"];
+	head = 0;
+	_length = 0;
+	if (self.notifiesChanges) [self didChangeValueForKey:@"data"];
 }
 
 #pragma mark - Properties
 
-+ (NSSet *)keyPathsForValuesAffectingData { return [NSSet setWithObjects:@"internalData", nil]; }
-- (NSData *)data { return self.internalBuffer; }
++ (BOOL)automaticallyNotifiesObserversOfData { return NO; }
+- (NSData *)data { return [NSData dataWithBytes:self.contiguousBytes length:_length]; }
+- (const void *)contiguousBytes { return storage + head; }
 
 @end
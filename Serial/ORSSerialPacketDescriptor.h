@@ -191,6 +191,21 @@ typedef BOOL(^ORSSerialPacketEvaluator)(NSData * __nullable inputData);
  */
 - (nullable NSData *)packetMatchingAtEndOfBuffer:(nullable NSData *)buffer;
 
+/**
+ *  Like -packetMatchingAtEndOfBuffer:, but works on the bytes in place and returns only the
+ *  length of the packet, so nothing needs to be allocated or copied to find it.
+ *
+ *  Descriptors created with fixed packet data, or with a prefix and/or suffix, are matched
+ *  by comparing bytes directly. Other descriptors still hand candidate packets to their
+ *  response evaluator as `NSData`.
+ *
+ *  @param bytes  Data received from serial port.
+ *  @param length The number of bytes in bytes.
+ *
+ *  @return The length of the valid packet ending at bytes+length, or 0 if there is none.
+ */
+- (NSUInteger)lengthOfPacketAtEndOfBytes:(const void *)bytes length:(NSUInteger)length;
+
 /**
  *  The fixed packetData for packets described by the receiver. Will be nil for packet
  *  descriptors not created using -initWithPacketData:userInfo:
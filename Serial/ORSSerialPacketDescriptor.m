@@ -139,12 +139,46 @@
 
 - (NSData *)packetMatchingAtEndOfBuffer:(NSData *)buffer
 {
-	for (NSUInteger i=1; i<=[buffer length]; i++)
+	NSUInteger packetLength = [self lengthOfPacketAtEndOfBytes:[buffer bytes] length:[buffer length]];
+	if (!packetLength) return nil;
+	return [buffer subdataWithRange:NSMakeRange([buffer length]-packetLength, packetLength)];
+}
+
+- (NSUInteger)lengthOfPacketAtEndOfBytes:(const void *)bytes length:(NSUInteger)length
+{
+	const uint8_t *end = (const uint8_t *)bytes + length;
+	
+	if (self.packetData)
 	{
-		NSData *window = [buffer subdataWithRange:NSMakeRange([buffer length]-i, i)];
-		if ([self dataIsValidPacket:window]) return window;
+		NSUInteger packetLength = [self.packetData length];
+		if (packetLength == 0 || packetLength > length) return 0;
+		return memcmp(end - packetLength, [self.packetData bytes], packetLength) == 0 ? packetLength : 0;
 	}
-	return nil;
+	
+	if (self.prefix || self.suffix)
+	{
+		// Same result as trying each window from the shortest up, as the evaluator would
+		NSUInteger prefixLength = [self.prefix length];
+		NSUInteger suffixLength = [self.suffix length];
+		if (suffixLength > length) return 0;
+		if (suffixLength && memcmp(end - suffixLength, [self.suffix bytes], suffixLength) != 0) return 0;
+		
+		NSUInteger shortest = MAX(MAX(prefixLength, suffixLength), 1ul);
+		if (!prefixLength) return shortest <= length ? shortest : 0;
+		for (NSUInteger i=shortest; i<=length; i++)
+		{
+			if (memcmp(end - i, [self.prefix bytes], prefixLength) == 0) return i;
+		}
+		return 0;
+	}
+	
+	NSData *buffer = [NSData dataWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO];
+	for (NSUInteger i=1; i<=length; i++)
+	{
+		NSData *window = [buffer subdataWithRange:NSMakeRange(length-i, i)];
+		if ([self dataIsValidPacket:window]) return i;
+	}
+	return 0;
 }
 
 @end
@@ -0,0 +1,94 @@
+//
+//  ORSSerialPacketMatcher.h
+//  ORSSerialPort
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a
+//	copy of this software and associated documentation files (the
+//	"Software"), to deal in the Software without restriction, including
+//	without limitation the rights to use, copy, modify, merge, publish,
+//	distribute, sublicense, and/or sell copies of the Software, and to
+//	permit persons to whom the Software is furnished to do so, subject to
+//	the following conditions:
+//
+//	The above copyright notice and this permission notice shall be included
+//	in all copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+//	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+//	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+//	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#import <Foundation/Foundation.h>
+
+// Keep older versions of the compiler happy
+#ifndef NS_ASSUME_NONNULL_BEGIN
+#define NS_ASSUME_NONNULL_BEGIN
+#define NS_ASSUME_NONNULL_END
+#define nullable
+#define nonnullable
+#define __nullable
+#endif
+
+#ifndef NS_DESIGNATED_INITIALIZER
+#define NS_DESIGNATED_INITIALIZER
+#endif
+
+@class ORSSerialPacketDescriptor;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  An ORSSerialPacketMatcher finds the packets described by an ORSSerialPacketDescriptor in a
+ *  stream of bytes, one byte at a time. ORSSerialPort keeps one for each installed descriptor
+ *  and one for the response to the pending request.
+ *
+ *  Descriptors created with fixed packet data, or with a prefix and/or suffix, are compiled
+ *  into small automata over the prefix and suffix, so each byte costs O(1) amortized work and
+ *  nothing is copied until a packet is complete. The result is the same packet
+ *  -[ORSSerialPacketDescriptor packetMatchingAtEndOfBuffer:] would find in the last
+ *  maximumPacketLength bytes.
+ *
+ *  Descriptors with a response evaluator block or a regular expression can only be checked by
+ *  running them. They are handed windows of the last maximumPacketLength bytes, which are
+ *  views into the matcher's buffer rather than copies, so the cost per byte is bounded by
+ *  the descriptor's maximumPacketLength.
+ */
+@interface ORSSerialPacketMatcher : NSObject
+
+/**
+ *  Creates a matcher for the packets described by descriptor.
+ *
+ *  @param descriptor The descriptor of the packets to find.
+ *
+ *  @return An initialized ORSSerialPacketMatcher instance.
+ */
+- (instancetype)initWithDescriptor:(ORSSerialPacketDescriptor *)descriptor NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Feeds the matcher the next received byte.
+ *
+ *  Once a packet has been found, matching starts over with the following byte, as if
+ *  -reset had been called.
+ *
+ *  @param byte The received byte.
+ *
+ *  @return The complete packet ending with byte, or nil.
+ */
+- (nullable NSData *)packetEndingWithByte:(uint8_t)byte;
+
+/**
+ *  Forgets all bytes received so far.
+ */
+- (void)reset;
+
+/**
+ *  The descriptor of the packets the receiver finds.
+ */
+@property (nonatomic, strong, readonly) ORSSerialPacketDescriptor *descriptor;
+
+@end
+
+NS_ASSUME_NONNULL_END
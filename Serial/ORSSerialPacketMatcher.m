@@ -0,0 +1,221 @@
+//
+//  ORSSerialPacketMatcher.m
+//  ORSSerialPort
+//
+//	Permission is hereby granted, free of charge, to any person obtaining a
+//	copy of this software and associated documentation files (the
+//	"Software"), to deal in the Software without restriction, including
+//	without limitation the rights to use, copy, modify, merge, publish,
+//	distribute, sublicense, and/or sell copies of the Software, and to
+//	permit persons to whom the Software is furnished to do so, subject to
+//	the following conditions:
+//
+//	The above copyright notice and this permission notice shall be included
+//	in all copies or substantial portions of the Software.
+//
+//	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//	OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+//	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+//	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+//	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+//	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#import "ORSSerialPacketMatcher.h"
+#import "ORSSerialPacketDescriptor.h"
+#import "ORSSerialBuffer.h"
+
+typedef NS_ENUM(NSUInteger, ORSSerialPacketMatcherKind) {
+	ORSSerialPacketMatcherKindFixed = 0,	// packetData
+	ORSSerialPacketMatcherKindPrefixSuffix,
+	ORSSerialPacketMatcherKindEvaluator,	// response evaluator block or regular expression
+};
+
+// Knuth-Morris-Pratt automaton over one pattern. state is the length of the longest
+// prefix of the pattern that the stream currently ends with.
+typedef struct {
+	const uint8_t *pattern;
+	NSUInteger length;
+	NSUInteger *fallback;	// fallback[i] is the state to retry from after a mismatch in state i+1
+	NSUInteger state;
+} ORSPatternAutomaton;
+
+static void ORSPatternAutomatonInit(ORSPatternAutomaton *automaton, NSData *pattern)
+{
+	automaton->pattern = [pattern bytes];
+	automaton->length = [pattern length];
+	automaton->fallback = calloc(MAX(automaton->length, 1ul), sizeof(NSUInteger));
+	automaton->state = 0;
+
+	NSUInteger k = 0;
+	for (NSUInteger i=1; i<automaton->length; i++) {
+		while (k > 0 && automaton->pattern[i] != automaton->pattern[k]) k = automaton->fallback[k-1];
+		if (automaton->pattern[i] == automaton->pattern[k]) k++;
+		automaton->fallback[i] = k;
+	}
+}
+
+// Returns YES if the stream now ends with the whole pattern
+static inline BOOL ORSPatternAutomatonAdvance(ORSPatternAutomaton *automaton, uint8_t byte)
+{
+	if (!automaton->length) return YES;
+
+	NSUInteger state = automaton->state;
+	if (state == automaton->length) state = automaton->fallback[state-1];
+	while (state > 0 && byte != automaton->pattern[state]) state = automaton->fallback[state-1];
+	if (byte == automaton->pattern[state]) state++;
+	automaton->state = state;
+	return state == automaton->length;
+}
+
+@interface ORSSerialPacketMatcher ()
+{
+	ORSSerialPacketMatcherKind kind;
+	NSUInteger maximumLength;
+	NSUInteger shortestLength;
+
+	ORSPatternAutomaton prefixAutomaton;
+	ORSPatternAutomaton suffixAutomaton;
+
+	// Stream offsets at which the prefix starts, oldest first, within the last maximumLength bytes
+	NSUInteger *prefixStarts;
+	NSUInteger prefixStartsHead;
+	NSUInteger prefixStartsCount;
+
+	NSUInteger position;	// Bytes received since the last reset
+}
+
+@property (nonatomic, strong, readwrite) ORSSerialPacketDescriptor *descriptor;
+@property (nonatomic, strong) NSData *prefix;	// Kept so the automata's pattern bytes stay alive
+@property (nonatomic, strong) NSData *suffix;
+@property (nonatomic, strong) ORSSerialBuffer *buffer;
+
+@end
+
+@implementation ORSSerialPacketMatcher
+
+- (instancetype)init NS_UNAVAILABLE
+{
+	[NSException raise:NSInternalInconsistencyException format:@"Use -[ORSSerialPacketMatcher initWithDescriptor:]"];
+	return nil;
+}
+
+- (instancetype)initWithDescriptor:(ORSSerialPacketDescriptor *)descriptor
+{
+	self = [super init];
+	if (self) {
+		_descriptor = descriptor;
+		maximumLength = descriptor.maximumPacketLength;
+		_buffer = [[ORSSerialBuffer alloc] initWithMaximumLength:maximumLength];
+
+		if (descriptor.packetData) {
+			kind = ORSSerialPacketMatcherKindFixed;
+			_prefix = descriptor.packetData;
+		} else if (descriptor.prefix || descriptor.suffix) {
+			kind = ORSSerialPacketMatcherKindPrefixSuffix;
+			_prefix = descriptor.prefix;
+			_suffix = descriptor.suffix;
+		} else {
+			kind = ORSSerialPacketMatcherKindEvaluator;
+		}
+
+		ORSPatternAutomatonInit(&prefixAutomaton, _prefix);
+		ORSPatternAutomatonInit(&suffixAutomaton, _suffix);
+		shortestLength = MAX(MAX(prefixAutomaton.length, suffixAutomaton.length), 1ul);
+		prefixStarts = calloc(MAX(maximumLength, 1ul), sizeof(NSUInteger));
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(prefixAutomaton.fallback);
+	free(suffixAutomaton.fallback);
+	free(prefixStarts);
+}
+
+- (void)reset
+{
+	[self.buffer clearBuffer];
+	prefixAutomaton.state = 0;
+	suffixAutomaton.state = 0;
+	prefixStartsHead = 0;
+	prefixStartsCount = 0;
+	position = 0;
+}
+
+- (NSData *)packetEndingWithByte:(uint8_t)byte
+{
+	if (!maximumLength) return nil;
+	
+	[self.buffer appendBytes:&byte length:1];
+	position++;
+
+	NSUInteger packetLength = 0;
+	switch (kind) {
+		case ORSSerialPacketMatcherKindFixed:
+			if (ORSPatternAutomatonAdvance(&prefixAutomaton, byte) && prefixAutomaton.length) {
+				packetLength = prefixAutomaton.length;
+			}
+			break;
+		case ORSSerialPacketMatcherKindPrefixSuffix:
+			packetLength = [self prefixSuffixPacketLengthAfterByte:byte];
+			break;
+		case ORSSerialPacketMatcherKindEvaluator:
+			packetLength = [self evaluatedPacketLength];
+			break;
+	}
+	if (!packetLength || packetLength > maximumLength) return nil;
+
+	ORSSerialBuffer *buffer = self.buffer;
+	NSData *packet = [NSData dataWithBytes:(const uint8_t *)buffer.contiguousBytes + buffer.length - packetLength length:packetLength];
+	[self reset];
+	return packet;
+}
+
+#pragma mark - Private Methods
+
+- (NSUInteger)prefixSuffixPacketLengthAfterByte:(uint8_t)byte
+{
+	if (prefixAutomaton.length) {
+		if (ORSPatternAutomatonAdvance(&prefixAutomaton, byte)) {
+			if (prefixStartsCount == maximumLength) {
+				prefixStartsHead = (prefixStartsHead + 1) % maximumLength;
+				prefixStartsCount--;
+			}
+			prefixStarts[(prefixStartsHead + prefixStartsCount) % maximumLength] = position - prefixAutomaton.length;
+			prefixStartsCount++;
+		}
+
+		// Starts that have fallen out of the last maximumLength bytes can't begin a packet any more
+		while (prefixStartsCount && position - prefixStarts[prefixStartsHead] > maximumLength) {
+			prefixStartsHead = (prefixStartsHead + 1) % maximumLength;
+			prefixStartsCount--;
+		}
+	}
+
+	if (!ORSPatternAutomatonAdvance(&suffixAutomaton, byte)) return 0;
+
+	if (!prefixAutomaton.length) return position >= shortestLength ? shortestLength : 0;
+
+	// The shortest packet starts at the newest prefix that leaves room for the suffix
+	for (NSUInteger i=prefixStartsCount; i>0; i--) {
+		NSUInteger start = prefixStarts[(prefixStartsHead + i - 1) % maximumLength];
+		if (position - start >= shortestLength) return position - start;
+	}
+	return 0;
+}
+
+- (NSUInteger)evaluatedPacketLength
+{
+	ORSSerialBuffer *buffer = self.buffer;
+	const uint8_t *end = (const uint8_t *)buffer.contiguousBytes + buffer.length;
+	for (NSUInteger i=1; i<=buffer.length; i++)
+	{
+		NSData *window = [NSData dataWithBytesNoCopy:(void *)(end - i) length:i freeWhenDone:NO];
+		if ([self.descriptor dataIsValidPacket:window]) return i;
+	}
+	return 0;
+}
+
+@end
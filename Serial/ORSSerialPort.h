@@ -94,10 +94,11 @@ NS_ASSUME_NONNULL_BEGIN
  *  control settings can be set using the various properties `ORSSerialPort`
  *  provides. Note that all of these properties are Key Value Observing
  *  (KVO) compliant. This KVO compliance also applies to read-only
- *  properties for reading the state of the CTS, DSR and DCD pins. Among
- *  other things, this means it's easy to be notified when the state of one
- *  of these pins changes, without having to continually poll them, as well
- *  as making them easy to connect to a UI with Cocoa bindings.
+ *  properties for reading the state of the CTS, DSR and DCD pins, once
+ *  `monitorsModemLines` is set. Among other things, this means it's easy
+ *  to be notified when the state of one of these pins changes, without
+ *  having to continually poll them, as well as making them easy to connect
+ *  to a UI with Cocoa bindings.
  *
  *  Sending Data
  *  ------------
@@ -239,25 +240,55 @@ NS_ASSUME_NONNULL_BEGIN
 /**
  *  Sends data out through the serial port represented by the receiver.
  *
- *  This method attempts to send all data synchronously. That is, the method
- *  will not return until all passed in data has been sent, or an error has occurred.
+ *  This method never blocks. The data is copied into the port's send buffer and
+ *  written out in the background as the port is able to take it. Data sent with this
+ *  method is always sent in full and in order, behind anything queued before it.
  *
- *  If an error occurs, the ORSSerialPortDelegate method `-serialPort:didEncounterError:` will
- *  be called. The exception to this is if sending data fails because the port
- *  is closed. In that case, this method returns NO, but `-serialPort:didEncounterError:`
- *  is *not* called. You can ensure that the port is open by calling `-isOpen` before 
- *  calling this method.
+ *  If an error occurs while writing, the ORSSerialPortDelegate method
+ *  `-serialPort:didEncounterError:` will be called and the rest of the send buffer
+ *  is discarded. If the port is closed, this method returns NO, but
+ *  `-serialPort:didEncounterError:` is *not* called. You can ensure that the port is
+ *  open by calling `-isOpen` before calling this method.
  *
- *  @note This method can take a long time to return when a very large amount of data
- *  is passed in, due to the relatively slow nature of serial communication. It is better
- *  to send data in discrete short packets if possible.
+ *  @note The send buffer holds 4096 bytes. Data that does not fit in what is left of it
+ *  is not sent at all, and is counted in droppedByteCount. It is better to send data in
+ *  discrete short packets if possible.
  *
  *  @param data An `NSData` object containing the data to be sent.
  *
- *  @return YES if sending data succeeded, NO if an error occurred.
+ *  @return YES if the data was queued to be sent, NO if the port is closed or the send buffer is full.
  */
 - (BOOL)sendData:(NSData *)data;
 
+/**
+ *  Sends a frame that makes any earlier, not yet started frame obsolete.
+ *
+ *  Like `-sendData:` this method never blocks. The difference is that the latest frame
+ *  wins: if the previous frame sent with this method is still waiting in the send buffer
+ *  when a new one is sent, the previous frame is dropped and only the new one goes out.
+ *  A frame that has started going out is always finished. Dropped frames are counted
+ *  in droppedFrameCount and droppedByteCount.
+ *
+ *  Use this for data that describes current state, such as a frame of light levels,
+ *  where a slow device should fall behind by skipping frames rather than by queueing them.
+ *
+ *  @param data An `NSData` object containing the frame to be sent.
+ *
+ *  @return YES if the frame was queued to be sent, NO if the port is closed or the send buffer is full.
+ */
+- (BOOL)sendFrame:(NSData *)data;
+
+/**
+ *  Same as `-sendFrame:`, but copies the frame straight from bytes, so that
+ *  sending does not need an `NSData` to be allocated.
+ *
+ *  @param bytes  The frame to be sent.
+ *  @param length The length of the frame in bytes.
+ *
+ *  @return YES if the frame was queued to be sent, NO if the port is closed or the send buffer is full.
+ */
+- (BOOL)sendFrameBytes:(const void *)bytes length:(NSUInteger)length;
+
 /**
  *  Sends the data in request, and begins watching for a valid response to the request,
  *  to be delivered to the delegate.
@@ -267,8 +298,8 @@ NS_ASSUME_NONNULL_BEGIN
  *  and this method will return YES. If there are no pending requests, the request
  *  is sent immediately and NO is returned if an error occurs.
  *
- *  @note This method calls through to -sendData:, and the same caveat
- *  about it taking a long time to send very large requests applies.
+ *  @note This method calls through to -sendData:, and the same limit on the
+ *  amount of data that can be queued at once applies.
  *
  *  @param request An ORSSerialRequest instance including the data to be sent.
  *
@@ -412,6 +443,48 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (copy, readonly) NSString *name;
 
+/**
+ *  The queue on which received data, packets and request responses are delivered to the
+ *  delegate, along with `-serialPort:requestDidTimeout:`. The default, nil, means the main queue.
+ *
+ *  Everything received between two deliveries is handed over together: one
+ *  `-serialPort:didReceiveData:` call with all of the data, then one
+ *  `-serialPort:didReceivePacket:matchingDescriptor:` call per packet. Set this before
+ *  opening the port. Other delegate methods are always called on the main queue.
+ */
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong, nullable) dispatch_queue_t receiveCallbackQueue;
+#else
+@property (nonatomic, nullable) dispatch_queue_t receiveCallbackQueue;
+#endif
+
+/** ---------------------------------------------------------------------------------------
+ * @name Send Statistics
+ *  ---------------------------------------------------------------------------------------
+ */
+
+/**
+ *  The number of bytes written to the port since the receiver was created. (read-only)
+ */
+@property (readonly) unsigned long long sentByteCount;
+
+/**
+ *  The number of frames sent with `-sendFrame:` that were dropped, either because a
+ *  newer frame replaced them or because the send buffer was full. (read-only)
+ */
+@property (readonly) unsigned long long droppedFrameCount;
+
+/**
+ *  The number of bytes that were queued or passed in to be sent but were never
+ *  written to the port. (read-only)
+ */
+@property (readonly) unsigned long long droppedByteCount;
+
+/**
+ *  The number of bytes waiting in the send buffer. (read-only)
+ */
+@property (readonly) NSUInteger queuedByteCount;
+
 /** ---------------------------------------------------------------------------------------
  * @name Configuring the Serial Port
  *  ---------------------------------------------------------------------------------------
@@ -525,13 +598,25 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic) BOOL DTR;
 
+/**
+ *  A Boolean value indicating whether the receiver keeps CTS, DSR and DCD up to date
+ *  while it is open.
+ *
+ *  The pins are always read when the port is opened. Keeping them current means
+ *  polling them every 10 milliseconds, since the system has no way to wait for
+ *  them to change, so it is off by default. Whether the port is still present is
+ *  noticed when reading from or writing to it fails, not from the pins.
+ */
+@property (nonatomic) BOOL monitorsModemLines;
+
 /**
  *  The state of the serial port's CTS pin.
  *
  *  - YES means 1 or high state.
  *  - NO means 0 or low state.
  *
- *  This property is observable using Key Value Observing.
+ *  This property is observable using Key Value Observing. It only follows the pin
+ *  while `monitorsModemLines` is YES.
  */
 @property (nonatomic, readonly) BOOL CTS;
 
@@ -541,7 +626,8 @@ NS_ASSUME_NONNULL_BEGIN
  *  - YES means 1 or high state.
  *  - NO means 0 or low state.
  *
- *  This property is observable using Key Value Observing.
+ *  This property is observable using Key Value Observing. It only follows the pin
+ *  while `monitorsModemLines` is YES.
  */
 @property (nonatomic, readonly) BOOL DSR;
 
@@ -551,7 +637,8 @@ NS_ASSUME_NONNULL_BEGIN
  *  - YES means 1 or high state.
  *  - NO means 0 or low state.
  *
- *  This property is observable using Key Value Observing.
+ *  This property is observable using Key Value Observing. It only follows the pin
+ *  while `monitorsModemLines` is YES.
  */
 @property (nonatomic, readonly) BOOL DCD;
 
@@ -26,12 +26,15 @@
 
 #import "ORSSerialPort.h"
 #import "ORSSerialRequest.h"
-#import "ORSSerialBuffer.h"
+#import "ORSSerialPacketMatcher.h"
 #import <IOKit/serial/IOSerialKeys.h>
 #import <IOKit/serial/ioss.h>
 #import <sys/param.h>
 #import <sys/filio.h>
 #import <sys/ioctl.h>
+#import <pthread.h>
+#import <mach/mach_time.h>
+#import <stdatomic.h>
 
 #if !__has_feature(objc_arc)
 #error ORSSerialPort.m must be compiled with ARC. Either turn on ARC for the project or set the -fobjc-arc flag for ORSSerialPort.m in the Build Phases for this target
@@ -53,9 +56,54 @@
 
 static __strong NSMutableArray *allSerialPorts;
 
+// Size of the ring that -sendData: and -sendFrameBytes:length: queue into. Allocated once per port.
+static const NSUInteger ORSSerialPortSendBufferLength = 4096;
+
+// Queued bytes are only handed to the driver once its own output queue is down to this
+// many bytes, so that frames wait in the send buffer, where a newer frame can still replace them.
+// Ptys and many USB CDC drivers report an empty queue no matter what, so the bytes still going
+// out at the baud rate are estimated too, and the larger of the two counts.
+static const NSUInteger ORSSerialPortDriverQueueLowWater = 16;
+
+static uint64_t ORSSerialPortNanoseconds(void)
+{
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0) mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+// Size of the buffer that received data is read into and parsed in place. Allocated once per port.
+static const NSUInteger ORSSerialPortReceiveBufferLength = 1024;
+
 @interface ORSSerialPort ()
 {
 	struct termios originalPortAttributes;
+	
+	// Send ring. Guarded by sendLock; the bytes between sendHead and sendHead+sendCount are only
+	// read by the write queue, so it writes them out without holding the lock.
+	pthread_mutex_t sendLock;
+	uint8_t *sendBuffer;
+	NSUInteger sendHead;
+	NSUInteger sendCount;
+	NSUInteger latestFrameLength; // Bytes at the end of the ring that a newer frame may still replace
+	unsigned long long sentBytes;
+	unsigned long long droppedFrames;
+	unsigned long long droppedBytes;
+	
+	// Only touched on writeQueue
+	BOOL writeSourceSuspended;
+	NSUInteger sendBytesPerSecond;
+	uint64_t drainedAt; // When the bytes written so far should be out on the wire, from ORSSerialPortNanoseconds()
+	
+	// Only touched by the read source
+	uint8_t *receiveBuffer;
+	
+	// Received data and packets waiting to be delivered to the delegate. Guarded by receiveLock.
+	pthread_mutex_t receiveLock;
+	BOOL receiveBatchScheduled;
+	
+	// Set by whichever of the read and write paths notices the device is gone first
+	atomic_flag removalNoticed;
 }
 
 @property (copy, readwrite) NSString *path;
@@ -63,10 +111,16 @@ static __strong NSMutableArray *allSerialPorts;
 @property int fileDescriptor;
 @property (copy, readwrite) NSString *name;
 
-@property (strong) ORSSerialBuffer *requestResponseReceiveBuffer;
+@property (strong) ORSSerialPacketMatcher *requestResponseMatcher;
+
+// Received batches, guarded by receiveLock
+@property (nonatomic, strong) NSMutableData *receivedDataBatch;
+@property (nonatomic, strong) NSMutableArray *receivedPacketsBatch;
+@property (nonatomic, strong) NSMutableArray *receivedPacketDescriptorsBatch;
 
 // Packet descriptors
-@property (nonatomic, strong) NSMapTable *packetDescriptorsAndBuffers;
+@property (nonatomic, strong) NSMapTable *packetDescriptorsAndMatchers;
+@property (nonatomic, copy) NSArray *packetMatchers; // The map table's matchers, for walking once per byte
 
 // Request handling
 @property (nonatomic, strong) NSMutableArray *requestsQueue;
@@ -81,11 +135,19 @@ static __strong NSMutableArray *allSerialPorts;
 @property (nonatomic, strong) dispatch_source_t pinPollTimer;
 @property (nonatomic, strong) dispatch_source_t pendingRequestTimeoutTimer;
 @property (nonatomic, strong) dispatch_queue_t requestHandlingQueue;
+@property (nonatomic, strong) dispatch_queue_t writeQueue;
+@property (nonatomic, strong) dispatch_source_t writeSource;
+@property (nonatomic, strong) dispatch_source_t writeKickSource;
+@property (nonatomic, strong) dispatch_source_t writeRetryTimer;
 #else
 @property (nonatomic) dispatch_source_t readPollSource;
 @property (nonatomic) dispatch_source_t pinPollTimer;
 @property (nonatomic) dispatch_source_t pendingRequestTimeoutTimer;
 @property (nonatomic) dispatch_queue_t requestHandlingQueue;
+@property (nonatomic) dispatch_queue_t writeQueue;
+@property (nonatomic) dispatch_source_t writeSource;
+@property (nonatomic) dispatch_source_t writeKickSource;
+@property (nonatomic) dispatch_source_t writeRetryTimer;
 #endif
 
 @end
@@ -174,11 +236,18 @@ static __strong NSMutableArray *allSerialPorts;
 		self.path = bsdPath;
 		self.name = [[self class] modemNameFromDevice:device];
 		self.requestHandlingQueue = dispatch_queue_create("com.openreelsoftware.ORSSerialPort.requestHandlingQueue", 0);
+		self.writeQueue = dispatch_queue_create("com.openreelsoftware.ORSSerialPort.writeQueue", 0);
+		pthread_mutex_init(&sendLock, NULL);
+		sendBuffer = malloc(ORSSerialPortSendBufferLength);
+		sendBytesPerSecond = 11520;
+		pthread_mutex_init(&receiveLock, NULL);
+		receiveBuffer = malloc(ORSSerialPortReceiveBufferLength);
 #if MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_8
-		self.packetDescriptorsAndBuffers = [NSMapTable strongToStrongObjectsMapTable];
+		self.packetDescriptorsAndMatchers = [NSMapTable strongToStrongObjectsMapTable];
 #else
-		self.packetDescriptorsAndBuffers = [NSMapTable mapTableWithStrongToStrongObjects]; // Deprecated in 10.8.
+		self.packetDescriptorsAndMatchers = [NSMapTable mapTableWithStrongToStrongObjects]; // Deprecated in 10.8.
 #endif
+		self.packetMatchers = @[];
 		self.requestsQueue = [NSMutableArray array];
 		self.baudRate = @B19200;
 		self.allowsNonStandardBaudRates = NO;
@@ -190,6 +259,8 @@ static __strong NSMutableArray *allSerialPorts;
 		self.usesDCDOutputFlowControl = NO;
 		self.RTS = NO;
 		self.DTR = NO;
+		self.monitorsModemLines = NO;
+		atomic_flag_clear(&removalNoticed);
 	}
 	
 	[[self class] addSerialPort:self];
@@ -225,6 +296,17 @@ static __strong NSMutableArray *allSerialPorts;
 	}
 	
 	self.requestHandlingQueue = nil;
+	self.writeQueue = nil;
+	self.receiveCallbackQueue = nil;
+	
+	if (sendBuffer) {
+		free(sendBuffer);
+		pthread_mutex_destroy(&sendLock);
+	}
+	if (receiveBuffer) {
+		free(receiveBuffer);
+		pthread_mutex_destroy(&receiveLock);
+	}
 }
 
 - (NSString *)description
@@ -264,15 +346,11 @@ static __strong NSMutableArray *allSerialPorts;
 		return;
 	}
 	
-	// Now that the device is open, clear the O_NONBLOCK flag so subsequent I/O will block.
-	// See fcntl(2) ("man 2 fcntl") for details.
-	
-	if (fcntl(descriptor, F_SETFL, 0) == -1)
-	{
-		LOG_SERIAL_PORT_ERROR(@"Error clearing O_NONBLOCK %@ - %s(%d).\n", self.path, strerror(errno), errno);
-	}
+	// The descriptor is left non-blocking. Reads only happen once the read source says data is
+	// available, and writes go out from the write queue as the driver has room for them.
 	
 	self.fileDescriptor = descriptor;
+	atomic_flag_clear(&removalNoticed);
 	
 
 	// Port opened successfully, set options
@@ -294,55 +372,29 @@ static __strong NSMutableArray *allSerialPorts;
 		int localPortFD = self.fileDescriptor;
 		if (!self.isOpen) return;
 		
-		// Data is available
-		char buf[1024];
-		long lengthRead = read(localPortFD, buf, sizeof(buf));
+		// Data is available. It is read into the receive buffer and parsed there, a chunk at a time.
+		long lengthRead = read(localPortFD, self->receiveBuffer, ORSSerialPortReceiveBufferLength);
 		if (lengthRead>0)
 		{
-			NSData *readData = [NSData dataWithBytes:buf length:lengthRead];
-			if (readData != nil) [self receiveData:readData];
+			[self receiveBytes:self->receiveBuffer length:lengthRead];
+		}
+		else if (lengthRead == 0 || (errno != EAGAIN && errno != EINTR))
+		{
+			// With VMIN at 1, reading nothing from a readable port means it hung up
+			int error = lengthRead < 0 ? errno : 0;
+			if (error) [self notifyDelegateOfPosixError];
+			if (error == 0 || error == ENXIO || error == EIO || error == ENODEV) [self noticeSystemRemoval];
 		}
 	});
 	dispatch_source_set_cancel_handler(readPollSource, ^{ [self reallyClosePort]; });
 	dispatch_resume(readPollSource);
 	self.readPollSource = readPollSource;
 	
-	// Start another poller to check status of CTS and DSR
-	dispatch_queue_t pollQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, pollQueue);
-	dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, 0), 10*NSEC_PER_MSEC, 5*NSEC_PER_MSEC);
-	dispatch_source_set_event_handler(timer, ^{
-		if (!self.isOpen) {
-			dispatch_async(pollQueue, ^{ dispatch_source_cancel(timer); });
-			return;
-		}
-		
-		int32_t modemLines=0;
-		int result = ioctl(self.fileDescriptor, TIOCMGET, &modemLines);
-		if (result < 0)
-		{
-			[self notifyDelegateOfPosixErrorWaitingUntilDone:(errno == ENXIO)];
-			if (errno == ENXIO)
-			{
-				[self cleanupAfterSystemRemoval];
-			}
-			return;
-		}
-		
-		BOOL CTSPin = (modemLines & TIOCM_CTS) != 0;
-		BOOL DSRPin = (modemLines & TIOCM_DSR) != 0;
-		BOOL DCDPin = (modemLines & TIOCM_CAR) != 0;
-		
-		if (CTSPin != self.CTS)
-			dispatch_sync(mainQueue, ^{self.CTS = CTSPin;});
-		if (DSRPin != self.DSR)
-			dispatch_sync(mainQueue, ^{self.DSR = DSRPin;});
-		if (DCDPin != self.DCD)
-			dispatch_sync(mainQueue, ^{self.DCD = DCDPin;});
-	});
-	self.pinPollTimer = timer;
-	dispatch_resume(self.pinPollTimer);
-	ORS_GCD_RELEASE(timer);
+	[self startWriting];
+	
+	// CTS, DSR and DCD start out right either way; they are only kept up to date when asked for
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ [self readInputPins]; });
+	if (self.monitorsModemLines) [self startMonitoringModemLines];
 }
 
 - (BOOL)close;
@@ -355,6 +407,7 @@ static __strong NSMutableArray *allSerialPorts;
 - (void)reallyClosePort
 {
 	self.pinPollTimer = nil; // Stop polling CTS/DSR/DCD pins
+	[self stopWriting];
 	
 	// The next tcsetattr() call can fail if the port is waiting to send data. This is likely to happen
 	// e.g. if flow control is on and the CTS line is low. So, turn off flow control before proceeding
@@ -393,6 +446,13 @@ static __strong NSMutableArray *allSerialPorts;
 	[self cleanupAfterSystemRemoval];
 }
 
+// Called from the read and write paths, which can both run into the removal
+- (void)noticeSystemRemoval
+{
+	if (atomic_flag_test_and_set(&removalNoticed)) return;
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ [self cleanupAfterSystemRemoval]; });
+}
+
 - (void)cleanupAfterSystemRemoval
 {
 	if ([self.delegate respondsToSelector:@selector(serialPortWasRemovedFromSystem:)])
@@ -407,23 +467,20 @@ static __strong NSMutableArray *allSerialPorts;
 	if (!self.isOpen) return NO;
 	if ([data length] == 0) return YES;
 	
-	NSMutableData *writeBuffer = [data mutableCopy];
-	while ([writeBuffer length] > 0)
-	{
-		long numBytesWritten = write(self.fileDescriptor, [writeBuffer bytes], [writeBuffer length]);
-		if (numBytesWritten < 0)
-		{
-			LOG_SERIAL_PORT_ERROR(@"Error writing to serial port:%d", errno);
-			[self notifyDelegateOfPosixError];
-			return NO;
-		}
-		else if (numBytesWritten > 0)
-		{
-			[writeBuffer replaceBytesInRange:NSMakeRange(0, numBytesWritten) withBytes:NULL length:0];
-		}
-	}
+	return [self queueBytes:[data bytes] length:[data length] replaceable:NO];
+}
+
+- (BOOL)sendFrame:(NSData *)data;
+{
+	return [self sendFrameBytes:[data bytes] length:[data length]];
+}
+
+- (BOOL)sendFrameBytes:(const void *)bytes length:(NSUInteger)length;
+{
+	if (!self.isOpen) return NO;
+	if (length == 0) return YES;
 	
-	return YES;
+	return [self queueBytes:bytes length:length replaceable:YES];
 }
 
 - (BOOL)sendRequest:(ORSSerialRequest *)request
@@ -455,32 +512,235 @@ static __strong NSMutableArray *allSerialPorts;
 
 - (void)startListeningForPacketsMatchingDescriptor:(ORSSerialPacketDescriptor *)descriptor;
 {
-	if ([self.packetDescriptorsAndBuffers objectForKey:descriptor]) return; // Already listening
+	if ([self.packetDescriptorsAndMatchers objectForKey:descriptor]) return; // Already listening
 	
-	[self willChangeValueForKey:@"packetDescriptorsAndBuffers"];
+	[self willChangeValueForKey:@"packetDescriptorsAndMatchers"];
 	dispatch_sync(self.requestHandlingQueue, ^{
-		ORSSerialBuffer *buffer = [[ORSSerialBuffer alloc] initWithMaximumLength:descriptor.maximumPacketLength];
-		[self.packetDescriptorsAndBuffers setObject:buffer forKey:descriptor];
+		ORSSerialPacketMatcher *matcher = [[ORSSerialPacketMatcher alloc] initWithDescriptor:descriptor];
+		[self.packetDescriptorsAndMatchers setObject:matcher forKey:descriptor];
+		self.packetMatchers = NSAllMapTableValues(self.packetDescriptorsAndMatchers);
 	});
-	[self didChangeValueForKey:@"packetDescriptorsAndBuffers"];
+	[self didChangeValueForKey:@"packetDescriptorsAndMatchers"];
 }
 
 - (void)stopListeningForPacketsMatchingDescriptor:(ORSSerialPacketDescriptor *)descriptor;
 {
-	[self willChangeValueForKey:@"packetDescriptorsAndBuffers"];
-	dispatch_sync(self.requestHandlingQueue, ^{ [self.packetDescriptorsAndBuffers removeObjectForKey:descriptor]; });
-	[self didChangeValueForKey:@"packetDescriptorsAndBuffers"];
+	[self willChangeValueForKey:@"packetDescriptorsAndMatchers"];
+	dispatch_sync(self.requestHandlingQueue, ^{
+		[self.packetDescriptorsAndMatchers removeObjectForKey:descriptor];
+		self.packetMatchers = NSAllMapTableValues(self.packetDescriptorsAndMatchers);
+	});
+	[self didChangeValueForKey:@"packetDescriptorsAndMatchers"];
 }
 
 #pragma mark - Private Methods
 
+#pragma mark Asynchronous Writing
+
+// Copies bytes onto the end of the send ring and wakes the write queue. Never blocks on the port.
+- (BOOL)queueBytes:(const void *)bytes length:(NSUInteger)length replaceable:(BOOL)replaceable
+{
+	pthread_mutex_lock(&sendLock);
+	
+	if (replaceable && latestFrameLength > 0)
+	{
+		// The previous frame has not started going out yet, so it is stale. Drop it.
+		sendCount -= latestFrameLength;
+		droppedFrames++;
+		droppedBytes += latestFrameLength;
+	}
+	latestFrameLength = 0; // Anything already queued now has to go out ahead of these bytes
+	
+	if (sendCount + length > ORSSerialPortSendBufferLength)
+	{
+		if (replaceable) droppedFrames++;
+		droppedBytes += length;
+		pthread_mutex_unlock(&sendLock);
+		LOG_SERIAL_PORT_ERROR(@"Send buffer full, dropped %lu bytes for %@", (unsigned long)length, self.path);
+		return NO;
+	}
+	
+	NSUInteger tail = (sendHead + sendCount) % ORSSerialPortSendBufferLength;
+	NSUInteger firstRun = MIN(length, ORSSerialPortSendBufferLength - tail);
+	memcpy(sendBuffer + tail, bytes, firstRun);
+	memcpy(sendBuffer, (const uint8_t *)bytes + firstRun, length - firstRun);
+	sendCount += length;
+	if (replaceable) latestFrameLength = length;
+	
+	dispatch_source_t kick = self.writeKickSource;
+	pthread_mutex_unlock(&sendLock);
+	
+	if (kick) dispatch_source_merge_data(kick, 1);
+	return YES;
+}
+
+// Called from -open
+- (void)startWriting
+{
+	dispatch_sync(self.writeQueue, ^{
+		pthread_mutex_lock(&sendLock);
+		sendHead = 0;
+		sendCount = 0;
+		latestFrameLength = 0;
+		pthread_mutex_unlock(&sendLock);
+		
+		// Fires while the driver has room; only resumed while there are bytes it did not take
+		dispatch_source_t writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, self.fileDescriptor, 0, self.writeQueue);
+		dispatch_source_set_event_handler(writeSource, ^{ [self writeQueuedBytes]; });
+		self.writeSource = writeSource;
+		ORS_GCD_RELEASE(writeSource);
+		writeSourceSuspended = YES;
+		
+		// Wakes the write queue after bytes were queued, without allocating
+		dispatch_source_t kick = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_OR, 0, 0, self.writeQueue);
+		dispatch_source_set_event_handler(kick, ^{ [self writeQueuedBytes]; });
+		dispatch_resume(kick);
+		
+		// Wakes the write queue once the driver should have drained its queue
+		dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.writeQueue);
+		dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+		dispatch_source_set_event_handler(timer, ^{ [self writeQueuedBytes]; });
+		dispatch_resume(timer);
+		self.writeRetryTimer = timer;
+		ORS_GCD_RELEASE(timer);
+		
+		pthread_mutex_lock(&sendLock);
+		self.writeKickSource = kick;
+		pthread_mutex_unlock(&sendLock);
+		ORS_GCD_RELEASE(kick);
+	});
+}
+
+// Called from -reallyClosePort, before the file descriptor is closed
+- (void)stopWriting
+{
+	dispatch_sync(self.writeQueue, ^{
+		pthread_mutex_lock(&sendLock);
+		self.writeKickSource = nil;
+		sendCount = 0;
+		latestFrameLength = 0;
+		pthread_mutex_unlock(&sendLock);
+		
+		self.writeRetryTimer = nil;
+		if (self.writeSource && writeSourceSuspended) dispatch_resume(self.writeSource); // Sources can't be released suspended
+		writeSourceSuspended = NO;
+		self.writeSource = nil;
+	});
+	dispatch_sync(self.writeQueue, ^{}); // Let the cancellations run before the descriptor goes away
+}
+
+// Must only be called on writeQueue
+- (void)setWriteSourceRunning:(BOOL)running
+{
+	if (!self.writeSource || running != writeSourceSuspended) return;
+	if (running) {
+		dispatch_resume(self.writeSource);
+	} else {
+		dispatch_suspend(self.writeSource);
+	}
+	writeSourceSuspended = !running;
+}
+
+// Must only be called on writeQueue. Bytes written but, going by the baud rate, not yet sent.
+- (NSUInteger)bytesInFlightAt:(uint64_t)now
+{
+	if (drainedAt <= now) return 0;
+	return (NSUInteger)((drainedAt - now) * sendBytesPerSecond / NSEC_PER_SEC);
+}
+
+// Must only be called on writeQueue, with sendLock held. The newest frame is held back from replacement
+// while write() may be reading it. It becomes replaceable again if the write stopped short of it and
+// nothing has been queued behind it since.
+- (void)releaseHeldFrame:(NSUInteger)frameLength queuedAtWrite:(NSUInteger)queued written:(NSUInteger)written
+{
+	if (frameLength == 0 || written > queued - frameLength || sendCount != queued - written) return;
+	latestFrameLength = frameLength;
+}
+
+// Must only be called on writeQueue
+- (void)writeQueuedBytes
+{
+	int descriptor = self.fileDescriptor;
+	if (descriptor == 0 || !self.writeSource) return;
+	
+	uint64_t now = ORSSerialPortNanoseconds();
+	int driverQueued = 0;
+	if (ioctl(descriptor, TIOCOUTQ, &driverQueued) != 0 || driverQueued < 0) driverQueued = 0;
+	NSUInteger queued = MAX((NSUInteger)driverQueued, [self bytesInFlightAt:now]);
+	if (queued > ORSSerialPortDriverQueueLowWater)
+	{
+		// Come back once the driver has about drained, rather than spinning on the write source
+		uint64_t nanoseconds = (uint64_t)(queued - ORSSerialPortDriverQueueLowWater) * NSEC_PER_SEC / MAX(sendBytesPerSecond, 1ul);
+		dispatch_source_set_timer(self.writeRetryTimer, dispatch_time(DISPATCH_TIME_NOW, nanoseconds), DISPATCH_TIME_FOREVER, NSEC_PER_MSEC);
+		[self setWriteSourceRunning:NO];
+		return;
+	}
+	
+	for (;;)
+	{
+		pthread_mutex_lock(&sendLock);
+		NSUInteger heldFrameLength = latestFrameLength;
+		NSUInteger queued = sendCount;
+		latestFrameLength = 0; // May be going out now; see -releaseHeldFrame:queuedAtWrite:written:
+		NSUInteger head = sendHead;
+		NSUInteger length = MIN(sendCount, ORSSerialPortSendBufferLength - head);
+		pthread_mutex_unlock(&sendLock);
+		
+		if (length == 0)
+		{
+			[self setWriteSourceRunning:NO];
+			return;
+		}
+		
+		ssize_t numBytesWritten = write(descriptor, sendBuffer + head, length);
+		if (numBytesWritten < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+			{
+				pthread_mutex_lock(&sendLock);
+				[self releaseHeldFrame:heldFrameLength queuedAtWrite:queued written:0];
+				pthread_mutex_unlock(&sendLock);
+				[self setWriteSourceRunning:YES];
+				return;
+			}
+			
+			LOG_SERIAL_PORT_ERROR(@"Error writing to serial port:%d", errno);
+			BOOL removed = (errno == ENXIO);
+			pthread_mutex_lock(&sendLock);
+			droppedBytes += sendCount;
+			sendCount = 0;
+			pthread_mutex_unlock(&sendLock);
+			[self setWriteSourceRunning:NO];
+			[self notifyDelegateOfPosixError];
+			if (removed) [self noticeSystemRemoval];
+			return;
+		}
+		
+		pthread_mutex_lock(&sendLock);
+		sendHead = (head + numBytesWritten) % ORSSerialPortSendBufferLength;
+		sendCount -= numBytesWritten;
+		sentBytes += numBytesWritten;
+		[self releaseHeldFrame:heldFrameLength queuedAtWrite:queued written:numBytesWritten];
+		pthread_mutex_unlock(&sendLock);
+		drainedAt = MAX(drainedAt, now) + (uint64_t)numBytesWritten * NSEC_PER_SEC / MAX(sendBytesPerSecond, 1ul);
+		
+		if ((NSUInteger)numBytesWritten < length)
+		{
+			[self setWriteSourceRunning:YES];
+			return;
+		}
+	}
+}
+
+#pragma mark Requests
+
 // Must only be called on requestHandlingQueue (ie. wrap call to this method in dispatch())
 - (BOOL)reallySendRequest:(ORSSerialRequest *)request
 {
 	if (!self.pendingRequest)
 	{
-		NSUInteger bufferLength = request.responseDescriptor.maximumPacketLength;
-		self.requestResponseReceiveBuffer = [[ORSSerialBuffer alloc] initWithMaximumLength:bufferLength];
+		ORSSerialPacketDescriptor *responseDescriptor = request.responseDescriptor;
+		self.requestResponseMatcher = responseDescriptor ? [[ORSSerialPacketMatcher alloc] initWithDescriptor:responseDescriptor] : nil;
 		
 		// Send immediately
 		self.pendingRequest = request;
@@ -494,7 +754,7 @@ static __strong NSMutableArray *allSerialPorts;
 		}
 		BOOL success = [self sendData:request.dataToSend];
 		// Immediately send next request if this one doesn't require a response
-		if (success) [self checkResponseToPendingRequestAndContinueIfValidWithReceivedByte:nil];
+		if (success) [self checkResponseToPendingRequestAndContinueIfValidWithReceivedByte:NULL];
 		return success;
 	}
 	
@@ -526,7 +786,7 @@ static __strong NSMutableArray *allSerialPorts;
 		return;
 	}
 	
-	dispatch_async(dispatch_get_main_queue(), ^{
+	dispatch_async([self callbackQueue], ^{
 		[self.delegate serialPort:self requestDidTimeout:request];
 		dispatch_async(self.requestHandlingQueue, ^{
 			[self sendNextRequest];
@@ -535,7 +795,7 @@ static __strong NSMutableArray *allSerialPorts;
 }
 
 // Must only be called on requestHandlingQueue
-- (void)checkResponseToPendingRequestAndContinueIfValidWithReceivedByte:(NSData *)byte
+- (void)checkResponseToPendingRequestAndContinueIfValidWithReceivedByte:(const uint8_t *)byte
 {
 	if (!self.pendingRequest) return; // Nothing to do
 	
@@ -546,14 +806,13 @@ static __strong NSMutableArray *allSerialPorts;
 		return;
 	}
 	
-	[self.requestResponseReceiveBuffer appendData:byte];
-	NSData *responseData = [packetDescriptor packetMatchingAtEndOfBuffer:self.requestResponseReceiveBuffer.data];
+	NSData *responseData = [self.requestResponseMatcher packetEndingWithByte:*byte];
 	if (!responseData) return;
 	
 	self.pendingRequestTimeoutTimer = nil;
 	ORSSerialRequest *request = self.pendingRequest;
 	
-	dispatch_async(dispatch_get_main_queue(), ^{
+	dispatch_async([self callbackQueue], ^{
 		if ([responseData length] &&
 			[self.delegate respondsToSelector:@selector(serialPort:didReceiveResponse:toRequest:)])
 		{
@@ -566,48 +825,96 @@ static __strong NSMutableArray *allSerialPorts;
 
 #pragma mark Port Read/Write
 
-- (void)receiveData:(NSData *)data;
+// Called by the read source with a chunk in receiveBuffer
+- (void)receiveBytes:(const uint8_t *)bytes length:(NSUInteger)length
 {
-	dispatch_async(dispatch_get_main_queue(), ^{
-		if ([self.delegate respondsToSelector:@selector(serialPort:didReceiveData:)])
-		{
-			[self.delegate serialPort:self didReceiveData:data];
-		}
-	});
+	BOOL wantsData = [self.delegate respondsToSelector:@selector(serialPort:didReceiveData:)];
 	
-	dispatch_async(self.requestHandlingQueue, ^{
-		const void *bytes = [data bytes];
-		for (NSUInteger i=0; i<[data length]; i++) {
-			
-			NSData *byte = [NSData dataWithBytesNoCopy:(void *)(bytes+i) length:1 freeWhenDone:NO];
+	// Synchronous, so the chunk is parsed straight out of receiveBuffer before the next read
+	dispatch_sync(self.requestHandlingQueue, ^{
+		BOOL haveBatch = NO;
+		if (wantsData) {
+			pthread_mutex_lock(&self->receiveLock);
+			if (!self.receivedDataBatch) self.receivedDataBatch = [NSMutableData dataWithCapacity:length];
+			[self.receivedDataBatch appendBytes:bytes length:length];
+			pthread_mutex_unlock(&self->receiveLock);
+			haveBatch = YES;
+		}
+		
+		for (NSUInteger i=0; i<length; i++) {
 			
 			// Check for packets we're listening for
-			for (ORSSerialPacketDescriptor *descriptor in self.packetDescriptorsAndBuffers)
+			for (ORSSerialPacketMatcher *matcher in self.packetMatchers)
 			{
-				// Append byte to buffer
-				ORSSerialBuffer *buffer = [self.packetDescriptorsAndBuffers objectForKey:descriptor];
-				[buffer appendData:byte];
-				
-				// Check for complete packet
-				NSData *completePacket = [descriptor packetMatchingAtEndOfBuffer:buffer.data];
-				if (![completePacket length]) continue;
+				// Check for complete packet. The matcher starts over after one.
+				NSData *completePacket = [matcher packetEndingWithByte:bytes[i]];
+				if (!completePacket) continue;
 				
-				// Complete packet received, so notify delegate then clear buffer
-				dispatch_async(dispatch_get_main_queue(), ^{
-					if ([self.delegate respondsToSelector:@selector(serialPort:didReceivePacket:matchingDescriptor:)])
-					{
-						[self.delegate serialPort:self didReceivePacket:completePacket matchingDescriptor:descriptor];
-					}
-				});
-				[buffer clearBuffer];
+				// Complete packet received, so queue it for the delegate
+				ORSSerialPacketDescriptor *descriptor = matcher.descriptor;
+				pthread_mutex_lock(&self->receiveLock);
+				if (!self.receivedPacketsBatch) {
+					self.receivedPacketsBatch = [NSMutableArray array];
+					self.receivedPacketDescriptorsBatch = [NSMutableArray array];
+				}
+				[self.receivedPacketsBatch addObject:completePacket];
+				[self.receivedPacketDescriptorsBatch addObject:descriptor];
+				pthread_mutex_unlock(&self->receiveLock);
+				haveBatch = YES;
 			}
 			
 			// Also check for response to pending request
-			[self checkResponseToPendingRequestAndContinueIfValidWithReceivedByte:byte];
+			[self checkResponseToPendingRequestAndContinueIfValidWithReceivedByte:bytes+i];
 		}
+		
+		if (haveBatch) [self scheduleReceivedBatchDelivery];
 	});
 }
 
+// Delivers everything received since the last delivery in one go. While a delivery
+// is waiting on the callback queue, newly received data just joins the batch.
+- (void)scheduleReceivedBatchDelivery
+{
+	pthread_mutex_lock(&receiveLock);
+	BOOL alreadyScheduled = receiveBatchScheduled;
+	receiveBatchScheduled = YES;
+	pthread_mutex_unlock(&receiveLock);
+	
+	if (!alreadyScheduled) dispatch_async([self callbackQueue], ^{ [self deliverReceivedBatch]; });
+}
+
+// Called on the callback queue
+- (void)deliverReceivedBatch
+{
+	pthread_mutex_lock(&receiveLock);
+	NSData *data = self.receivedDataBatch;
+	NSArray *packets = self.receivedPacketsBatch;
+	NSArray *descriptors = self.receivedPacketDescriptorsBatch;
+	self.receivedDataBatch = nil;
+	self.receivedPacketsBatch = nil;
+	self.receivedPacketDescriptorsBatch = nil;
+	receiveBatchScheduled = NO;
+	pthread_mutex_unlock(&receiveLock);
+	
+	id<ORSSerialPortDelegate> delegate = self.delegate;
+	if ([data length] && [delegate respondsToSelector:@selector(serialPort:didReceiveData:)])
+	{
+		[delegate serialPort:self didReceiveData:data];
+	}
+	
+	if ([packets count] && [delegate respondsToSelector:@selector(serialPort:didReceivePacket:matchingDescriptor:)])
+	{
+		for (NSUInteger i=0; i<[packets count]; i++) {
+			[delegate serialPort:self didReceivePacket:packets[i] matchingDescriptor:descriptors[i]];
+		}
+	}
+}
+
+- (dispatch_queue_t)callbackQueue
+{
+	return self.receiveCallbackQueue ?: dispatch_get_main_queue();
+}
+
 #pragma mark Port Propeties Methods
 
 - (void)setPortOptions;
@@ -656,6 +963,8 @@ static __strong NSMutableArray *allSerialPorts;
 	
 	// Set baud rate
 	cfsetspeed(&options, [[self baudRate] unsignedLongValue]);
+	NSUInteger bytesPerSecond = MAX([[self baudRate] unsignedLongValue] / 10, 1ul); // 8N1 is 10 bits a byte
+	dispatch_async(self.writeQueue, ^{ sendBytesPerSecond = bytesPerSecond; });
 	
 	int result = tcsetattr(self.fileDescriptor, TCSANOW, &options);
 	if (result != 0) {
@@ -811,17 +1120,49 @@ static __strong NSMutableArray *allSerialPorts;
 
 + (NSSet *)keyPathsForValuesAffectingPacketDescriptors
 {
-	return [NSSet setWithObject:@"packetDescriptorsAndBuffers"];
+	return [NSSet setWithObject:@"packetDescriptorsAndMatchers"];
 }
 
 - (NSArray *)packetDescriptors
 {
-	NSArray *result = NSAllMapTableKeys(self.packetDescriptorsAndBuffers);
+	NSArray *result = NSAllMapTableKeys(self.packetDescriptorsAndMatchers);
 	return result ?: @[];
 }
 
 - (BOOL)isOpen { return self.fileDescriptor != 0; }
 
+- (unsigned long long)sentByteCount
+{
+	pthread_mutex_lock(&sendLock);
+	unsigned long long result = sentBytes;
+	pthread_mutex_unlock(&sendLock);
+	return result;
+}
+
+- (unsigned long long)droppedFrameCount
+{
+	pthread_mutex_lock(&sendLock);
+	unsigned long long result = droppedFrames;
+	pthread_mutex_unlock(&sendLock);
+	return result;
+}
+
+- (unsigned long long)droppedByteCount
+{
+	pthread_mutex_lock(&sendLock);
+	unsigned long long result = droppedBytes;
+	pthread_mutex_unlock(&sendLock);
+	return result;
+}
+
+- (NSUInteger)queuedByteCount
+{
+	pthread_mutex_lock(&sendLock);
+	NSUInteger result = sendCount;
+	pthread_mutex_unlock(&sendLock);
+	return result;
+}
+
 - (void)setIoKitDevice:(io_object_t)device
 {
 	if (device != _IOKitDevice) {
@@ -922,6 +1263,71 @@ static __strong NSMutableArray *allSerialPorts;
 	}
 }
 
+#pragma mark Modem Lines
+
+// Darwin has no TIOCMIWAIT to wait for the lines to change, so watching them means polling
+- (void)startMonitoringModemLines
+{
+	dispatch_queue_t pollQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, pollQueue);
+	dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, 0), 10*NSEC_PER_MSEC, 5*NSEC_PER_MSEC);
+	dispatch_source_set_event_handler(timer, ^{
+		if (!self.isOpen) {
+			dispatch_async(pollQueue, ^{ dispatch_source_cancel(timer); });
+			return;
+		}
+		[self readInputPins];
+	});
+	self.pinPollTimer = timer;
+	dispatch_resume(self.pinPollTimer);
+	ORS_GCD_RELEASE(timer);
+}
+
+- (void)stopMonitoringModemLines
+{
+	self.pinPollTimer = nil;
+}
+
+// Must not be called on the main queue
+- (void)readInputPins
+{
+	if (!self.isOpen) return;
+	
+	int32_t modemLines=0;
+	int result = ioctl(self.fileDescriptor, TIOCMGET, &modemLines);
+	if (result < 0)
+	{
+		[self notifyDelegateOfPosixErrorWaitingUntilDone:(errno == ENXIO)];
+		if (errno == ENXIO) [self noticeSystemRemoval];
+		return;
+	}
+	
+	BOOL CTSPin = (modemLines & TIOCM_CTS) != 0;
+	BOOL DSRPin = (modemLines & TIOCM_DSR) != 0;
+	BOOL DCDPin = (modemLines & TIOCM_CAR) != 0;
+	
+	dispatch_queue_t mainQueue = dispatch_get_main_queue();
+	if (CTSPin != self.CTS)
+		dispatch_sync(mainQueue, ^{self.CTS = CTSPin;});
+	if (DSRPin != self.DSR)
+		dispatch_sync(mainQueue, ^{self.DSR = DSRPin;});
+	if (DCDPin != self.DCD)
+		dispatch_sync(mainQueue, ^{self.DCD = DCDPin;});
+}
+
+- (void)setMonitorsModemLines:(BOOL)flag
+{
+	if (flag == _monitorsModemLines) return;
+	_monitorsModemLines = flag;
+	
+	if (!self.isOpen) return;
+	if (flag) {
+		[self startMonitoringModemLines];
+	} else {
+		[self stopMonitoringModemLines];
+	}
+}
+
 - (void)updateModemLines
 {
 	if (![self isOpen]) return;
@@ -1008,4 +1414,63 @@ static __strong NSMutableArray *allSerialPorts;
 	}
 }
 
+- (void)setReceiveCallbackQueue:(dispatch_queue_t)receiveCallbackQueue
+{
+	if (receiveCallbackQueue != _receiveCallbackQueue)
+	{
+		ORS_GCD_RELEASE(_receiveCallbackQueue);
+		ORS_GCD_RETAIN(receiveCallbackQueue);
+		_receiveCallbackQueue = receiveCallbackQueue;
+	}
+}
+
+- (void)setWriteQueue:(dispatch_queue_t)writeQueue
+{
+	if (writeQueue != _writeQueue)
+	{
+		ORS_GCD_RELEASE(_writeQueue);
+		ORS_GCD_RETAIN(writeQueue);
+		_writeQueue = writeQueue;
+	}
+}
+
+- (void)setWriteSource:(dispatch_source_t)writeSource
+{
+	if (writeSource != _writeSource) {
+		if (_writeSource) {
+			dispatch_source_cancel(_writeSource);
+			ORS_GCD_RELEASE(_writeSource);
+		}
+		
+		ORS_GCD_RETAIN(writeSource);
+		_writeSource = writeSource;
+	}
+}
+
+- (void)setWriteKickSource:(dispatch_source_t)writeKickSource
+{
+	if (writeKickSource != _writeKickSource) {
+		if (_writeKickSource) {
+			dispatch_source_cancel(_writeKickSource);
+			ORS_GCD_RELEASE(_writeKickSource);
+		}
+		
+		ORS_GCD_RETAIN(writeKickSource);
+		_writeKickSource = writeKickSource;
+	}
+}
+
+- (void)setWriteRetryTimer:(dispatch_source_t)writeRetryTimer
+{
+	if (writeRetryTimer != _writeRetryTimer) {
+		if (_writeRetryTimer) {
+			dispatch_source_cancel(_writeRetryTimer);
+			ORS_GCD_RELEASE(_writeRetryTimer);
+		}
+		
+		ORS_GCD_RETAIN(writeRetryTimer);
+		_writeRetryTimer = writeRetryTimer;
+	}
+}
+
 @end
@@ -0,0 +1,546 @@
+//
+//  LinuxSerialPort.cpp
+//  ChristmasTreeVisualizer
+//
+
+#include "LinuxSerialPort.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include <algorithm>
+
+static speed_t speedForBaudRate(unsigned long baudRate)
+{
+    switch (baudRate) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 500000: return B500000;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+        default: return 0;
+    }
+}
+
+// Writes and reads that fail with these mean the device is gone
+static bool errorMeansRemoved(int error)
+{
+    return error == EIO || error == ENXIO || error == ENODEV;
+}
+
+// TIOCMIWAIT only returns for a line change or a hang-up; this signal, with
+// a handler that does nothing, is how stopping gets it to return early.  0
+// if the process already has a use for the signal, which is not taken over.
+static int modemWakeSignal()
+{
+    static int signal = [] {
+        int wake = SIGRTMIN + 1;
+        struct sigaction previous = {};
+        if (sigaction(wake, NULL, &previous) != 0 ||
+            (previous.sa_flags & SA_SIGINFO) || previous.sa_handler != SIG_DFL) {
+            return 0;
+        }
+
+        struct sigaction action = {};
+        action.sa_handler = [](int) {};
+        sigemptyset(&action.sa_mask);
+        sigaction(wake, &action, NULL);     // no SA_RESTART, so the ioctl fails with EINTR
+        return wake;
+    }();
+    return signal;
+}
+
+static const uint8_t kModemLineCTS = 0x01;
+static const uint8_t kModemLineDSR = 0x02;
+static const uint8_t kModemLineDCD = 0x04;
+
+LinuxSerialPort::LinuxSerialPort(const std::string& path)
+: m_path(path)
+, m_sendBuffer(kSendBufferLength)
+, m_receiveBuffer(kReceiveBufferLength)
+{
+}
+
+LinuxSerialPort::~LinuxSerialPort()
+{
+    close();
+}
+
+bool LinuxSerialPort::open(unsigned long baudRate)
+{
+    close();
+
+    speed_t speed = speedForBaudRate(baudRate);
+    if (speed == 0) {
+        errno = EINVAL;
+        return false;
+    }
+
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0) {
+        return false;
+    }
+
+    // like ORSSerialPort, one opener at a time
+    ioctl(m_fd, TIOCEXCL);
+
+    termios options;
+    if (tcgetattr(m_fd, &options) != 0) {
+        int error = errno;
+        closeDescriptors();
+        errno = error;
+        return false;
+    }
+    cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cflag &= ~(CRTSCTS | CSTOPB | PARENB);
+
+    // with VMIN 0 a read of nothing returns 0, which is how a hang-up reads
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    bool ok = tcsetattr(m_fd, TCSANOW, &options) == 0 && m_epoll >= 0 && m_wakeFd >= 0 && m_timerFd >= 0;
+    for (int fd : {m_fd, m_wakeFd, m_timerFd}) {
+        if (!ok) {
+            break;
+        }
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ok = epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+    if (!ok) {
+        int error = errno;
+        closeDescriptors();
+        errno = error;
+        return false;
+    }
+
+    tcflush(m_fd, TCIOFLUSH);
+
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sendHead = 0;
+        m_sendCount = 0;
+        m_latestFrameLength = 0;
+    }
+    m_wantsWritable = false;
+    m_bytesPerSecond = baudRate / 10.0;     // 8N1 is ten bits a byte
+    m_drainedAt = Clock::now();
+
+    m_stop.store(false, std::memory_order_relaxed);
+    m_open.store(true, std::memory_order_release);
+    m_thread = std::thread(&LinuxSerialPort::run, this);
+
+    readModemLines(m_fd);
+    if (m_monitorsModemLines) {
+        int fd = (modemWakeSignal() != 0) ? dup(m_fd) : -1;
+        if (fd >= 0) {
+            m_modemStop.store(false);
+            m_modemDone.store(false);
+            m_modemThread = std::thread(&LinuxSerialPort::monitorModemLines, this, fd);
+        }
+    }
+
+    return true;
+}
+
+void LinuxSerialPort::close()
+{
+    stopMonitoringModemLines();
+
+    if (m_thread.joinable()) {
+        m_stop.store(true, std::memory_order_relaxed);
+        uint64_t one = 1;
+        ssize_t ignored = write(m_wakeFd, &one, sizeof(one));
+        (void)ignored;
+        m_thread.join();
+    }
+    m_open.store(false, std::memory_order_release);
+    closeDescriptors();
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    m_droppedBytes += m_sendCount;
+    m_sendCount = 0;
+    m_latestFrameLength = 0;
+}
+
+void LinuxSerialPort::closeDescriptors()
+{
+    for (int* fd : {&m_fd, &m_epoll, &m_wakeFd, &m_timerFd}) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+bool LinuxSerialPort::sendData(const void* bytes, size_t length)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    return length == 0 || queueBytes(bytes, length, false);
+}
+
+bool LinuxSerialPort::sendFrame(const void* bytes, size_t length)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    return length == 0 || queueBytes(bytes, length, true);
+}
+
+LinuxSerialPort::ModemLines LinuxSerialPort::modemLines() const
+{
+    uint8_t bits = m_modemLines.load(std::memory_order_relaxed);
+    ModemLines lines;
+    lines.cts = (bits & kModemLineCTS) != 0;
+    lines.dsr = (bits & kModemLineDSR) != 0;
+    lines.dcd = (bits & kModemLineDCD) != 0;
+    return lines;
+}
+
+uint64_t LinuxSerialPort::sentByteCount() const
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_sentBytes;
+}
+
+uint64_t LinuxSerialPort::droppedFrameCount() const
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_droppedFrames;
+}
+
+uint64_t LinuxSerialPort::droppedByteCount() const
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_droppedBytes;
+}
+
+size_t LinuxSerialPort::queuedByteCount() const
+{
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_sendCount;
+}
+
+// Copies bytes onto the end of the send ring and wakes the I/O thread.
+// Never blocks on the port.
+bool LinuxSerialPort::queueBytes(const void* bytes, size_t length, bool replaceable)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+
+        if (replaceable && m_latestFrameLength > 0) {
+            // the previous frame has not started going out yet, so it is stale
+            m_sendCount -= m_latestFrameLength;
+            m_droppedFrames++;
+            m_droppedBytes += m_latestFrameLength;
+        }
+        // anything already queued now has to go out ahead of these bytes
+        m_latestFrameLength = 0;
+
+        if (m_sendCount + length > kSendBufferLength) {
+            if (replaceable) {
+                m_droppedFrames++;
+            }
+            m_droppedBytes += length;
+            return false;
+        }
+
+        size_t tail = (m_sendHead + m_sendCount) % kSendBufferLength;
+        size_t firstRun = std::min(length, kSendBufferLength - tail);
+        memcpy(m_sendBuffer.data() + tail, bytes, firstRun);
+        memcpy(m_sendBuffer.data(), (const uint8_t*)bytes + firstRun, length - firstRun);
+        m_sendCount += length;
+        if (replaceable) {
+            m_latestFrameLength = length;
+        }
+    }
+
+    uint64_t one = 1;
+    ssize_t ignored = write(m_wakeFd, &one, sizeof(one));
+    (void)ignored;
+    return true;
+}
+
+void LinuxSerialPort::run()
+{
+    epoll_event events[3];
+
+    while (!m_stop.load(std::memory_order_relaxed) && isOpen()) {
+        int count = epoll_wait(m_epoll, events, 3, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail(errno);
+            break;
+        }
+
+        bool wantsWrite = false;
+        for (int i=0; i<count && isOpen(); i++) {
+            int fd = events[i].data.fd;
+            uint32_t ready = events[i].events;
+
+            if (fd == m_wakeFd || fd == m_timerFd) {
+                uint64_t value;
+                ssize_t ignored = read(fd, &value, sizeof(value));
+                (void)ignored;
+                wantsWrite = true;
+                continue;
+            }
+
+            // read what is there before taking a hang-up at its word
+            if (ready & EPOLLIN) {
+                readAvailableBytes();
+            }
+            if (isOpen() && (ready & (EPOLLHUP | EPOLLERR))) {
+                fail(0);
+            }
+            if (ready & EPOLLOUT) {
+                wantsWrite = true;
+            }
+        }
+
+        if (wantsWrite && isOpen() && !m_stop.load(std::memory_order_relaxed)) {
+            writeQueuedBytes();
+        }
+    }
+}
+
+// Reads everything the driver has, handing it over a buffer at a time
+void LinuxSerialPort::readAvailableBytes()
+{
+    size_t length = 0;
+    for (;;) {
+        ssize_t numBytesRead = read(m_fd, m_receiveBuffer.data() + length, m_receiveBuffer.size() - length);
+        if (numBytesRead > 0) {
+            length += numBytesRead;
+            if (length == m_receiveBuffer.size()) {
+                if (m_receiveHandler) {
+                    m_receiveHandler(m_receiveBuffer.data(), length);
+                }
+                length = 0;
+            }
+            continue;
+        }
+
+        int error = (numBytesRead == 0) ? 0 : errno;
+        if (numBytesRead < 0 && error == EINTR) {
+            continue;
+        }
+
+        if (length && m_receiveHandler) {
+            m_receiveHandler(m_receiveBuffer.data(), length);
+        }
+        if (numBytesRead == 0 || error != EAGAIN) {
+            fail(error);
+        }
+        return;
+    }
+}
+
+size_t LinuxSerialPort::bytesInFlight(Clock::time_point now) const
+{
+    if (m_drainedAt <= now) {
+        return 0;
+    }
+    return (size_t)(std::chrono::duration<double>(m_drainedAt - now).count() * m_bytesPerSecond);
+}
+
+void LinuxSerialPort::writeQueuedBytes()
+{
+    Clock::time_point now = Clock::now();
+
+    int driverQueued = 0;
+    if (ioctl(m_fd, TIOCOUTQ, &driverQueued) != 0) {
+        driverQueued = 0;
+    }
+    size_t queued = std::max((size_t)driverQueued, bytesInFlight(now));
+    if (queued > kDriverQueueLowWater) {
+        // come back once the driver has about drained, rather than spinning on EPOLLOUT
+        armRetryTimer(std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>((queued - kDriverQueueLowWater) / std::max(m_bytesPerSecond, 1.0))));
+        setWantsWritable(false);
+        return;
+    }
+
+    for (;;) {
+        size_t head;
+        size_t length;
+        size_t heldFrameLength;
+        size_t queuedAtWrite;
+        {
+            std::lock_guard<std::mutex> lock(m_sendMutex);
+            heldFrameLength = m_latestFrameLength;
+            queuedAtWrite = m_sendCount;
+            m_latestFrameLength = 0;    // may be going out now; see releaseHeldFrame()
+            head = m_sendHead;
+            length = std::min(m_sendCount, kSendBufferLength - head);
+        }
+
+        if (length == 0) {
+            setWantsWritable(false);
+            return;
+        }
+
+        ssize_t numBytesWritten = write(m_fd, m_sendBuffer.data() + head, length);
+        if (numBytesWritten < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                {
+                    std::lock_guard<std::mutex> lock(m_sendMutex);
+                    releaseHeldFrame(heldFrameLength, queuedAtWrite, 0);
+                }
+                setWantsWritable(true);
+                return;
+            }
+            fail(errno);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_sendMutex);
+            m_sendHead = (head + numBytesWritten) % kSendBufferLength;
+            m_sendCount -= numBytesWritten;
+            m_sentBytes += numBytesWritten;
+            releaseHeldFrame(heldFrameLength, queuedAtWrite, numBytesWritten);
+        }
+        m_drainedAt = std::max(m_drainedAt, now) + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(numBytesWritten / std::max(m_bytesPerSecond, 1.0)));
+
+        if ((size_t)numBytesWritten < length) {
+            setWantsWritable(true);
+            return;
+        }
+    }
+}
+
+// Called with m_sendMutex held.  The newest frame is held back from
+// replacement while write() may be reading it.  It becomes replaceable again
+// if the write stopped short of it and nothing was queued behind it since.
+void LinuxSerialPort::releaseHeldFrame(size_t frameLength, size_t queuedAtWrite, size_t written)
+{
+    if (frameLength == 0 || written > queuedAtWrite - frameLength || m_sendCount != queuedAtWrite - written) {
+        return;
+    }
+    m_latestFrameLength = frameLength;
+}
+
+void LinuxSerialPort::setWantsWritable(bool wantsWritable)
+{
+    if (wantsWritable == m_wantsWritable) {
+        return;
+    }
+    epoll_event event = {};
+    event.events = wantsWritable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.fd = m_fd;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_fd, &event) == 0) {
+        m_wantsWritable = wantsWritable;
+    }
+}
+
+void LinuxSerialPort::armRetryTimer(Clock::duration delay)
+{
+    long long nanoseconds = std::max<long long>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count());
+    itimerspec spec = {};
+    spec.it_value.tv_sec = nanoseconds / 1000000000;
+    spec.it_value.tv_nsec = nanoseconds % 1000000000;
+    timerfd_settime(m_timerFd, 0, &spec, NULL);
+}
+
+// Called on the I/O thread when the port can't go on.  error is 0 for a
+// hang-up.  Closes the device straight away so it can go, and stops the
+// I/O thread; close() still needs calling to join it.
+void LinuxSerialPort::fail(int error)
+{
+    if (!m_open.exchange(false, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_droppedBytes += m_sendCount;
+        m_sendCount = 0;
+        m_latestFrameLength = 0;
+    }
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_fd, NULL);
+    ::close(m_fd);
+    m_fd = -1;
+
+    if (error != 0 && m_errorHandler) {
+        m_errorHandler(error);
+    }
+    if ((error == 0 || errorMeansRemoved(error)) && m_removalHandler) {
+        m_removalHandler();
+    }
+}
+
+void LinuxSerialPort::readModemLines(int fd)
+{
+    int status = 0;
+    if (ioctl(fd, TIOCMGET, &status) != 0) {
+        return;
+    }
+    uint8_t bits = ((status & TIOCM_CTS) ? kModemLineCTS : 0) |
+                   ((status & TIOCM_DSR) ? kModemLineDSR : 0) |
+                   ((status & TIOCM_CAR) ? kModemLineDCD : 0);
+    if (m_modemLines.exchange(bits, std::memory_order_relaxed) != bits && m_modemLinesHandler) {
+        m_modemLinesHandler(modemLines());
+    }
+}
+
+// Runs on the modem line thread, which owns fd
+void LinuxSerialPort::monitorModemLines(int fd)
+{
+    while (!m_modemStop.load()) {
+        if (ioctl(fd, TIOCMIWAIT, TIOCM_CTS | TIOCM_DSR | TIOCM_CAR) == 0) {
+            readModemLines(fd);
+        } else if (errno != EINTR) {
+            // not supported by the driver, or hung up, which the I/O thread reports
+            break;
+        }
+    }
+    ::close(fd);
+    m_modemDone.store(true);
+}
+
+void LinuxSerialPort::stopMonitoringModemLines()
+{
+    if (!m_modemThread.joinable()) {
+        return;
+    }
+    m_modemStop.store(true);
+
+    // a signal sent just before the thread gets back into the ioctl is
+    // lost, so keep at it until the thread says it is done
+    while (!m_modemDone.load()) {
+        pthread_kill(m_modemThread.native_handle(), modemWakeSignal());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    m_modemThread.join();
+}
@@ -0,0 +1,164 @@
+//
+//  LinuxSerialPort.h
+//  ChristmasTreeVisualizer
+//
+//  A serial port on termios and epoll, in the role ORSSerialPort plays on the
+//  Mac, so the tree output path can be run and load tested on Linux.
+//
+//  Like ORSSerialPort, sends never block: bytes go into a fixed ring that the
+//  port's I/O thread writes out as the driver takes them, and frames sent with
+//  sendFrame() are latest-wins, replaced by a newer one until they start going
+//  out.  Received bytes are read in batches and handed over once per wake-up.
+//  Unplugging the device is noticed from the hang-up or the failed read or
+//  write, and reported once.
+//
+//  CTS, DSR and DCD are read when the port opens.  Following them after that
+//  is opt-in: a thread of its own then sleeps in TIOCMIWAIT until one
+//  changes, so a port nobody asks about them costs no wake-ups.
+//
+
+#ifndef LINUXSERIALPORT_H
+#define LINUXSERIALPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class LinuxSerialPort
+{
+public:
+    // All handlers are called on the port's I/O thread, and must not close
+    // or destroy the port.
+    typedef std::function<void(const uint8_t* bytes, size_t length)> ReceiveHandler;
+    typedef std::function<void()> RemovalHandler;
+    typedef std::function<void(int error)> ErrorHandler;
+
+    struct ModemLines {
+        bool cts = false;
+        bool dsr = false;
+        bool dcd = false;
+    };
+    // called on the modem line thread
+    typedef std::function<void(const ModemLines& lines)> ModemLinesHandler;
+
+    static const size_t kSendBufferLength = 4096;
+    static const size_t kReceiveBufferLength = 1024;
+
+    // bytes the driver may hold before more are written; the rest wait in
+    // the ring where a newer frame can still replace them
+    static const size_t kDriverQueueLowWater = 16;
+
+    explicit LinuxSerialPort(const std::string& path);
+    ~LinuxSerialPort();
+
+    LinuxSerialPort(const LinuxSerialPort&) = delete;
+    LinuxSerialPort& operator=(const LinuxSerialPort&) = delete;
+
+    // set before open()
+    void setReceiveHandler(const ReceiveHandler& handler) { m_receiveHandler = handler; }
+    void setRemovalHandler(const RemovalHandler& handler) { m_removalHandler = handler; }
+    void setErrorHandler(const ErrorHandler& handler) { m_errorHandler = handler; }
+    void setModemLinesHandler(const ModemLinesHandler& handler) { m_modemLinesHandler = handler; }
+
+    // Follow the modem lines while open.  Drivers without TIOCMIWAIT, such as
+    // pseudo terminals, leave them as they were at open().  The monitor
+    // thread is woken with SIGRTMIN+1, whose handler it installs the first
+    // time; if something else in the process already handles that signal,
+    // it is left alone and the lines also stay as they were at open().
+    void setMonitorsModemLines(bool monitors) { m_monitorsModemLines = monitors; }
+
+    // 8N1, raw, no flow control.  false with errno set if the port could
+    // not be opened or does not take the baud rate.
+    bool open(unsigned long baudRate);
+    void close();
+
+    bool isOpen() const { return m_open.load(std::memory_order_acquire); }
+    const std::string& path() const { return m_path; }
+
+    // Queues bytes to go out after everything already queued.  false if the
+    // port is closed or the send buffer is full.
+    bool sendData(const void* bytes, size_t length);
+
+    // Queues a frame that the next sendFrame() replaces if it has not
+    // started going out by then.
+    bool sendFrame(const void* bytes, size_t length);
+
+    uint64_t sentByteCount() const;
+    uint64_t droppedFrameCount() const;
+    uint64_t droppedByteCount() const;
+    size_t queuedByteCount() const;
+
+    ModemLines modemLines() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    bool queueBytes(const void* bytes, size_t length, bool replaceable);
+
+    void run();
+    void readAvailableBytes();
+    void writeQueuedBytes();
+    void releaseHeldFrame(size_t frameLength, size_t queuedAtWrite, size_t written);
+    void setWantsWritable(bool wantsWritable);
+    void armRetryTimer(Clock::duration delay);
+    size_t bytesInFlight(Clock::time_point now) const;
+    void fail(int error);
+    void closeDescriptors();
+
+    void readModemLines(int fd);
+    void monitorModemLines(int fd);
+    void stopMonitoringModemLines();
+
+    std::string m_path;
+
+    int m_fd = -1;
+    int m_epoll = -1;
+    int m_wakeFd = -1;      // eventfd: bytes were queued, or close() wants the thread to stop
+    int m_timerFd = -1;     // timerfd: the driver should have drained by now
+
+    std::thread m_thread;
+    std::atomic<bool> m_open{false};
+    std::atomic<bool> m_stop{false};
+
+    ReceiveHandler m_receiveHandler;
+    RemovalHandler m_removalHandler;
+    ErrorHandler m_errorHandler;
+    ModemLinesHandler m_modemLinesHandler;
+
+    // the modem line thread waits on its own duplicate of the descriptor,
+    // so the I/O thread can close the original under it
+    bool m_monitorsModemLines = false;
+    std::thread m_modemThread;
+    std::atomic<bool> m_modemStop{false};
+    std::atomic<bool> m_modemDone{false};
+    std::atomic<uint8_t> m_modemLines{0};
+
+    // send ring, shared with the senders
+    mutable std::mutex m_sendMutex;
+    std::vector<uint8_t> m_sendBuffer;
+    size_t m_sendHead = 0;
+    size_t m_sendCount = 0;
+    size_t m_latestFrameLength = 0;     // bytes at the end of the ring that a newer frame may still replace
+    uint64_t m_sentBytes = 0;
+    uint64_t m_droppedFrames = 0;
+    uint64_t m_droppedBytes = 0;
+
+    // I/O thread only
+    std::vector<uint8_t> m_receiveBuffer;
+    bool m_wantsWritable = false;
+    double m_bytesPerSecond = 0;
+
+    // when what has been written should be out of the driver.  Pseudo
+    // terminals and many USB serial drivers report nothing for TIOCOUTQ,
+    // so this estimate from the baud rate stands in for them.
+    Clock::time_point m_drainedAt;
+};
+
+#endif // LINUXSERIALPORT_H
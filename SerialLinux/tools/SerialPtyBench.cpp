@@ -0,0 +1,385 @@
+//
+//  SerialPtyBench.cpp
+//  ChristmasTreeVisualizer
+//
+//  Runs the tree's serial output through LinuxSerialPort into a pseudo
+//  terminal, with the other end played by an emulated christmasStrand: it
+//  takes bytes off the line no faster than the baud rate allows, decodes the
+//  frames and applies the ribbon the way the sketch does, loses what arrives
+//  while strip.show() has interrupts off, and sends heartbeats back.
+//
+//  usage: serial_pty_bench [seconds] [frameRateHz] [baud] [showMicros] [unplugAfterSeconds]
+//
+//  Prints the sustained throughput, the latency from sendFrame() to the
+//  frame's last byte reaching the strand, and where frames were lost: replaced
+//  in the send queue, corrupted on the line, or deltas the strand could not
+//  apply.  With unplugAfterSeconds the strand end hangs up partway, and the
+//  time the port takes to report the removal is printed too.  Exits 1 if
+//  that is never reported or the strand saw no good frames.
+//
+
+#include "LinuxSerialPort.h"
+#include "TreeProtocol.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsBetween(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double>(to - from).count();
+}
+
+// when each sequence number was handed to the port, in ns since the start
+static std::array<std::atomic<int64_t>, 256> sQueuedAt;
+
+//-------------------------------------------------------------------------------------------------
+//	StrandEmulator
+//-------------------------------------------------------------------------------------------------
+//
+class StrandEmulator
+{
+public:
+    StrandEmulator(int master, double bytesPerSecond, double showSeconds, Clock::time_point start)
+    : m_master(master), m_byteTime(1.0 / bytesPerSecond), m_showSeconds(showSeconds), m_start(start)
+    {
+        m_thread = std::thread(&StrandEmulator::run, this);
+    }
+
+    ~StrandEmulator()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        m_stop.store(true);
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    // closes the master side, which is what unplugging looks like to the port
+    void unplug()
+    {
+        m_unplug.store(true);
+    }
+
+    const TreeFrameDecoder& decoder() const { return m_decoder; }
+    const TreeRibbonDecoder& ribbonDecoder() const { return m_ribbonDecoder; }
+    uint64_t bytesReceived() const { return m_bytesReceived; }
+    uint64_t bytesOverrun() const { return m_bytesOverrun; }
+    uint64_t framesGood() const { return m_framesGood; }
+    uint64_t ribbonsApplied() const { return m_ribbonsApplied; }
+    std::vector<double>& latencies() { return m_latencies; }
+
+private:
+    struct WireByte {
+        uint8_t byte;
+        double arrival;     // seconds since the start, when the last bit is in
+    };
+
+    static void setPixel(uint8_t, uint8_t) {}
+
+    double now() const { return secondsBetween(m_start, Clock::now()); }
+
+    void run()
+    {
+        double nextHeartbeat = 1.0;
+        uint8_t heartbeatSequence = 0;
+
+        while (!m_stop.load()) {
+            if (m_unplug.load()) {
+                close(m_master);
+                return;
+            }
+
+            pollfd pfd = { m_master, POLLIN, 0 };
+            poll(&pfd, 1, 1);
+
+            // bytes come off the line one byte time apart at best
+            uint8_t buffer[256];
+            ssize_t count;
+            while ((count = read(m_master, buffer, sizeof(buffer))) > 0) {
+                double t = now();
+                for (ssize_t i=0; i<count; i++) {
+                    m_lastArrival = std::max(m_lastArrival + m_byteTime, t);
+                    m_wire.push_back(WireByte{buffer[i], m_lastArrival});
+                }
+            }
+
+            double t = now();
+            while (!m_wire.empty() && m_wire.front().arrival <= t) {
+                receive(m_wire.front());
+                m_wire.pop_front();
+            }
+
+            if (t >= nextHeartbeat) {
+                sendHeartbeat(heartbeatSequence++);
+                nextHeartbeat = t + 1.0;
+            }
+        }
+    }
+
+    void receive(const WireByte& wireByte)
+    {
+        // while show() runs the UART keeps one byte in its register and one
+        // being shifted in; everything after that is overrun
+        if (wireByte.arrival < m_showUntil) {
+            if (m_showKept == 2) {
+                m_bytesOverrun++;
+                return;
+            }
+            m_showKept++;
+        }
+        m_bytesReceived++;
+
+        if (!m_decoder.feed(wireByte.byte)) {
+            return;
+        }
+        m_framesGood++;
+
+        int64_t queuedAt = sQueuedAt[m_decoder.sequence()].load(std::memory_order_relaxed);
+        m_latencies.push_back(wireByte.arrival - queuedAt / 1e9);
+
+        if (m_ribbonDecoder.apply(m_decoder.type(), m_decoder.sequence(), m_decoder.payload(),
+                                  m_decoder.payloadLength(), setPixel)) {
+            m_ribbonsApplied++;
+            m_showUntil = wireByte.arrival + m_showSeconds;
+            m_showKept = 0;
+        }
+    }
+
+    void sendHeartbeat(uint8_t sequence)
+    {
+        TreeHeartbeat heartbeat = {};
+        heartbeat.flags = kTreeHeartbeatActive;
+        heartbeat.framesGood = m_decoder.framesGood();
+        heartbeat.framesBad = m_decoder.framesBad();
+        heartbeat.framesMissed = m_decoder.framesMissed();
+
+        uint8_t payload[kTreeHeartbeatSize];
+        treePackHeartbeat(heartbeat, payload);
+        uint8_t frame[kTreeFrameMaxEncoded];
+        size_t length = treeEncodeFrame(kTreeFrameHeartbeat, sequence, payload, sizeof(payload), frame, sizeof(frame));
+        ssize_t ignored = write(m_master, frame, length);
+        (void)ignored;
+    }
+
+    int m_master;
+    double m_byteTime;
+    double m_showSeconds;
+    Clock::time_point m_start;
+
+    std::thread m_thread;
+    std::atomic<bool> m_stop{false};
+    std::atomic<bool> m_unplug{false};
+
+    std::deque<WireByte> m_wire;
+    double m_lastArrival = 0;
+    double m_showUntil = 0;
+    int m_showKept = 0;
+
+    TreeFrameDecoder m_decoder;
+    TreeRibbonDecoder m_ribbonDecoder;
+    uint64_t m_bytesReceived = 0;
+    uint64_t m_bytesOverrun = 0;
+    uint64_t m_framesGood = 0;
+    uint64_t m_ribbonsApplied = 0;
+    std::vector<double> m_latencies;
+};
+
+//-------------------------------------------------------------------------------------------------
+//	host side
+//-------------------------------------------------------------------------------------------------
+//
+// A ribbon that drifts, with the odd jump, in the 0-128 range the light
+// engine produces
+static void synthesizeRibbon(uint8_t* ribbon, uint32_t& rng)
+{
+    for (uint8_t i=0; i<kTreeRibbonSize; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        int v = ribbon[i] + (int)(rng % 9) - 4;
+        if (rng % 50 == 0) {
+            v = (rng >> 8) % 129;
+        }
+        ribbon[i] = (uint8_t)std::min(128, std::max(0, v));
+    }
+}
+
+static double percentile(std::vector<double>& values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, const char* argv[])
+{
+    double seconds = (argc > 1) ? strtod(argv[1], NULL) : 10.0;
+    double frameRate = (argc > 2) ? strtod(argv[2], NULL) : 60.0;
+    unsigned long baud = (argc > 3) ? strtoul(argv[3], NULL, 10) : 115200;
+    double showMicros = (argc > 4) ? strtod(argv[4], NULL) : 2300.0;    // 75 WS2812 pixels
+    double unplugAfter = (argc > 5) ? strtod(argv[5], NULL) : 0;
+    if (frameRate <= 0) {
+        frameRate = 60.0;
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    Clock::time_point start = Clock::now();
+
+    LinuxSerialPort port(ptsname(master));
+
+    std::atomic<bool> removed(false);
+    std::atomic<int64_t> removedAt(0);
+    port.setRemovalHandler([&] {
+        removedAt.store(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        removed.store(true);
+    });
+
+    TreeFrameDecoder heartbeatDecoder;
+    std::atomic<uint32_t> heartbeats(0);
+    port.setReceiveHandler([&](const uint8_t* bytes, size_t length) {
+        for (size_t i=0; i<length; i++) {
+            if (heartbeatDecoder.feed(bytes[i]) && heartbeatDecoder.type() == kTreeFrameHeartbeat) {
+                heartbeats++;
+            }
+        }
+    });
+
+    if (!port.open(baud)) {
+        perror("open");
+        return 1;
+    }
+
+    StrandEmulator strand(master, baud / 10.0, showMicros / 1e6, start);
+
+    TreeRibbonEncoder encoder;
+    uint8_t sequence = 0;
+    uint8_t ribbon[kTreeRibbonSize] = {0};
+    uint32_t rng = 2463534242u;
+
+    uint64_t framesQueued = 0;
+    uint64_t framesRefused = 0;
+    uint64_t keyframes = 0;
+    uint64_t bytesQueued = 0;
+    bool unplugged = false;
+    double unpluggedAt = 0;
+
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+    Clock::time_point next = start;
+    uint64_t frameIndex = 0;
+
+    while (secondsBetween(start, Clock::now()) < seconds) {
+        std::this_thread::sleep_until(next);
+        next += period;
+
+        if (unplugAfter > 0 && !unplugged && secondsBetween(start, Clock::now()) >= unplugAfter) {
+            strand.unplug();
+            unplugged = true;
+            unpluggedAt = secondsBetween(start, Clock::now());
+        }
+
+        synthesizeRibbon(ribbon, rng);
+        uint8_t treeBits = (frameIndex++ / 4) & 0xF;
+
+        uint8_t payload[kTreeFrameMaxPayload];
+        uint8_t payloadLength = 0;
+        uint8_t type = encoder.encode(treeBits, ribbon, sequence, payload, payloadLength);
+        if (type == 0) {
+            continue;
+        }
+
+        // as SendRibbonFrame in the plug-in does it
+        for (int attempt=0; attempt<2; attempt++) {
+            uint8_t frame[kTreeFrameMaxEncoded];
+            size_t length = treeEncodeFrame(type, sequence, payload, payloadLength, frame, sizeof(frame));
+            sQueuedAt[sequence].store(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+                                      std::memory_order_relaxed);
+            sequence++;
+
+            uint64_t dropped = port.droppedFrameCount();
+            bool queued = port.sendFrame(frame, length);
+            framesQueued += queued;
+            framesRefused += !queued;
+            bytesQueued += queued ? length : 0;
+            keyframes += queued && type == kTreeFrameRibbonKey;
+            if (queued && port.droppedFrameCount() == dropped) {
+                break;
+            }
+
+            encoder.forceKeyframe();
+            if (!queued || type != kTreeFrameRibbonDelta) {
+                break;
+            }
+            type = encoder.encode(treeBits, ribbon, sequence, payload, payloadLength);
+        }
+    }
+
+    // let the strand take what is still on the line
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    strand.stop();
+    double elapsed = secondsBetween(start, Clock::now());
+
+    const TreeFrameDecoder& decoder = strand.decoder();
+    std::vector<double>& latencies = strand.latencies();
+    double meanLatency = 0;
+    for (double latency : latencies) {
+        meanLatency += latency;
+    }
+    meanLatency /= std::max<size_t>(latencies.size(), 1);
+
+    printf("%.1f s  %.1f Hz  %lu baud  show %.0f us\n", elapsed, frameRate, baud, showMicros);
+    printf("host: %llu frames queued (%llu key), %llu replaced, %llu refused, %.0f bytes/s sent, %u heartbeats\n",
+           (unsigned long long)framesQueued, (unsigned long long)keyframes,
+           (unsigned long long)port.droppedFrameCount(), (unsigned long long)framesRefused,
+           port.sentByteCount() / elapsed, heartbeats.load());
+    printf("strand: %llu frames good (%.1f/s), %u bad, %u missed, %u deltas skipped, %llu ribbons applied, %.0f bytes/s, %llu bytes overrun\n",
+           (unsigned long long)strand.framesGood(), strand.framesGood() / elapsed,
+           decoder.framesBad(), decoder.framesMissed(), strand.ribbonDecoder().deltasSkipped(),
+           (unsigned long long)strand.ribbonsApplied(), strand.bytesReceived() / elapsed,
+           (unsigned long long)strand.bytesOverrun());
+    printf("latency: mean %.2f ms  p50 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+           meanLatency * 1e3, percentile(latencies, 0.5) * 1e3, percentile(latencies, 0.99) * 1e3,
+           percentile(latencies, 1.0) * 1e3);
+
+    bool failed = strand.framesGood() == 0;
+    if (unplugged) {
+        if (removed.load()) {
+            printf("unplugged at %.2f s, removal reported after %.2f ms, port %s\n", unpluggedAt,
+                   (removedAt.load() / 1e9 - unpluggedAt) * 1e3, port.isOpen() ? "still open" : "closed");
+        } else {
+            printf("unplugged at %.2f s, removal never reported\n", unpluggedAt);
+            failed = true;
+        }
+    } else {
+        close(master);
+    }
+
+    port.close();
+    return failed ? 1 : 0;
+}
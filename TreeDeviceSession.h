@@ -0,0 +1,97 @@
+//
+//  TreeDeviceSession.h
+//  ChristmasTreeVisualizer
+//
+//  The connections to the lights: the strand's serial port and the UDP
+//  socket for the ball lights.  There is one session for the process, so
+//  the connections outlive any one VisualView.  Play, stop, track changes
+//  and showing the visualizer again all find them already open.  The serial
+//  port is only searched for again when a device is plugged in after the
+//  last one went away.
+//
+//  The search never blocks: every likely port is opened and sent a probe at
+//  once, and the one that answers with a strand heartbeat is kept.
+//
+//  The ball lights' address is looked up once and the UDP socket connected
+//  to it, so a frame is just a send().  It is only looked up again after the
+//  socket fails, or when the address is changed.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "ORSSerialPort.h"
+#import "GCDAsyncUdpSocket.h"
+
+#include <atomic>
+
+#include "TreeProtocol.h"
+#include "PixelProtocol.h"
+
+// What the host keeps about its frames on the strand's serial link
+struct StrandLinkEncoder
+{
+    // sequence numbers for every frame sent on the link, by whichever thread,
+    // so the strand can count the frames it never saw.  Probes use them too,
+    // so a port carries on from its probes rather than starting over.
+    std::atomic<uint8_t> sequence{0};
+
+    // set from any thread when the strand has lost the ribbon base, a new
+    // port included; the lighting thread sends a key frame next
+    std::atomic<bool> needsKeyframe{true};
+
+    // packs the ribbon; lighting thread only
+    TreeRibbonEncoder ribbon;
+};
+
+// What the host keeps about its pixel packets to the ball lights
+struct BallLinkEncoder
+{
+    // set on the main thread whenever the socket connects; the next packet
+    // is a keyframe flagged as a restart, since the controller may hold
+    // sequence numbers and a keyframe from an earlier run or another host
+    std::atomic<bool> needsRestart{true};
+
+    // lighting thread only
+    uint16_t sequence = 0;
+    PixelFrameEncoder pixels;
+};
+
+// The strand's side of the serial link, as told by its heartbeats
+struct StrandLinkStats
+{
+    TreeHeartbeat lastHeartbeat = {};
+    CFAbsoluteTime lastHeartbeatTime = 0;
+    uint32_t heartbeats = 0;
+
+    // heartbeats that arrived corrupt, or never arrived
+    uint32_t heartbeatsBad = 0;
+    uint32_t heartbeatsMissed = 0;
+};
+
+@interface TreeDeviceSession : NSObject <ORSSerialPortDelegate, GCDAsyncUdpSocketDelegate>
+
++ (instancetype)sharedSession;
+
+// Opens whatever is not open yet.  Cheap once everything is, so it is fine
+// to call on every play.  Like the rest of the methods, main thread only.
+- (void)connect;
+
+// Closes everything and stops reconnecting on hot-plug, until the next connect.
+- (void)disconnect;
+
+// Where the ball lights listen.  Setting either reconnects the socket.
+@property (nonatomic, copy) NSString * ballHost;
+@property (nonatomic, assign) uint16_t ballPort;
+
+// read from the lighting thread, hence atomic; nil while not connected
+@property (atomic, strong, readonly) ORSSerialPort * serialPort;
+@property (atomic, strong, readonly) GCDAsyncUdpSocket * udpSocket;     // connected to the ball lights
+
+// updated from the serial port's heartbeats, on the main thread
+@property (nonatomic, readonly) StrandLinkStats strandLink;
+
+// for the frames sent through serialPort and udpSocket; live as long as the session
+@property (nonatomic, readonly) StrandLinkEncoder * strandEncoder;
+@property (nonatomic, readonly) BallLinkEncoder * ballEncoder;
+
+@end
@@ -0,0 +1,444 @@
+//
+//  TreeDeviceSession.mm
+//  ChristmasTreeVisualizer
+//
+
+#import "TreeDeviceSession.h"
+
+#import "ORSSerialPortManager.h"
+#import "ORSSerialRequest.h"
+#import "ORSSerialPacketDescriptor.h"
+
+// A strand answers a probe within a few ms once running, but opening the port
+// resets an Arduino, and its bootloader holds the sketch back for up to two
+// seconds; probes sent meanwhile go unanswered and are sent again.
+static const NSTimeInterval kProbeTimeout = 0.25;
+static const NSUInteger kProbeAttempts = 10;
+
+// where the strand was found last time; used while its probe is still out
+static NSString * const kStrandPortPathKey = @"ChristmasTreeVisualizerStrandPortPath";
+
+static NSString * const kDefaultBallHost = @"10.0.1.150";
+static const uint16_t kDefaultBallPort = 2390;
+
+// how long to wait before reopening a ball socket that failed, so a
+// controller that is switched off costs a lookup a second at most
+static const NSTimeInterval kBallReconnectDelay = 1.0;
+
+@interface TreeDeviceSession ()
+
+@property (atomic, strong, readwrite) ORSSerialPort * serialPort;
+@property (atomic, strong, readwrite) GCDAsyncUdpSocket * udpSocket;
+
+@property (nonatomic, strong) dispatch_queue_t socketQueue;
+
+// the ball socket from when it is opened until it closes; udpSocket only
+// once it is connected
+@property (nonatomic, strong) GCDAsyncUdpSocket * ballSocket;
+
+// the ball lights' address as last looked up, so reopening needs no lookup
+@property (nonatomic, strong) NSData * ballAddress;
+
+// set between connect and disconnect; plugging in a device only opens it then
+@property (nonatomic, assign) BOOL wantsConnection;
+
+// ports being probed, by path, and how many probes each has had
+@property (nonatomic, strong) NSMutableDictionary<NSString*, ORSSerialPort*>* probingPorts;
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSNumber*>* probeAttempts;
+
+@end
+
+@implementation TreeDeviceSession
+{
+    TreeFrameDecoder _strandDecoder;
+    StrandLinkStats _strandLink;
+    StrandLinkEncoder _strandEncoder;
+    BallLinkEncoder _ballEncoder;
+}
+
++ (instancetype)sharedSession
+{
+    static TreeDeviceSession* sSession = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sSession = [[TreeDeviceSession alloc] init];
+    });
+    return sSession;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _socketQueue = dispatch_queue_create("socket queue", 0);
+        _ballHost = [kDefaultBallHost copy];
+        _ballPort = kDefaultBallPort;
+        _probingPorts = [NSMutableDictionary dictionary];
+        _probeAttempts = [NSMutableDictionary dictionary];
+
+        // the manager only posts hot-plug notifications once something has asked for it
+        [ORSSerialPortManager sharedSerialPortManager];
+        NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
+        [nc addObserver:self selector:@selector(serialPortsWereConnected:) name:ORSSerialPortsWereConnectedNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
+    [nc removeObserver:self];
+}
+
+- (void)connect
+{
+    self.wantsConnection = YES;
+
+    if (self.ballSocket == nil) {
+        [self openBallSocket];
+    }
+
+    if (self.serialPort == nil) {
+        [self discoverSerialPort];
+    }
+}
+
+- (void)disconnect
+{
+    self.wantsConnection = NO;
+
+    [self closeSerialPort];
+    [self stopProbing];
+
+    [self closeBallSocket];
+}
+
+- (StrandLinkStats)strandLink
+{
+    return _strandLink;
+}
+
+- (StrandLinkEncoder *)strandEncoder
+{
+    return &_strandEncoder;
+}
+
+- (BallLinkEncoder *)ballEncoder
+{
+    return &_ballEncoder;
+}
+
+#pragma mark Ball Lights
+
+- (void)setBallHost:(NSString *)ballHost
+{
+    if (![ballHost isEqualToString:_ballHost]) {
+        _ballHost = [ballHost copy];
+        [self reopenBallSocket];
+    }
+}
+
+- (void)setBallPort:(uint16_t)ballPort
+{
+    if (ballPort != _ballPort) {
+        _ballPort = ballPort;
+        [self reopenBallSocket];
+    }
+}
+
+- (void)openBallSocket
+{
+    GCDAsyncUdpSocket* socket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:self.socketQueue];
+    self.ballSocket = socket;
+
+    // through a WiFi stall only the newest frame waits; the balls never
+    // replay a backlog of old colors once it clears
+    [socket setReplacesPendingSends:YES];
+    [socket setMaxSendQueueLength:1];
+
+    // the address from last time connects straight away, without a lookup
+    NSError* error = nil;
+    BOOL connecting = self.ballAddress ? [socket connectToAddress:self.ballAddress error:&error]
+                                       : [socket connectToHost:self.ballHost onPort:self.ballPort error:&error];
+    if (!connecting) {
+        NSLog(@"DBS: ball lights socket could not connect to %@:%u, %@", self.ballHost, self.ballPort, error);
+        [self ballSocketFailed:socket];
+    }
+}
+
+- (void)closeBallSocket
+{
+    GCDAsyncUdpSocket* socket = self.ballSocket;
+    self.ballSocket = nil;
+    self.udpSocket = nil;
+    [socket close];
+}
+
+- (void)reopenBallSocket
+{
+    self.ballAddress = nil;
+    if (self.ballSocket) {
+        [self closeBallSocket];
+        [self openBallSocket];
+    }
+}
+
+// Forgets the address, which may be what went wrong, and tries again later
+- (void)ballSocketFailed:(GCDAsyncUdpSocket*)socket
+{
+    if (socket != self.ballSocket) {
+        return;
+    }
+    [self closeBallSocket];
+    self.ballAddress = nil;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kBallReconnectDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        if (self.wantsConnection && self.ballSocket == nil) {
+            [self openBallSocket];
+        }
+    });
+}
+
+#pragma mark Serial Port
+
+// Probes every likely port at once, and returns straight away; the first to
+// answer like a strand wins.  The port the strand was on last time is used
+// until then, so the lights start without waiting, and dropped if it does
+// not answer.
+- (void)discoverSerialPort
+{
+    NSArray* availablePorts = [[ORSSerialPortManager sharedSerialPortManager] availablePorts];
+    NSMutableArray* candidates = [NSMutableArray array];
+    for (ORSSerialPort* port in availablePorts) {
+
+        NSString* path = port.path;
+
+        if ([path hasPrefix:@"/dev/tty.usbserial"] ||
+            [path hasPrefix:@"/dev/cu.usbserial"] ||
+            [path hasPrefix:@"/dev/tty.usbmodem"] ||
+            [path hasPrefix:@"/dev/cu.usbmodem"]) {
+
+            [candidates addObject:port];
+        }
+    }
+
+    if (candidates.count == 0) {
+        NSLog(@"DBS: Could not find valid Serial port\n");
+        return;
+    }
+
+    NSString* cachedPath = [[NSUserDefaults standardUserDefaults] stringForKey:kStrandPortPathKey];
+    for (ORSSerialPort* port in candidates) {
+        if (self.probingPorts[port.path] == nil && [self openPort:port]) {
+            NSLog(@"DBS: probing serial port %@ for the strand", port.path);
+            self.probingPorts[port.path] = port;
+            self.probeAttempts[port.path] = @1;
+            [port sendRequest:[self probeRequest]];
+
+            if (self.serialPort == nil && [port.path isEqualToString:cachedPath]) {
+                [self adoptPort:port];
+            }
+        }
+    }
+}
+
+- (BOOL)openPort:(ORSSerialPort*)port
+{
+    port.delegate = self;
+    port.baudRate = [NSNumber numberWithInteger:115200];
+    [port open];
+
+    // one that would not open is tried again on the next connect or hot-plug
+    if (!port.isOpen) {
+        port.delegate = nil;
+    }
+    return port.isOpen;
+}
+
+- (void)adoptPort:(ORSSerialPort*)port
+{
+    // a new link starts its counts over, and its ribbon from a key frame
+    _strandDecoder = TreeFrameDecoder();
+    _strandLink = StrandLinkStats();
+    _strandEncoder.needsKeyframe.store(true, std::memory_order_relaxed);
+
+    self.serialPort = port;
+}
+
+- (ORSSerialRequest*)probeRequest
+{
+    uint8_t encoded[kTreeFrameMaxEncoded];
+    size_t length = treeEncodeFrame(kTreeFrameProbe, _strandEncoder.sequence.fetch_add(1, std::memory_order_relaxed),
+                                    NULL, 0, encoded, sizeof(encoded));
+    NSData* data = [NSData dataWithBytes:encoded length:length];
+
+    // the answer is any good heartbeat frame, a periodic one included; the
+    // only 0x00 in a frame is the delimiter at its end
+    ORSSerialPacketDescriptor* heartbeat = [[ORSSerialPacketDescriptor alloc] initWithMaximumPacketLength:kTreeFrameMaxEncoded userInfo:nil responseEvaluator:^BOOL(NSData* inputData) {
+        TreeFrameDecoder decoder;
+        const uint8_t* bytes = (const uint8_t*)inputData.bytes;
+        NSUInteger length = inputData.length;
+        for (NSUInteger i=0; i+1<length; i++) {
+            if (bytes[i] == 0) {
+                return NO;
+            }
+            decoder.feed(bytes[i]);
+        }
+        return length > 0 && decoder.feed(bytes[length - 1]) && decoder.type() == kTreeFrameHeartbeat;
+    }];
+
+    return [ORSSerialRequest requestWithDataToSend:data userInfo:nil timeoutInterval:kProbeTimeout responseDescriptor:heartbeat];
+}
+
+- (void)stopProbingPort:(ORSSerialPort*)port
+{
+    [self.probingPorts removeObjectForKey:port.path];
+    [self.probeAttempts removeObjectForKey:port.path];
+
+    if (port == self.serialPort) {
+        [self closeSerialPort];
+    } else {
+        [port close];
+        port.delegate = nil;
+    }
+}
+
+- (void)stopProbing
+{
+    for (ORSSerialPort* port in self.probingPorts.allValues) {
+        [self stopProbingPort:port];
+    }
+}
+
+- (void)closeSerialPort
+{
+    ORSSerialPort* serialPort = self.serialPort;
+    if (serialPort) {
+        NSLog(@"DBS: cleaning up serial connection");
+        self.serialPort = nil;
+        [serialPort close];
+        serialPort.delegate = nil;
+    }
+}
+
+- (void)serialPortsWereConnected:(NSNotification*)notification
+{
+    if (self.wantsConnection && self.serialPort == nil) {
+        [self discoverSerialPort];
+    }
+}
+
+#pragma mark ORSSerialPortDelegate
+
+- (void)serialPort:(ORSSerialPort *)serialPort didReceiveResponse:(NSData *)responseData toRequest:(ORSSerialRequest *)request
+{
+    if (self.probingPorts[serialPort.path] != serialPort) {
+        return;
+    }
+
+    NSLog(@"DBS: Christmas Tree Visualizer: found the strand on %@, after %@ probes", serialPort.path, self.probeAttempts[serialPort.path]);
+    [self.probingPorts removeObjectForKey:serialPort.path];
+    [self.probeAttempts removeObjectForKey:serialPort.path];
+
+    // closes the rest, the last known port too if this is another one
+    [self stopProbing];
+
+    [[NSUserDefaults standardUserDefaults] setObject:serialPort.path forKey:kStrandPortPathKey];
+    if (serialPort != self.serialPort) {
+        [self adoptPort:serialPort];
+    }
+}
+
+- (void)serialPort:(ORSSerialPort *)serialPort requestDidTimeout:(ORSSerialRequest *)request
+{
+    if (self.probingPorts[serialPort.path] != serialPort) {
+        return;
+    }
+
+    NSUInteger attempts = self.probeAttempts[serialPort.path].unsignedIntegerValue;
+    if (attempts < kProbeAttempts) {
+        self.probeAttempts[serialPort.path] = @(attempts + 1);
+        [serialPort sendRequest:[self probeRequest]];
+        return;
+    }
+
+    NSLog(@"DBS: no strand on serial port %@", serialPort.path);
+    if (serialPort == self.serialPort) {
+        [[NSUserDefaults standardUserDefaults] removeObjectForKey:kStrandPortPathKey];
+    }
+    [self stopProbingPort:serialPort];
+}
+
+- (void)serialPort:(ORSSerialPort *)serialPort didReceiveData:(NSData *)data
+{
+    if (serialPort != self.serialPort) {
+        return;
+    }
+
+    const uint8_t* bytes = (const uint8_t*)data.bytes;
+    for (NSUInteger i=0; i<data.length; i++) {
+        if (!_strandDecoder.feed(bytes[i])) {
+            continue;
+        }
+
+        TreeHeartbeat heartbeat;
+        if (_strandDecoder.type() == kTreeFrameHeartbeat &&
+            treeUnpackHeartbeat(_strandDecoder.payload(), _strandDecoder.payloadLength(), heartbeat)) {
+            _strandLink.lastHeartbeat = heartbeat;
+            _strandLink.lastHeartbeatTime = CFAbsoluteTimeGetCurrent();
+            _strandLink.heartbeats++;
+        }
+    }
+    _strandLink.heartbeatsBad = _strandDecoder.framesBad();
+    _strandLink.heartbeatsMissed = _strandDecoder.framesMissed();
+}
+
+- (void)serialPort:(ORSSerialPort *)serialPort didEncounterError:(NSError *)error
+{
+    NSLog(@"DBS: serial port %@ error %@", serialPort.path, error);
+}
+
+- (void)serialPortWasRemovedFromSystem:(ORSSerialPort *)serialPort
+{
+    if (self.probingPorts[serialPort.path] == serialPort) {
+        [self stopProbingPort:serialPort];
+    } else if (serialPort == self.serialPort) {
+        [self closeSerialPort];
+    }
+}
+
+#pragma mark GCDAsyncUdpSocketDelegate
+
+// These arrive on the socket queue; the session's state belongs to the main thread.
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didConnectToAddress:(NSData *)address
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (sock == self.ballSocket) {
+            self.ballAddress = address;
+            _ballEncoder.needsRestart.store(true, std::memory_order_relaxed);
+            self.udpSocket = sock;
+        }
+    });
+}
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didNotConnect:(NSError *)error
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        NSLog(@"DBS: ball lights socket could not connect to %@:%u, %@", self.ballHost, self.ballPort, error);
+        [self ballSocketFailed:sock];
+    });
+}
+
+- (void)udpSocketDidClose:(GCDAsyncUdpSocket *)sock withError:(NSError *)error
+{
+    // a send that fails, unreachable host and refused port included, closes the socket
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (error) {
+            NSLog(@"DBS: ball lights socket closed, %@", error);
+        }
+        [self ballSocketFailed:sock];
+    });
+}
+
+@end
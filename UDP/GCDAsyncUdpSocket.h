@@ -266,6 +266,36 @@ typedef BOOL (^GCDAsyncUdpSocketSendFilterBlock)(NSData *data, NSData *address,
 - (uint16_t)maxSendBufferSize;
 - (void)setMaxSendBufferSize:(uint16_t)max;
 
+/**
+ * Gets/Sets the maximum number of packets that may wait in the send queue,
+ * not counting the one being sent.
+ * The default is zero, which means the queue is unbounded.
+ * 
+ * When a new packet would go past the limit, the oldest waiting packets are dropped to make room.
+ * Dropped packets are counted by droppedSendCount, and are NOT reported to the delegate
+ * via udpSocket:didNotSendDataWithTag:dueToError:.
+ * 
+ * Use this for real-time streams, where an old packet is worth less than a new one,
+ * so that a stalled network does not build up a backlog that is later sent in a burst.
+**/
+- (NSUInteger)maxSendQueueLength;
+- (void)setMaxSendQueueLength:(NSUInteger)max;
+
+/**
+ * Gets/Sets whether a new packet replaces one still waiting in the send queue
+ * with the same tag and the same destination.
+ * The default is NO.
+ * 
+ * The new packet takes the old one's place in the queue, so it goes out no later than the old one would have.
+ * A packet that is already being sent is never replaced.
+ * Replaced packets are counted by droppedSendCount, and are NOT reported to the delegate.
+ * 
+ * Packets sent with sendData:toHost:port:withTimeout:tag: have the same destination
+ * when their host strings and ports are equal; no name resolution is done to compare them.
+**/
+- (BOOL)replacesPendingSends;
+- (void)setReplacesPendingSends:(BOOL)flag;
+
 /**
  * User data allows you to associate arbitrary information with the socket.
  * This data is not used internally in any way.
@@ -654,6 +684,22 @@ typedef BOOL (^GCDAsyncUdpSocketSendFilterBlock)(NSData *data, NSData *address,
 **/
 - (void)sendData:(NSData *)data toAddress:(NSData *)remoteAddr withTimeout:(NSTimeInterval)timeout tag:(long)tag;
 
+/**
+ * Send queue statistics.
+ * 
+ * sendQueueDepth is the number of packets waiting to be sent, plus the one being sent.
+ * droppedSendCount is the number of packets dropped by maxSendQueueLength or replaced under replacesPendingSends.
+ * 
+ * Send latency is the time from a sendData: call until the OS accepts the packet.
+ * lastSendLatency is that of the last packet sent, averageSendLatency follows it smoothed over about
+ * the last 16 packets, and maxSendLatency is the longest seen since the socket was created.
+**/
+- (NSUInteger)sendQueueDepth;
+- (unsigned long long)droppedSendCount;
+- (NSTimeInterval)lastSendLatency;
+- (NSTimeInterval)averageSendLatency;
+- (NSTimeInterval)maxSendLatency;
+
 /**
  * You may optionally set a send filter for the socket.
  * A filter can provide several interesting possibilities:
@@ -21,6 +21,7 @@
 #endif
 
 #import <arpa/inet.h>
+#import <mach/mach_time.h>
 #import <fcntl.h>
 #import <ifaddrs.h>
 #import <netdb.h>
@@ -183,6 +184,14 @@ enum GCDAsyncUdpSocketConfig
 	GCDAsyncUdpSendPacket *currentSend;
 	NSMutableArray *sendQueue;
 	
+	NSUInteger maxSendQueueLength;
+	BOOL replacesPendingSends;
+	
+	unsigned long long droppedSendCount;
+	NSTimeInterval lastSendLatency;
+	NSTimeInterval averageSendLatency;
+	NSTimeInterval maxSendLatency;
+	
 	unsigned long socket4FDBytesAvailable;
 	unsigned long socket6FDBytesAvailable;
 	
@@ -224,10 +233,12 @@ enum GCDAsyncUdpSocketConfig
 - (BOOL)connectWithAddress4:(NSData *)address4 error:(NSError **)errPtr;
 - (BOOL)connectWithAddress6:(NSData *)address6 error:(NSError **)errPtr;
 
+- (void)enqueueSendPacket:(GCDAsyncUdpSendPacket *)packet;
 - (void)maybeDequeueSend;
 - (void)doPreSend;
 - (void)doSend;
 - (void)endCurrentSend;
+- (void)recordSendLatency;
 - (void)setupSendTimerWithTimeout:(NSTimeInterval)timeout;
 
 - (void)doReceive;
@@ -279,9 +290,17 @@ enum GCDAsyncUdpSocketConfig
 	
 	NSData *address;
 	int addressFamily;
+	
+	// The destination as given to sendData:toHost:port:withTimeout:tag:, for comparing packets
+	NSString *host;
+	uint16_t port;
+	
+	// When sendData: was called, in mach_absolute_time units
+	uint64_t enqueueTime;
 }
 
 - (id)initWithData:(NSData *)d timeout:(NSTimeInterval)t tag:(long)i;
+- (BOOL)hasSameTagAndDestinationAsPacket:(GCDAsyncUdpSendPacket *)packet;
 
 @end
 
@@ -296,10 +315,22 @@ enum GCDAsyncUdpSocketConfig
 		tag = i;
 		
 		resolveInProgress = NO;
+		
+		enqueueTime = mach_absolute_time();
 	}
 	return self;
 }
 
+- (BOOL)hasSameTagAndDestinationAsPacket:(GCDAsyncUdpSendPacket *)packet
+{
+	if (tag != packet->tag) return NO;
+	
+	if (host || packet->host)
+		return port == packet->port && [host isEqualToString:packet->host];
+	
+	// Both sent to an address, or both on a connected socket
+	return (address == packet->address) || [address isEqualToData:packet->address];
+}
 
 @end
 
@@ -883,6 +914,70 @@ enum GCDAsyncUdpSocketConfig
         dispatch_async(socketQueue, block);
 }
 
+- (NSUInteger)maxSendQueueLength
+{
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = maxSendQueueLength;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (void)setMaxSendQueueLength:(NSUInteger)max
+{
+	dispatch_block_t block = ^{
+		
+		LogVerbose(@"%@ %lu", THIS_METHOD, (unsigned long)max);
+		
+		maxSendQueueLength = max;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_async(socketQueue, block);
+}
+
+- (BOOL)replacesPendingSends
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		
+		result = replacesPendingSends;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (void)setReplacesPendingSends:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		
+		LogVerbose(@"%@ %@", THIS_METHOD, (flag ? @"YES" : @"NO"));
+		
+		replacesPendingSends = flag;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_async(socketQueue, block);
+}
+
 - (uint16_t)maxSendBufferSize
 {
     __block uint16_t result = 0;
@@ -3667,7 +3762,7 @@ enum GCDAsyncUdpSocketConfig
 	
 	dispatch_async(socketQueue, ^{ @autoreleasepool {
 		
-		[sendQueue addObject:packet];
+		[self enqueueSendPacket:packet];
 		[self maybeDequeueSend];
 	}});
 	
@@ -3689,6 +3784,8 @@ enum GCDAsyncUdpSocketConfig
 	
 	GCDAsyncUdpSendPacket *packet = [[GCDAsyncUdpSendPacket alloc] initWithData:data timeout:timeout tag:tag];
 	packet->resolveInProgress = YES;
+	packet->host = [host copy];
+	packet->port = port;
 	
 	[self asyncResolveHost:host port:port withCompletionBlock:^(NSArray *addresses, NSError *error) {
 		
@@ -3710,7 +3807,7 @@ enum GCDAsyncUdpSocketConfig
 	
 	dispatch_async(socketQueue, ^{ @autoreleasepool {
 		
-		[sendQueue addObject:packet];
+		[self enqueueSendPacket:packet];
 		[self maybeDequeueSend];
 		
 	}});
@@ -3733,11 +3830,170 @@ enum GCDAsyncUdpSocketConfig
 	
 	dispatch_async(socketQueue, ^{ @autoreleasepool {
 		
-		[sendQueue addObject:packet];
+		[self enqueueSendPacket:packet];
 		[self maybeDequeueSend];
 	}});
 }
 
+/**
+ * Adds a packet to the send queue, applying replacesPendingSends and maxSendQueueLength.
+ * Connect packets share the queue, and are never replaced or dropped.
+**/
+- (void)enqueueSendPacket:(GCDAsyncUdpSendPacket *)packet
+{
+	NSAssert(dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey), @"Must be dispatched on socketQueue");
+	
+	if (replacesPendingSends)
+	{
+		NSUInteger i = [sendQueue count];
+		while (i-- > 0)
+		{
+			GCDAsyncUdpSendPacket *pending = [sendQueue objectAtIndex:i];
+			
+			if ([pending isMemberOfClass:[GCDAsyncUdpSendPacket class]] &&
+			    [pending hasSameTagAndDestinationAsPacket:packet])
+			{
+				LogVerbose(@"Replacing pending send packet with tag %ld", packet->tag);
+				
+				[sendQueue replaceObjectAtIndex:i withObject:packet];
+				droppedSendCount++;
+				return;
+			}
+		}
+	}
+	
+	if (maxSendQueueLength > 0)
+	{
+		NSUInteger waiting = 0;
+		for (id pending in sendQueue)
+		{
+			if ([pending isMemberOfClass:[GCDAsyncUdpSendPacket class]])
+				waiting++;
+		}
+		
+		NSUInteger i = 0;
+		while (waiting >= maxSendQueueLength && i < [sendQueue count])
+		{
+			if ([[sendQueue objectAtIndex:i] isMemberOfClass:[GCDAsyncUdpSendPacket class]])
+			{
+				LogVerbose(@"Send queue full, dropping oldest pending send packet");
+				
+				[sendQueue removeObjectAtIndex:i];
+				droppedSendCount++;
+				waiting--;
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+	
+	[sendQueue addObject:packet];
+}
+
+- (NSUInteger)sendQueueDepth
+{
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = [sendQueue count] + (currentSend ? 1 : 0);
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (unsigned long long)droppedSendCount
+{
+	__block unsigned long long result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = droppedSendCount;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (NSTimeInterval)lastSendLatency
+{
+	__block NSTimeInterval result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = lastSendLatency;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (NSTimeInterval)averageSendLatency
+{
+	__block NSTimeInterval result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = averageSendLatency;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (NSTimeInterval)maxSendLatency
+{
+	__block NSTimeInterval result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = maxSendLatency;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+/**
+ * Records how long the current send packet took from sendData: to the OS accepting it.
+**/
+- (void)recordSendLatency
+{
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	
+	uint64_t elapsed = mach_absolute_time() - currentSend->enqueueTime;
+	NSTimeInterval latency = (double)elapsed * timebase.numer / timebase.denom / NSEC_PER_SEC;
+	
+	lastSendLatency = latency;
+	averageSendLatency = (averageSendLatency == 0) ? latency : averageSendLatency + (latency - averageSendLatency) / 16;
+	maxSendLatency = MAX(maxSendLatency, latency);
+}
+
 - (void)setSendFilter:(GCDAsyncUdpSocketSendFilterBlock)filterBlock withQueue:(dispatch_queue_t)filterQueue
 {
 	[self setSendFilter:filterBlock withQueue:filterQueue isAsynchronous:YES];
@@ -4115,6 +4371,7 @@ enum GCDAsyncUdpSocketConfig
 	}
 	else // done
 	{
+		[self recordSendLatency];
 		[self notifyDidSendDataWithTag:currentSend->tag];
 		[self endCurrentSend];
 		[self maybeDequeueSend];
@@ -0,0 +1,357 @@
+#include "PixelProtocol.h"
+
+#include <string.h>
+
+// a packet this far behind the newest is not a late one, the sender started over
+static const int16_t kPixelReorderWindow = 256;
+
+// this many stale packets in a row means the link got slower, not that they are late
+static const uint8_t kPixelStaleRunLimit = 30;
+
+// so a gap between runs always fits one skip byte
+static_assert(kPixelFrameMaxPixels <= 0xFF, "skips are a byte");
+
+static uint8_t* putU16(uint8_t* out, uint16_t value)
+{
+  *out++ = value >> 8;
+  *out++ = value & 0xFF;
+  return out;
+}
+
+static uint8_t* putU32(uint8_t* out, uint32_t value)
+{
+  out = putU16(out, value >> 16);
+  return putU16(out, value & 0xFFFF);
+}
+
+static const uint8_t* getU16(const uint8_t* in, uint16_t& value)
+{
+  value = (uint16_t)(in[0] << 8 | in[1]);
+  return in + 2;
+}
+
+static const uint8_t* getU32(const uint8_t* in, uint32_t& value)
+{
+  uint16_t high, low;
+  in = getU16(in, high);
+  in = getU16(in, low);
+  value = (uint32_t)high << 16 | low;
+  return in;
+}
+
+static uint8_t* putHeader(uint8_t* out, const PixelFrameHeader& header)
+{
+  uint8_t* p = putU16(out, kPixelProtocolMagic);
+  *p++ = kPixelProtocolVersion;
+  *p++ = header.flags;
+  p = putU16(p, header.sequence);
+  p = putU32(p, header.timestamp);
+  p = putU16(p, header.offset);
+  return putU16(p, header.count);
+}
+
+size_t pixelEncodeFrame(const PixelFrameHeader& header, const uint8_t* rgb,
+                        uint8_t* out, size_t outCapacity)
+{
+  size_t length = kPixelFrameHeaderSize + (size_t)header.count * 3;
+  if (header.count > kPixelFrameMaxPixels || outCapacity < length) {
+    return 0;
+  }
+
+  uint8_t* p = putHeader(out, header);
+  memcpy(p, rgb, (size_t)header.count * 3);
+
+  return length;
+}
+
+bool pixelDecodeHeader(const uint8_t* packet, size_t length, PixelFrameHeader& header)
+{
+  if (length < kPixelFrameHeaderSize) {
+    return false;
+  }
+
+  uint16_t magic;
+  const uint8_t* p = getU16(packet, magic);
+  uint8_t version = *p++;
+  if (magic != kPixelProtocolMagic || version != kPixelProtocolVersion) {
+    return false;
+  }
+
+  header.flags = *p++;
+  p = getU16(p, header.sequence);
+  p = getU32(p, header.timestamp);
+  p = getU16(p, header.offset);
+  getU16(p, header.count);
+
+  if (header.flags & kPixelFrameDelta) {
+    // a delta is sent only while smaller than its keyframe
+    return length >= kPixelFrameHeaderSize + 2 && length <= kPixelFrameMaxSize;
+  }
+  return length == kPixelFrameHeaderSize + (size_t)header.count * 3;
+}
+
+static bool samePixel(const uint8_t* a, const uint8_t* b)
+{
+  return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+//---- PixelFrameEncoder
+
+bool PixelFrameEncoder::encodeRuns(const uint8_t* rgb, uint16_t count,
+                                   uint8_t* out, size_t outCapacity, size_t& length) const
+{
+  uint8_t* p = out;
+  uint8_t* end = out + outCapacity;
+  uint8_t skip = 0;
+  uint16_t i = 0;
+
+  while (i < count) {
+    if (samePixel(rgb + i * 3, m_key + i * 3)) {
+      skip++;
+      i++;
+      continue;
+    }
+
+    // the same color three times over is cheaper as a fill
+    uint16_t fill = 1;
+    while (i + fill < count && fill < kPixelRunMaxLength &&
+           samePixel(rgb + (i + fill) * 3, rgb + i * 3) &&
+           !samePixel(rgb + (i + fill) * 3, m_key + (i + fill) * 3)) {
+      fill++;
+    }
+
+    uint16_t run = fill;
+    if (fill < 3) {
+      // changed pixels one by one, up to the next unchanged pixel or fill
+      run = 1;
+      while (i + run < count && run < kPixelRunMaxLength &&
+             !samePixel(rgb + (i + run) * 3, m_key + (i + run) * 3)) {
+        uint16_t j = i + run;
+        if (j + 2 < count &&
+            samePixel(rgb + j * 3, rgb + (j + 1) * 3) && samePixel(rgb + j * 3, rgb + (j + 2) * 3) &&
+            !samePixel(rgb + (j + 1) * 3, m_key + (j + 1) * 3) &&
+            !samePixel(rgb + (j + 2) * 3, m_key + (j + 2) * 3)) {
+          break;
+        }
+        run++;
+      }
+    }
+
+    size_t data = fill >= 3 ? 3 : (size_t)run * 3;
+    if ((size_t)(end - p) < 2 + data) {
+      return false;
+    }
+    *p++ = skip;
+    *p++ = fill >= 3 ? kPixelRunFill | run : run;
+    memcpy(p, rgb + i * 3, data);
+    p += data;
+
+    skip = 0;
+    i += run;
+  }
+
+  length = p - out;
+  return true;
+}
+
+size_t PixelFrameEncoder::encode(const PixelFrameHeader& header, const uint8_t* rgb,
+                                 uint8_t* out, size_t outCapacity)
+{
+  size_t bytes = (size_t)header.count * 3;
+  if (header.count > kPixelFrameMaxPixels) {
+    return 0;
+  }
+
+  bool key = !m_haveKey || m_sinceKey >= kPixelKeyframeInterval ||
+             header.offset != m_keyOffset || header.count != m_keyCount;
+  if (!key && memcmp(rgb, m_last, bytes) == 0) {
+    m_sinceKey++;
+    return 0;
+  }
+
+  // a delta is only worth it while it is smaller than the keyframe
+  size_t limit = kPixelFrameHeaderSize + bytes - 1;
+  if (outCapacity < limit) {
+    limit = outCapacity;
+  }
+  size_t runsLength;
+  if (!key && limit > kPixelFrameHeaderSize + 2 &&
+      encodeRuns(rgb, header.count, out + kPixelFrameHeaderSize + 2,
+                 limit - kPixelFrameHeaderSize - 2, runsLength)) {
+    PixelFrameHeader delta = header;
+    delta.flags |= kPixelFrameDelta;
+    putU16(putHeader(out, delta), m_keySequence);
+
+    memcpy(m_last, rgb, bytes);
+    m_sinceKey++;
+    return kPixelFrameHeaderSize + 2 + runsLength;
+  }
+
+  PixelFrameHeader keyHeader = header;
+  keyHeader.flags &= ~kPixelFrameDelta;
+  size_t length = pixelEncodeFrame(keyHeader, rgb, out, outCapacity);
+  if (length == 0) {
+    return 0;
+  }
+
+  memcpy(m_key, rgb, bytes);
+  memcpy(m_last, rgb, bytes);
+  m_keySequence = header.sequence;
+  m_keyOffset = header.offset;
+  m_keyCount = header.count;
+  m_sinceKey = 0;
+  m_haveKey = true;
+  return length;
+}
+
+//---- PixelFrameDecoder
+
+bool PixelFrameDecoder::apply(const PixelFrameHeader& header, const uint8_t* payload, size_t length,
+                              PixelSetter setPixel)
+{
+  if ((uint32_t)header.offset + header.count > m_numPixels) {
+    return false;
+  }
+
+  if (!(header.flags & kPixelFrameDelta)) {
+    if (length != (size_t)header.count * 3) {
+      return false;
+    }
+    memcpy(m_key + header.offset * 3, payload, length);
+    for (uint16_t i = 0; i < header.count; i++) {
+      const uint8_t* c = payload + i * 3;
+      setPixel(header.offset + i, c[0], c[1], c[2]);
+    }
+    m_keySequence = header.sequence;
+    m_keyOffset = header.offset;
+    m_keyCount = header.count;
+    m_haveKey = true;
+    return true;
+  }
+
+  if (length < 2) {
+    return false;
+  }
+  uint16_t base;
+  const uint8_t* runs = getU16(payload, base);
+  const uint8_t* end = payload + length;
+  if (!m_haveKey || base != m_keySequence ||
+      header.offset != m_keyOffset || header.count != m_keyCount) {
+    m_deltasSkipped++;
+    return false;
+  }
+
+  // check every run fits before changing any pixel
+  uint32_t covered = 0;
+  for (const uint8_t* p = runs; p < end; ) {
+    if (end - p < 2) {
+      return false;
+    }
+    uint8_t run = p[1] & kPixelRunMaxLength;
+    size_t data = (p[1] & kPixelRunFill) ? 3 : (size_t)run * 3;
+    covered += p[0] + run;
+    p += 2;
+    if ((size_t)(end - p) < data || covered > header.count) {
+      return false;
+    }
+    p += data;
+  }
+
+  const uint8_t* key = m_key + header.offset * 3;
+  uint16_t i = 0;
+  for (const uint8_t* p = runs; p < end; ) {
+    for (uint16_t n = i + p[0]; i < n; i++) {
+      setPixel(header.offset + i, key[i * 3], key[i * 3 + 1], key[i * 3 + 2]);
+    }
+    uint8_t run = p[1] & kPixelRunMaxLength;
+    bool fill = p[1] & kPixelRunFill;
+    p += 2;
+    for (uint8_t n = 0; n < run; n++, i++) {
+      const uint8_t* c = fill ? p : p + n * 3;
+      setPixel(header.offset + i, c[0], c[1], c[2]);
+    }
+    p += fill ? 3 : (size_t)run * 3;
+  }
+  for (; i < header.count; i++) {
+    setPixel(header.offset + i, key[i * 3], key[i * 3 + 1], key[i * 3 + 2]);
+  }
+  return true;
+}
+
+//---- PixelFrameReceiver
+
+void PixelFrameReceiver::restart(uint32_t offset, uint32_t nowMillis)
+{
+  m_minOffset = offset;
+  m_minOffsetRelaxed = nowMillis;
+  m_staleRun = 0;
+}
+
+bool PixelFrameReceiver::accept(const uint8_t* packet, size_t length, uint32_t nowMillis)
+{
+  PixelFrameHeader header;
+  if (!pixelDecodeHeader(packet, length, header) ||
+      (uint32_t)header.offset + header.count > m_numPixels) {
+    m_framesBad++;
+    return false;
+  }
+
+  uint32_t offset = nowMillis - header.timestamp;
+
+  int16_t ahead = (int16_t)(header.sequence - m_lastSequence);
+  if (!m_haveSequence || (header.flags & kPixelFrameRestart) || ahead < -kPixelReorderWindow) {
+    restart(offset, nowMillis);
+  } else if (ahead == 0) {
+    m_framesDuplicate++;
+    return false;
+  } else if (ahead < 0) {
+    // it was counted lost when the packets after it came
+    m_framesReordered++;
+    if (m_framesLost > 0) {
+      m_framesLost--;
+    }
+    return false;
+  } else {
+    m_framesLost += ahead - 1;
+  }
+  m_haveSequence = true;
+  m_lastSequence = header.sequence;
+
+  if (nowMillis - m_minOffsetRelaxed >= 1000) {
+    m_minOffset++;
+    m_minOffsetRelaxed = nowMillis;
+  }
+  int32_t delay = (int32_t)(offset - m_minOffset);
+  if (delay < 0) {
+    m_minOffset = offset;
+    delay = 0;
+  }
+
+  if (delay > kPixelFrameStaleMillis) {
+    if (++m_staleRun < kPixelStaleRunLimit) {
+      m_framesStale++;
+      return false;
+    }
+    restart(offset, nowMillis);
+    delay = 0;
+  } else {
+    m_staleRun = 0;
+  }
+
+  m_header = header;
+  m_payload = packet + kPixelFrameHeaderSize;
+  m_payloadLength = length - kPixelFrameHeaderSize;
+  m_lastDelay = delay;
+  m_framesGood++;
+  return true;
+}
+
+void PixelFrameReceiver::resetStats()
+{
+  m_framesGood = 0;
+  m_framesBad = 0;
+  m_framesLost = 0;
+  m_framesDuplicate = 0;
+  m_framesReordered = 0;
+  m_framesStale = 0;
+}
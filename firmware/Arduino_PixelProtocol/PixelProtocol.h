@@ -0,0 +1,202 @@
+#ifndef PIXEL_PROTOCOL_H
+#define PIXEL_PROTOCOL_H
+
+//
+// UDP packets of RGB pixels, from the visualizer to the christmasUDP ball
+// light controller.  Used as is by both: an Arduino library for the sketch,
+// and plain C++ for the host.
+//
+// A packet is a header, big endian,
+//
+//   magic (2)  version  flags  sequence (2)  timestamp (4)  offset (2)  count (2)
+//
+// then count RGB triples for the pixels from offset on.  The sequence goes
+// up by one per packet.  The timestamp is the host's clock in milliseconds
+// when it sent the packet; only differences between packets mean anything.
+//
+// A packet with the delta flag is a keyframe's pixels with some runs
+// changed.  After the header it has the keyframe's sequence (2), then runs
+// until the end of the packet, each
+//
+//   skip  run  RGB...
+//
+// skip pixels as in the keyframe, then run & 0x7F changed pixels: one RGB
+// for all of them if the top bit of run is set, otherwise one RGB each.
+// Pixels after the last run are as in the keyframe.  Deltas only build on
+// the keyframe, never on each other, so losing one costs just that packet.
+//
+// WiFi delivers packets late, twice or out of order.  The controller applies
+// a packet only if it is newer than every packet before it and did not spend
+// much longer getting there than the quickest ones do.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const uint16_t kPixelProtocolMagic = 0x5850;   // "XP"
+static const uint8_t kPixelProtocolVersion = 1;
+
+// flags
+static const uint8_t kPixelFrameShow = 0x01;      // latch the pixels once this packet is applied
+static const uint8_t kPixelFrameRestart = 0x02;   // the sender started over; take its sequence as is
+static const uint8_t kPixelFrameDelta = 0x04;     // runs changed since a keyframe, over its offset and count
+
+static const uint8_t kPixelFrameHeaderSize = 14;
+
+// keeps a packet inside one unfragmented datagram on any link
+static const uint16_t kPixelFrameMaxPixels = 170;
+static const uint16_t kPixelFrameMaxSize = kPixelFrameHeaderSize + kPixelFrameMaxPixels * 3;
+
+// a packet this much slower than the quickest recent ones is too late to show
+static const uint16_t kPixelFrameStaleMillis = 100;
+
+// delta runs
+static const uint8_t kPixelRunFill = 0x80;
+static const uint8_t kPixelRunMaxLength = 0x7F;
+
+// at most this many frames between keyframes, sent or not; a controller that
+// missed a keyframe or came up late shows the right pixels again after it
+static const uint8_t kPixelKeyframeInterval = 10;
+
+struct PixelFrameHeader {
+  uint8_t flags;
+  uint16_t sequence;
+  uint32_t timestamp;
+  uint16_t offset;
+  uint16_t count;
+};
+
+// Writes the header and count pixels from rgb to out.  Returns the number of
+// bytes to send, or 0 if there are too many pixels or out is too small.
+size_t pixelEncodeFrame(const PixelFrameHeader& header, const uint8_t* rgb,
+                        uint8_t* out, size_t outCapacity);
+
+// Fills header from packet.  false unless the magic, version and length all
+// check out; a delta's runs are checked when it is applied.  The payload
+// starts at packet + kPixelFrameHeaderSize.
+bool pixelDecodeHeader(const uint8_t* packet, size_t length, PixelFrameHeader& header);
+
+// Host side: turns pixels into keyframes or deltas, whichever is smaller.
+// The frame's flags, sequence, timestamp, offset and count come from the
+// header passed in; the delta flag is the encoder's.
+class PixelFrameEncoder {
+
+  public:
+
+    PixelFrameEncoder() {}
+
+    // Writes a packet for count pixels from rgb to out.  Returns its length,
+    // or 0 when the pixels are the ones last encoded and no keyframe is due,
+    // or out is too small for a keyframe.
+    size_t encode(const PixelFrameHeader& header, const uint8_t* rgb,
+                  uint8_t* out, size_t outCapacity);
+
+    void forceKeyframe() { m_haveKey = false; }
+
+  private:
+
+    // false if the runs take more than outCapacity
+    bool encodeRuns(const uint8_t* rgb, uint16_t count,
+                    uint8_t* out, size_t outCapacity, size_t& length) const;
+
+    uint8_t m_key[kPixelFrameMaxPixels * 3];
+    uint8_t m_last[kPixelFrameMaxPixels * 3];
+    uint16_t m_keySequence = 0;
+    uint16_t m_keyOffset = 0;
+    uint16_t m_keyCount = 0;
+    uint8_t m_sinceKey = 0;
+    bool m_haveKey = false;
+};
+
+// Controller side: applies keyframes and deltas, handing every pixel the
+// frame covers to setPixel.  The keyframe is kept in keyStorage, which needs
+// room for numPixels RGB triples.
+class PixelFrameDecoder {
+
+  public:
+
+    typedef void (*PixelSetter)(uint16_t index, uint8_t r, uint8_t g, uint8_t b);
+
+    PixelFrameDecoder(uint8_t* keyStorage, uint16_t numPixels)
+      : m_key(keyStorage), m_numPixels(numPixels) {}
+
+    // false if the runs are malformed, or the frame is a delta whose
+    // keyframe never arrived
+    bool apply(const PixelFrameHeader& header, const uint8_t* payload, size_t length,
+               PixelSetter setPixel);
+
+    uint16_t deltasSkipped() const { return m_deltasSkipped; }
+
+  private:
+
+    uint8_t* m_key;
+    uint16_t m_numPixels;
+
+    uint16_t m_keySequence = 0;
+    uint16_t m_keyOffset = 0;
+    uint16_t m_keyCount = 0;
+    bool m_haveKey = false;
+    uint16_t m_deltasSkipped = 0;
+};
+
+// Controller side: decides which packets are worth showing, and keeps count
+// of the rest.
+class PixelFrameReceiver {
+
+  public:
+
+    explicit PixelFrameReceiver(uint16_t numPixels) : m_numPixels(numPixels) {}
+
+    // true if the packet should be applied, after which header() and
+    // payload() describe it until the next call
+    bool accept(const uint8_t* packet, size_t length, uint32_t nowMillis);
+
+    const PixelFrameHeader& header() const { return m_header; }
+    const uint8_t* payload() const { return m_payload; }
+    size_t payloadLength() const { return m_payloadLength; }
+
+    uint32_t framesGood() const { return m_framesGood; }
+    uint32_t framesBad() const { return m_framesBad; }            // malformed, or pixels out of range
+
+    // by sequence number: packets never seen, seen again, and seen after a newer one
+    uint32_t framesLost() const { return m_framesLost; }
+    uint32_t framesDuplicate() const { return m_framesDuplicate; }
+    uint32_t framesReordered() const { return m_framesReordered; }
+
+    // in order, but kPixelFrameStaleMillis slower than the quickest
+    uint32_t framesStale() const { return m_framesStale; }
+
+    // how much slower than the quickest recent packet the last good one was
+    uint32_t lastDelayMillis() const { return m_lastDelay; }
+
+    void resetStats();
+
+  private:
+
+    void restart(uint32_t offset, uint32_t nowMillis);
+
+    uint16_t m_numPixels;
+
+    PixelFrameHeader m_header = {};
+    const uint8_t* m_payload = 0;
+    size_t m_payloadLength = 0;
+
+    bool m_haveSequence = false;
+    uint16_t m_lastSequence = 0;
+
+    // now - timestamp for the quickest recent packet; the two clocks have
+    // different zeros and drift apart, so it is let up a little every second
+    uint32_t m_minOffset = 0;
+    uint32_t m_minOffsetRelaxed = 0;
+    uint32_t m_lastDelay = 0;
+    uint8_t m_staleRun = 0;
+
+    uint32_t m_framesGood = 0;
+    uint32_t m_framesBad = 0;
+    uint32_t m_framesLost = 0;
+    uint32_t m_framesDuplicate = 0;
+    uint32_t m_framesReordered = 0;
+    uint32_t m_framesStale = 0;
+};
+
+#endif // PIXEL_PROTOCOL_H
@@ -0,0 +1,328 @@
+#include "TreeProtocol.h"
+
+#include <string.h>
+
+uint16_t treeCRC16(uint16_t crc, uint8_t byte)
+{
+  crc ^= (uint16_t)byte << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return crc;
+}
+
+size_t treeEncodeFrame(uint8_t type, uint8_t sequence,
+                       const uint8_t* payload, size_t payloadLength,
+                       uint8_t* out, size_t outCapacity)
+{
+  if (payloadLength > kTreeFrameMaxPayload || outCapacity < kTreeFrameMaxEncoded) {
+    return 0;
+  }
+
+  uint8_t frame[kTreeFrameMaxDecoded];
+  size_t length = 0;
+  frame[length++] = kTreeProtocolVersion;
+  frame[length++] = type;
+  frame[length++] = sequence;
+  memcpy(frame + length, payload, payloadLength);
+  length += payloadLength;
+
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc = treeCRC16(crc, frame[i]);
+  }
+  crc = ~crc;
+  frame[length++] = crc >> 8;
+  frame[length++] = crc & 0xFF;
+
+  // COBS: each block starts with the distance to the next zero, which is dropped
+  size_t written = 1;
+  size_t codeIndex = 0;
+  uint8_t code = 1;
+  for (size_t i = 0; i < length; i++) {
+    if (frame[i] == 0) {
+      out[codeIndex] = code;
+      codeIndex = written++;
+      code = 1;
+    } else {
+      out[written++] = frame[i];
+      if (++code == 0xFF) {
+        out[codeIndex] = code;
+        codeIndex = written++;
+        code = 1;
+      }
+    }
+  }
+  out[codeIndex] = code;
+  out[written++] = 0;
+
+  return written;
+}
+
+static uint8_t* putU16(uint8_t* out, uint16_t value)
+{
+  *out++ = value >> 8;
+  *out++ = value & 0xFF;
+  return out;
+}
+
+static const uint8_t* getU16(const uint8_t* in, uint16_t& value)
+{
+  value = (uint16_t)(in[0] << 8 | in[1]);
+  return in + 2;
+}
+
+void treePackHeartbeat(const TreeHeartbeat& heartbeat, uint8_t* out)
+{
+  *out++ = heartbeat.treeBits;
+  *out++ = heartbeat.flags;
+  out = putU16(out, heartbeat.framesGood);
+  out = putU16(out, heartbeat.framesBad);
+  out = putU16(out, heartbeat.framesMissed);
+  out = putU16(out, heartbeat.loopMicrosMean);
+  putU16(out, heartbeat.loopMicrosMax);
+}
+
+bool treeUnpackHeartbeat(const uint8_t* payload, size_t length, TreeHeartbeat& heartbeat)
+{
+  if (length != kTreeHeartbeatSize) {
+    return false;
+  }
+  heartbeat.treeBits = *payload++;
+  heartbeat.flags = *payload++;
+  payload = getU16(payload, heartbeat.framesGood);
+  payload = getU16(payload, heartbeat.framesBad);
+  payload = getU16(payload, heartbeat.framesMissed);
+  payload = getU16(payload, heartbeat.loopMicrosMean);
+  getU16(payload, heartbeat.loopMicrosMax);
+  return true;
+}
+
+//---- TreeRibbonEncoder
+
+static uint8_t packedLevel(const uint8_t* packed, uint8_t index)
+{
+  uint8_t byte = packed[index >> 1];
+  return (index & 1) ? (byte & 0x0F) : (byte >> 4);
+}
+
+static void packLevel(uint8_t* packed, uint8_t index, uint8_t level)
+{
+  if (index & 1) {
+    packed[index >> 1] |= level;
+  } else {
+    packed[index >> 1] = level << 4;
+  }
+}
+
+uint8_t TreeRibbonEncoder::encode(uint8_t treeBits, const uint8_t* intensities, uint8_t sequence,
+                                  uint8_t* payload, uint8_t& payloadLength)
+{
+  uint8_t brightest = 0;
+  for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+    if (intensities[i] > brightest) {
+      brightest = intensities[i];
+    }
+  }
+
+  // the scale only changes with a key frame, so deltas keep their base's;
+  // one that would clip the brightest pixel needs a key frame now
+  bool key = !m_haveBase || m_deltas >= kTreeRibbonKeyframeInterval ||
+             brightest > kTreeRibbonMaxLevel * m_scale;
+  if (key) {
+    m_scale = brightest > kTreeRibbonMaxLevel ? (brightest + kTreeRibbonMaxLevel - 1) / kTreeRibbonMaxLevel : 1;
+  }
+
+  uint8_t levels[kTreeRibbonSize];
+  uint8_t changed = 0;
+  for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+    uint16_t level = (intensities[i] + m_scale / 2) / m_scale;
+    levels[i] = level > kTreeRibbonMaxLevel ? kTreeRibbonMaxLevel : level;
+    if (!m_haveBase || levels[i] != m_levels[i]) {
+      changed++;
+    }
+  }
+
+  if (!key && changed == 0 && treeBits == m_treeBits) {
+    return 0;
+  }
+
+  uint8_t deltaLength = 2 + kTreeRibbonBitmapSize + (changed + 1) / 2;
+  uint8_t keyLength = 2 + kTreeRibbonPackedSize;
+  if (!key && deltaLength >= keyLength) {
+    key = true;
+  }
+
+  uint8_t type;
+  payload[0] = treeBits;
+  if (key) {
+    type = kTreeFrameRibbonKey;
+    payload[1] = m_scale;
+    for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+      packLevel(payload + 2, i, levels[i]);
+    }
+    payloadLength = keyLength;
+    m_deltas = 0;
+  } else {
+    type = kTreeFrameRibbonDelta;
+    payload[1] = m_sequence;
+    uint8_t* bitmap = payload + 2;
+    uint8_t* packed = bitmap + kTreeRibbonBitmapSize;
+    memset(bitmap, 0, kTreeRibbonBitmapSize);
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+      if (levels[i] != m_levels[i]) {
+        bitmap[i >> 3] |= 1 << (i & 7);
+        packLevel(packed, n++, levels[i]);
+      }
+    }
+    payloadLength = deltaLength;
+    m_deltas++;
+  }
+
+  memcpy(m_levels, levels, sizeof(m_levels));
+  m_treeBits = treeBits;
+  m_sequence = sequence;
+  m_haveBase = true;
+
+  return type;
+}
+
+//---- TreeRibbonDecoder
+
+bool TreeRibbonDecoder::apply(uint8_t type, uint8_t sequence, const uint8_t* payload, uint8_t length, PixelSetter setPixel)
+{
+  if (type == kTreeFrameRibbon) {
+    if (length != 1 + kTreeRibbonSize) {
+      return false;
+    }
+    for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+      setPixel(i, payload[1 + i]);
+    }
+    // deltas only build on key frames
+    m_haveBase = false;
+    return true;
+  }
+
+  if (type == kTreeFrameRibbonKey) {
+    if (length != 2 + kTreeRibbonPackedSize) {
+      return false;
+    }
+    m_scale = payload[1];
+    for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+      setPixel(i, packedLevel(payload + 2, i) * m_scale);
+    }
+    m_sequence = sequence;
+    m_haveBase = true;
+    return true;
+  }
+
+  if (type == kTreeFrameRibbonDelta) {
+    if (length < 2 + kTreeRibbonBitmapSize) {
+      return false;
+    }
+    if (!m_haveBase || payload[1] != m_sequence) {
+      m_deltasSkipped++;
+      return false;
+    }
+
+    const uint8_t* bitmap = payload + 2;
+    const uint8_t* packed = bitmap + kTreeRibbonBitmapSize;
+    uint8_t changed = 0;
+    for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+      if (bitmap[i >> 3] & (1 << (i & 7))) {
+        changed++;
+      }
+    }
+    if (length != 2 + kTreeRibbonBitmapSize + (changed + 1) / 2) {
+      return false;
+    }
+
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+      if (bitmap[i >> 3] & (1 << (i & 7))) {
+        setPixel(i, packedLevel(packed, n++) * m_scale);
+      }
+    }
+    m_sequence = sequence;
+    return true;
+  }
+
+  return false;
+}
+
+//---- TreeFrameDecoder
+
+void TreeFrameDecoder::append(uint8_t byte)
+{
+  if (m_length == sizeof(m_buffer)) {
+    m_overflow = true;
+    return;
+  }
+  // the CRC runs two bytes behind, so it never covers the frame's own CRC
+  if (m_length >= kTreeFrameCRCSize) {
+    m_crc = treeCRC16(m_crc, m_buffer[m_length - kTreeFrameCRCSize]);
+  }
+  m_buffer[m_length++] = byte;
+}
+
+bool TreeFrameDecoder::feed(uint8_t byte)
+{
+  if (byte == 0) {
+    return finishFrame();
+  }
+
+  m_frameLength = 0;
+  if (m_overflow) {
+    return false;
+  }
+
+  if (m_codeLeft == 0) {
+    // a block shorter than the longest one stood for a zero
+    if (m_code != 0 && m_code != 0xFF) {
+      append(0);
+    }
+    m_code = byte;
+    m_codeLeft = byte - 1;
+  } else {
+    append(byte);
+    m_codeLeft--;
+  }
+  return false;
+}
+
+bool TreeFrameDecoder::finishFrame()
+{
+  // the CRC goes out inverted: as is, losing a trailing 0x00 CRC byte would
+  // leave a shorter frame whose last two bytes are its CRC
+  bool started = m_code != 0;
+  bool good = started && !m_overflow && m_codeLeft == 0 &&
+              m_length >= kTreeFrameHeaderSize + kTreeFrameCRCSize &&
+              (uint16_t)~m_crc == (uint16_t)(m_buffer[m_length - 2] << 8 | m_buffer[m_length - 1]) &&
+              m_buffer[0] == kTreeProtocolVersion;
+
+  m_frameLength = good ? m_length : 0;
+  m_length = 0;
+  m_code = 0;
+  m_codeLeft = 0;
+  m_overflow = false;
+  m_crc = 0xFFFF;
+
+  if (!good) {
+    // back to back delimiters are just idle line, not a bad frame
+    if (started) {
+      m_framesBad++;
+    }
+    return false;
+  }
+
+  uint8_t sequence = m_buffer[2];
+  if (m_haveSequence && sequence != m_nextSequence) {
+    m_framesMissed += (uint8_t)(sequence - m_nextSequence);
+  }
+  m_haveSequence = true;
+  m_nextSequence = sequence + 1;
+  m_framesGood++;
+
+  return true;
+}
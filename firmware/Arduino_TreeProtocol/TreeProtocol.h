@@ -0,0 +1,186 @@
+#ifndef TREE_PROTOCOL_H
+#define TREE_PROTOCOL_H
+
+//
+// Framing for the serial link between the visualizer and the christmasStrand
+// firmware.  Used as is by both: an Arduino library for the sketch, and
+// plain C++ for the host.
+//
+// A frame is
+//
+//   version  type  sequence  payload...  crc16 (big endian)
+//
+// COBS encoded and followed by a single 0x00.  COBS keeps 0x00 out of the
+// encoded bytes, so every byte value is allowed in the payload and the 0x00
+// always marks a frame boundary: after a dropped or garbled byte the decoder
+// is back in step at the next frame.  The CRC is CRC-16/GENIBUS (the CCITT
+// polynomial from 0xFFFF, inverted) over everything before it.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const uint8_t kTreeProtocolVersion = 1;
+
+// frame types, host -> strand
+static const uint8_t kTreeFrameTree = 0x01;         // payload: tree bits
+static const uint8_t kTreeFrameRibbon = 0x02;       // payload: tree bits, kTreeRibbonSize intensities
+static const uint8_t kTreeFrameRibbonKey = 0x03;    // payload: tree bits, scale, 4-bit levels
+static const uint8_t kTreeFrameRibbonDelta = 0x04;  // payload: tree bits, base sequence, changed bitmap, changed 4-bit levels
+static const uint8_t kTreeFrameProbe = 0x05;        // no payload; answered with a heartbeat straight away
+
+// frame types, strand -> host
+static const uint8_t kTreeFrameHeartbeat = 0x81;    // payload: a packed TreeHeartbeat
+
+static const uint8_t kTreeRibbonSize = 75;
+
+// Packed ribbons carry a level of 0-15 per pixel, two to a byte, high
+// nibble first; the intensity is level * scale.  A key frame sets the scale
+// and all the levels.  A delta frame has a bit per pixel, low bit first, for
+// the pixels whose level changed since the frame with the base sequence, then
+// just those levels.  The strand skips deltas whose base it never applied
+// until the next key frame.
+static const uint8_t kTreeRibbonMaxLevel = 15;
+static const uint8_t kTreeRibbonPackedSize = (kTreeRibbonSize + 1) / 2;
+static const uint8_t kTreeRibbonBitmapSize = (kTreeRibbonSize + 7) / 8;
+static const uint8_t kTreeRibbonKeyframeInterval = 10;  // at most this many deltas between key frames
+
+static const uint8_t kTreeFrameHeaderSize = 3;
+static const uint8_t kTreeFrameCRCSize = 2;
+static const uint8_t kTreeFrameMaxPayload = 1 + kTreeRibbonSize;
+static const uint8_t kTreeFrameMaxDecoded = kTreeFrameHeaderSize + kTreeFrameMaxPayload + kTreeFrameCRCSize;
+
+// COBS adds one byte per 254, plus the trailing 0x00
+static const uint8_t kTreeFrameMaxEncoded = kTreeFrameMaxDecoded + kTreeFrameMaxDecoded / 254 + 2;
+
+// What the strand reports about itself, a few times a second at most
+struct TreeHeartbeat {
+  uint8_t treeBits;
+  uint8_t flags;
+
+  // the strand's TreeFrameDecoder counters
+  uint16_t framesGood;
+  uint16_t framesBad;
+  uint16_t framesMissed;
+
+  // time between passes of the strand's serial loop since the last heartbeat
+  uint16_t loopMicrosMean;
+  uint16_t loopMicrosMax;
+};
+
+static const uint8_t kTreeHeartbeatActive = 0x01;   // frames arrived within the idle timeout
+
+static const uint8_t kTreeHeartbeatSize = 12;
+
+uint16_t treeCRC16(uint16_t crc, uint8_t byte);
+
+// Big endian, like the CRC.  Unpacking fails on a payload of the wrong size.
+void treePackHeartbeat(const TreeHeartbeat& heartbeat, uint8_t* out);
+bool treeUnpackHeartbeat(const uint8_t* payload, size_t length, TreeHeartbeat& heartbeat);
+
+// Writes a complete frame, delimiter included, to out.  Returns the number
+// of bytes to send, or 0 if the payload or out is too small for it.
+size_t treeEncodeFrame(uint8_t type, uint8_t sequence,
+                       const uint8_t* payload, size_t payloadLength,
+                       uint8_t* out, size_t outCapacity);
+
+// Host side: turns ribbon intensities into key or delta frames, whichever is
+// smaller.  Assumes every frame it encodes gets sent; call forceKeyframe()
+// when one wasn't.
+class TreeRibbonEncoder {
+
+  public:
+
+    TreeRibbonEncoder() {}
+
+    // Returns the frame type for payload, or 0 when the strand already shows
+    // these levels and there is nothing to send.  sequence is the sequence
+    // number the frame will go out with.
+    uint8_t encode(uint8_t treeBits, const uint8_t* intensities, uint8_t sequence,
+                   uint8_t* payload, uint8_t& payloadLength);
+
+    void forceKeyframe() { m_haveBase = false; }
+
+  private:
+
+    uint8_t m_levels[kTreeRibbonSize];
+    uint8_t m_scale = 1;
+    uint8_t m_treeBits = 0;
+    uint8_t m_sequence = 0;
+    uint8_t m_deltas = 0;
+    bool m_haveBase = false;
+};
+
+// Strand side: applies ribbon frames of every kind, handing each pixel that
+// changes to setPixel.
+class TreeRibbonDecoder {
+
+  public:
+
+    typedef void (*PixelSetter)(uint8_t index, uint8_t intensity);
+
+    TreeRibbonDecoder() {}
+
+    // false if the frame isn't a ribbon frame, is malformed, or is a delta
+    // whose base never arrived; the tree bits are payload[0] either way
+    bool apply(uint8_t type, uint8_t sequence, const uint8_t* payload, uint8_t length, PixelSetter setPixel);
+
+    uint16_t deltasSkipped() const { return m_deltasSkipped; }
+
+  private:
+
+    uint8_t m_scale = 1;
+    uint8_t m_sequence = 0;
+    bool m_haveBase = false;
+    uint16_t m_deltasSkipped = 0;
+};
+
+// Decodes frames a byte at a time, as they arrive.  A frame that is too long,
+// fails its CRC or has the wrong version is dropped and counted; decoding
+// starts over at the next 0x00.
+class TreeFrameDecoder {
+
+  public:
+
+    TreeFrameDecoder() {}
+
+    // true once byte completes a good frame, which type(), sequence() and
+    // payload() then describe until the next call
+    bool feed(uint8_t byte);
+
+    uint8_t type() const { return m_buffer[1]; }
+    uint8_t sequence() const { return m_buffer[2]; }
+    const uint8_t* payload() const { return m_buffer + kTreeFrameHeaderSize; }
+    uint8_t payloadLength() const { return m_frameLength ? m_frameLength - kTreeFrameHeaderSize - kTreeFrameCRCSize : 0; }
+
+    uint16_t framesGood() const { return m_framesGood; }
+    uint16_t framesBad() const { return m_framesBad; }
+
+    // frames the sequence numbers say never arrived
+    uint16_t framesMissed() const { return m_framesMissed; }
+
+  private:
+
+    bool finishFrame();
+    void append(uint8_t byte);
+
+    uint8_t m_buffer[kTreeFrameMaxDecoded];
+    uint8_t m_length = 0;
+    uint8_t m_frameLength = 0;
+
+    // COBS state: the current block's code and how many of its bytes are still to come
+    uint8_t m_code = 0;
+    uint8_t m_codeLeft = 0;
+    bool m_overflow = false;
+
+    uint16_t m_crc = 0xFFFF;
+
+    bool m_haveSequence = false;
+    uint8_t m_nextSequence = 0;
+
+    uint16_t m_framesGood = 0;
+    uint16_t m_framesBad = 0;
+    uint16_t m_framesMissed = 0;
+};
+
+#endif // TREE_PROTOCOL_H
@@ -3,14 +3,35 @@
 #include <avr/power.h>
 #endif
 
+#include "TreeProtocol.h"
+
 #define PIN 6
 #define TIMEOUT 5
+#define HEARTBEAT_INTERVAL 1000   // ms between heartbeats while nothing changes
 
 unsigned long t0 = millis();
 unsigned long second_counter = millis();
 uint8_t idle_counter = 0;
 
 uint8_t simpleLightBits = 0xf;
+bool active = false;
+
+unsigned long heartbeat_time = 0;
+uint8_t heartbeat_sequence = 0;
+
+// loop timing since the last heartbeat
+unsigned long loop_micros = 0;
+uint32_t loop_micros_total = 0;
+uint16_t loop_micros_max = 0;
+uint16_t loop_count = 0;
+
+TreeFrameDecoder decoder;
+TreeRibbonDecoder ribbonDecoder;
+Adafruit_NeoPixel strip = Adafruit_NeoPixel(kTreeRibbonSize, PIN, NEO_GRB + NEO_KHZ800);
+
+void setRibbonPixel(uint8_t index, uint8_t intensity) {
+  strip.setPixelColor(index, intensity, intensity, intensity);
+}
 
 void setup() {
   // This is for Trinket 5V 16MHz, you can remove these three lines if you are not using a Trinket
@@ -26,6 +47,9 @@ void setup() {
   // initialize the second counter
   second_counter = millis();
 
+  strip.begin();
+  strip.show();
+
   set_on();
 
   //Reserve space for the inputString and buffer
@@ -51,29 +75,107 @@ void serialDelay(uint8_t wait) {
 
       if (idle_counter > TIMEOUT) {
         set_on();
+        if (active) {
+          active = false;
+          sendHeartbeat();
+        }
       }
     }
 
+    timeLoop();
+
     // Check for new serial data
     serialEvent();
     setSimpleLights(simpleLightBits);
+
+    if ((millis() - heartbeat_time) >= HEARTBEAT_INTERVAL) {
+      sendHeartbeat();
+    }
   }
 }
 
 void serialEvent() {
 
+  bool ribbonChanged = false;
+
   while (Serial.available()) {
+    // a partial or corrupt frame is dropped by the decoder, nothing to undo here
+    if (!decoder.feed(Serial.read())) {
+      continue;
+    }
+
+    const uint8_t* payload = decoder.payload();
+    uint8_t length = decoder.payloadLength();
+
+    if (decoder.type() == kTreeFrameProbe) {
+      // the host is looking for the strand; not a sign of music
+      sendHeartbeat();
+      continue;
+    } else if (decoder.type() == kTreeFrameTree && length == 1) {
+      simpleLightBits = payload[0];
+    } else if (ribbonDecoder.apply(decoder.type(), decoder.sequence(), payload, length, setRibbonPixel)) {
+      simpleLightBits = payload[0];
+      ribbonChanged = true;
+    } else {
+      continue;
+    }
+
     // reset the idle timer
     idle_counter = 0;
-    // get the new byte:
-    simpleLightBits = Serial.read();   
+    if (!active) {
+      active = true;
+      sendHeartbeat();
+    }
   }
 
-  if (idle_counter == 0) {
-    Serial.write(simpleLightBits);
-    Serial.write(0xDB);
+  // show() runs with interrupts off, so once for however many frames came in;
+  // bytes lost meanwhile cost at most the frame they belonged to
+  if (ribbonChanged) {
+    strip.show();
+  }
+}
+
+void timeLoop() {
+  unsigned long now = micros();
+  if (loop_count < 0xFFFF && loop_micros != 0) {
+    unsigned long gap = now - loop_micros;
+    uint16_t clamped = gap > 0xFFFF ? 0xFFFF : gap;
+    loop_micros_total += clamped;
+    loop_micros_max = max(loop_micros_max, clamped);
+    loop_count++;
+  }
+  loop_micros = now;
+}
+
+// Tells the host how the link looks from this end.  Sent every
+// HEARTBEAT_INTERVAL, straight away when frames start or stop arriving, and
+// in answer to a probe.
+void sendHeartbeat() {
+  TreeHeartbeat heartbeat;
+  heartbeat.treeBits = simpleLightBits;
+  heartbeat.flags = active ? kTreeHeartbeatActive : 0;
+  heartbeat.framesGood = decoder.framesGood();
+  heartbeat.framesBad = decoder.framesBad();
+  heartbeat.framesMissed = decoder.framesMissed();
+  heartbeat.loopMicrosMean = loop_count ? loop_micros_total / loop_count : 0;
+  heartbeat.loopMicrosMax = loop_micros_max;
+
+  uint8_t payload[kTreeHeartbeatSize];
+  treePackHeartbeat(heartbeat, payload);
+
+  uint8_t frame[kTreeFrameMaxEncoded];
+  size_t length = treeEncodeFrame(kTreeFrameHeartbeat, heartbeat_sequence++, payload, sizeof(payload), frame, sizeof(frame));
+
+  // never wait on the UART; a heartbeat that doesn't fit is skipped, and the
+  // host sees the gap in the sequence
+  if ((size_t)Serial.availableForWrite() >= length) {
+    Serial.write(frame, length);
   }
 
+  heartbeat_time = millis();
+  loop_micros_total = 0;
+  loop_micros_max = 0;
+  loop_count = 0;
 }
 
 void setSimpleLights(uint8_t inByte) {
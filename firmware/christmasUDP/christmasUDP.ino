@@ -9,6 +9,7 @@
 #include <WiFiUdp.h>
 
 #include "BallLight.h"
+#include "PixelProtocol.h"
 
 /*****************************************************************************
   Example sketch for driving Adafruit WS2801 pixels!
@@ -56,7 +57,7 @@ WiFiUDP Udp;
 
 unsigned int localPort = 2390;      // local port to listen on
 
-char packetBuffer[255]; //buffer to hold incoming packet
+uint8_t packetBuffer[kPixelFrameMaxSize]; //buffer to hold incoming packet
 char  ReplyBuffer[] = "acknowledged";       // a string to send back
 
 // Idle timer
@@ -66,6 +67,17 @@ bool noPacket = true;
 #define NUM_BALLS 25
 BallLight lights[NUM_BALLS];
 
+// drops late, repeated and out of order packets, and counts them
+PixelFrameReceiver receiver(NUM_BALLS);
+
+// builds the pixels from keyframes and the deltas on them
+uint8_t keyPixels[NUM_BALLS * 3];
+PixelFrameDecoder decoder(keyPixels, NUM_BALLS);
+
+#define STATS_INTERVAL 5000   // ms between link statistics on the serial port
+unsigned long statsTime = 0;
+uint16_t deltasSkipped = 0;
+
 
 void setup() {
 #if defined(__AVR_ATtiny85__) && (F_CPU == 16000000L)
@@ -147,38 +159,35 @@ void loop() {
   int packetSize = Udp.parsePacket();
   if (packetSize)
   {
-    Serial.print("Received packet of size ");
-    Serial.println(packetSize);
-    Serial.print("From ");
-    IPAddress remoteIp = Udp.remoteIP();
-    Serial.print(remoteIp);
-    Serial.print(", port ");
-    Serial.println(Udp.remotePort());
-
-    // read the packet into packetBufffer
-    int len = Udp.read(packetBuffer, 255);
-    if (len > 0) packetBuffer[len] = 0;
-    Serial.println("Contents:");
-    Serial.println(packetBuffer);
-
-    processPacket();
-    //
-    //    // send a reply, to the IP address and port that sent us the packet we received
-    //    Udp.beginPacket(Udp.remoteIP(), Udp.remotePort());
-    //    Udp.write(ReplyBuffer);
-    //    Udp.endPacket();
-
-    noPacket = false;
-    Serial.println("Timer Reset");
-    Timer = millis();
+    // read the packet into packetBufffer; one too long for it can be no
+    // good packet, and only what was read may be decoded
+    int len = Udp.read(packetBuffer, sizeof(packetBuffer));
+    if (packetSize > (int)sizeof(packetBuffer) || len < 0) len = 0;
+
+    // a delta whose keyframe is missing leaves the idle animation running
+    if (receiver.accept(packetBuffer, len, millis()) && processPacket()) {
+      //
+      //    // send a reply, to the IP address and port that sent us the packet we received
+      //    Udp.beginPacket(Udp.remoteIP(), Udp.remotePort());
+      //    Udp.write(ReplyBuffer);
+      //    Udp.endPacket();
+      noPacket = false;
+      Timer = millis();
+    }
   }
 
-  if (millis() - Timer > 5000)
+  if (!noPacket && millis() - Timer > 5000)
   {
     Serial.println("Packet Timeout");
     noPacket = true;
   }
 
+  if (millis() - statsTime >= STATS_INTERVAL)
+  {
+    printLinkStats();
+    statsTime = millis();
+  }
+
   if (noPacket)
   {
     // Some example procedures showing how to display to the pixels
@@ -191,14 +200,44 @@ void loop() {
   }
 }
 
-void processPacket() {
-  int i;
+void setBallPixel(uint16_t index, uint8_t r, uint8_t g, uint8_t b) {
+  strip.setPixelColor(index, Color(r, g, b));
+}
+
+bool processPacket() {
+  const PixelFrameHeader& header = receiver.header();
 
-  for (i = 0; i < 25; i++) {
-    strip.setPixelColor(i, Color(packetBuffer[i * 3], packetBuffer[i * 3 + 1], packetBuffer[i * 3 + 2]));
+  if (!decoder.apply(header, receiver.payload(), receiver.payloadLength(), setBallPixel)) {
+    return false;
   }
-  strip.show();
-  Serial.println(millis());
+  if (header.flags & kPixelFrameShow) {
+    strip.show();
+  }
+  return true;
+}
+
+// Printing every packet took longer than the packets took to arrive, so the
+// link is summed up every STATS_INTERVAL instead
+void printLinkStats() {
+  Serial.print("packets good ");
+  Serial.print(receiver.framesGood());
+  Serial.print(" bad ");
+  Serial.print(receiver.framesBad());
+  Serial.print(" lost ");
+  Serial.print(receiver.framesLost());
+  Serial.print(" dup ");
+  Serial.print(receiver.framesDuplicate());
+  Serial.print(" reordered ");
+  Serial.print(receiver.framesReordered());
+  Serial.print(" stale ");
+  Serial.print(receiver.framesStale());
+  Serial.print(" skipped ");
+  Serial.print((uint16_t)(decoder.deltasSkipped() - deltasSkipped));
+  Serial.print(" delay ");
+  Serial.print(receiver.lastDelayMillis());
+  Serial.println(" ms");
+  receiver.resetStats();
+  deltasSkipped = decoder.deltasSkipped();
 }
 
 void rainbow(uint8_t wait) {
@@ -0,0 +1,472 @@
+//
+//  ProtocolRoundTrip.cpp
+//  ChristmasTreeVisualizer
+//
+//  Runs the key and delta codecs of both links end to end, the way the host
+//  and the sketches use them, over a channel that loses packets:
+//
+//  - ball frames through PixelFrameEncoder, a channel that also repeats,
+//    swaps and delays packets, PixelFrameReceiver and PixelFrameDecoder
+//  - ribbons through TreeRibbonEncoder, treeEncodeFrame, a serial line that
+//    loses whole frames, TreeFrameDecoder and TreeRibbonDecoder
+//
+//  Every frame the controller applies is checked against what the host
+//  meant it to show.  Then hand-made packets check the decoders' bounds:
+//  deltas whose keyframe never arrived, runs past the end of the frame,
+//  truncated runs, and random bytes.
+//
+//  usage: protocol_roundtrip [frames] [lossPercent] [seed]
+//
+//  Prints what went over each link and exits 1 on any mismatch, or if the
+//  run never exercised fills, skips or skipped deltas.
+//
+
+#include "PixelProtocol.h"
+#include "TreeProtocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <random>
+#include <vector>
+
+static int sFailures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        sFailures++;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------
+//	Ball pixels
+//-------------------------------------------------------------------------------------------------
+
+static const uint16_t kNumPixels = kPixelFrameMaxPixels;
+
+static std::array<uint8_t, kNumPixels * 3> sShown;
+static uint32_t sPixelsSet = 0;
+
+static void setShownPixel(uint16_t index, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (index >= kNumPixels) {
+        printf("FAIL: pixel %u set, past the strip\n", index);
+        sFailures++;
+        return;
+    }
+    sShown[index * 3 + 0] = r;
+    sShown[index * 3 + 1] = g;
+    sShown[index * 3 + 2] = b;
+    sPixelsSet++;
+}
+
+struct Packet
+{
+    std::vector<uint8_t> bytes;
+    uint32_t arrival;
+};
+
+struct RunCounts
+{
+    uint32_t fills = 0;
+    uint32_t literals = 0;
+    uint32_t maxSkip = 0;
+};
+
+// walks a delta the encoder wrote, to see which kinds of run a run used
+static void countRuns(const uint8_t* packet, size_t length, RunCounts& counts)
+{
+    const uint8_t* p = packet + kPixelFrameHeaderSize + 2;
+    const uint8_t* end = packet + length;
+    while (p + 2 <= end) {
+        counts.maxSkip = std::max<uint32_t>(counts.maxSkip, p[0]);
+        bool fill = p[1] & kPixelRunFill;
+        uint8_t run = p[1] & kPixelRunMaxLength;
+        if (fill) {
+            counts.fills++;
+        } else {
+            counts.literals++;
+        }
+        p += 2 + (fill ? 3 : run * 3);
+    }
+}
+
+// Balls that change color now and then and fade while they hold, a stretch
+// lit in one color, and a dark pause every so often with just the last ball
+// blinking, which skips the whole strip
+static void nextBallFrame(std::mt19937& random, int frame, uint8_t* rgb)
+{
+    static const uint8_t kColors[][3] = {{255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 255, 255}};
+
+    if ((frame / 200) % 4 == 3) {
+        memset(rgb, 0, kNumPixels * 3);
+        rgb[(kNumPixels - 1) * 3] = (frame / 7) % 2 ? 255 : 0;
+        return;
+    }
+
+    for (uint16_t i = 0; i < kNumPixels; i++) {
+        uint8_t* c = rgb + i * 3;
+        if (random() % 100 < 3) {
+            memcpy(c, kColors[random() % 4], 3);
+        } else if (random() % 100 < 10) {
+            c[0] = c[0] * 7 / 8;
+            c[1] = c[1] * 7 / 8;
+            c[2] = c[2] * 7 / 8;
+        }
+    }
+
+    if (random() % 100 < 20) {
+        uint16_t start = random() % kNumPixels;
+        uint16_t length = std::min<uint16_t>(3 + random() % 40, kNumPixels - start);
+        const uint8_t* color = kColors[random() % 4];
+        for (uint16_t i = start; i < start + length; i++) {
+            memcpy(rgb + i * 3, color, 3);
+        }
+    }
+}
+
+static void roundTripPixels(int frames, double loss, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    PixelFrameEncoder encoder;
+    PixelFrameReceiver receiver(kNumPixels);
+    std::array<uint8_t, kNumPixels * 3> keyStorage;
+    PixelFrameDecoder decoder(keyStorage.data(), kNumPixels);
+
+    std::array<uint8_t, kNumPixels * 3> rgb = {};
+    std::map<uint16_t, std::array<uint8_t, kNumPixels * 3> > sentFrames;
+    std::vector<Packet> channel;
+
+    uint16_t sequence = 0;
+    uint32_t sent = 0, keyframes = 0, bytesSent = 0, rawBytes = 0;
+    uint32_t applied = 0, mismatched = 0, lost = 0;
+    RunCounts runs;
+
+    for (int frame = 0; frame < frames; frame++) {
+        uint32_t now = frame * 16;
+        nextBallFrame(random, frame, rgb.data());
+        rawBytes += kPixelFrameHeaderSize + kNumPixels * 3;
+
+        PixelFrameHeader header = {};
+        header.flags = kPixelFrameShow | (frame == 0 ? kPixelFrameRestart : 0);
+        header.sequence = sequence;
+        header.timestamp = now;
+        header.offset = 0;
+        header.count = kNumPixels;
+
+        uint8_t packet[kPixelFrameMaxSize];
+        size_t length = encoder.encode(header, rgb.data(), packet, sizeof(packet));
+        if (length > 0) {
+            sentFrames[sequence] = rgb;
+            sequence++;
+            sent++;
+            bytesSent += length;
+
+            PixelFrameHeader encoded;
+            check(pixelDecodeHeader(packet, length, encoded), "encoder wrote a packet that does not decode");
+            if (encoded.flags & kPixelFrameDelta) {
+                countRuns(packet, length, runs);
+            } else {
+                keyframes++;
+            }
+
+            // lost, late, or sent twice; swapped with its neighbour below
+            if (chance(random) < loss) {
+                lost++;
+            } else {
+                uint32_t delay = chance(random) < 0.01 ? 300 : 2 + random() % 4;
+                channel.push_back(Packet{std::vector<uint8_t>(packet, packet + length), now + delay});
+                if (chance(random) < 0.01) {
+                    channel.push_back(channel.back());
+                }
+            }
+        }
+
+        if (channel.size() >= 2 && chance(random) < 0.02) {
+            std::swap(channel[channel.size() - 1], channel[channel.size() - 2]);
+        }
+
+        // the controller takes whatever has arrived by now, in channel order
+        for (auto it = channel.begin(); it != channel.end(); ) {
+            if (it->arrival > now) {
+                ++it;
+                continue;
+            }
+            // exactly as long as the datagram, so an overread shows under a sanitizer
+            std::vector<uint8_t> datagram(it->bytes);
+            it = channel.erase(it);
+
+            if (!receiver.accept(datagram.data(), datagram.size(), now)) {
+                continue;
+            }
+            if (!decoder.apply(receiver.header(), receiver.payload(), receiver.payloadLength(), setShownPixel)) {
+                continue;
+            }
+            applied++;
+            if (sShown != sentFrames[receiver.header().sequence]) {
+                mismatched++;
+            }
+        }
+    }
+
+    printf("pixels: %u frames sent, %u keyframes, %u bytes (%.1f%% of raw), %u lost on the way\n",
+           sent, keyframes, bytesSent, 100.0 * bytesSent / std::max(rawBytes, 1u), lost);
+    printf("pixels: %u applied, %u mismatched; %u deltas skipped; %u fills, %u literal runs, longest skip %u\n",
+           applied, mismatched, decoder.deltasSkipped(), runs.fills, runs.literals, runs.maxSkip);
+    printf("pixels: receiver good %u bad %u lost %u dup %u reordered %u stale %u\n",
+           receiver.framesGood(), receiver.framesBad(), receiver.framesLost(),
+           receiver.framesDuplicate(), receiver.framesReordered(), receiver.framesStale());
+
+    check(mismatched == 0, "an applied ball frame differs from the one sent");
+    check(applied > 0 && keyframes > 0 && keyframes < sent, "no mix of keyframes and deltas");
+    check(runs.fills > 0 && runs.literals > 0, "deltas never used both fill and literal runs");
+    check(runs.maxSkip == kNumPixels - 1, "no delta skipped all but the last pixel");
+    check(loss == 0 || decoder.deltasSkipped() > 0, "no delta was skipped for a lost keyframe");
+}
+
+// writes a delta by hand: header, base sequence, then the given run bytes
+static std::vector<uint8_t> makeDelta(uint16_t sequence, uint16_t base, uint16_t count, const std::vector<uint8_t>& runs)
+{
+    PixelFrameHeader header = {};
+    header.flags = kPixelFrameShow;
+    header.sequence = sequence;
+    header.count = 0;
+
+    std::vector<uint8_t> packet(kPixelFrameHeaderSize);
+    pixelEncodeFrame(header, packet.data(), packet.data(), packet.size());
+    packet[3] |= kPixelFrameDelta;
+    packet[12] = count >> 8;
+    packet[13] = count & 0xFF;
+    packet.push_back(base >> 8);
+    packet.push_back(base & 0xFF);
+    packet.insert(packet.end(), runs.begin(), runs.end());
+    return packet;
+}
+
+// applies a hand-made packet straight to the decoder, bypassing the receiver
+static bool applyPacket(PixelFrameDecoder& decoder, const std::vector<uint8_t>& packet)
+{
+    PixelFrameHeader header;
+    if (!pixelDecodeHeader(packet.data(), packet.size(), header)) {
+        return false;
+    }
+    return decoder.apply(header, packet.data() + kPixelFrameHeaderSize,
+                         packet.size() - kPixelFrameHeaderSize, setShownPixel);
+}
+
+static void checkPixelBounds(uint32_t seed)
+{
+    std::array<uint8_t, kNumPixels * 3> keyStorage;
+    PixelFrameDecoder decoder(keyStorage.data(), kNumPixels);
+
+    // a delta before any keyframe
+    sPixelsSet = 0;
+    check(!applyPacket(decoder, makeDelta(1, 0, kNumPixels, {})) && decoder.deltasSkipped() == 1 && sPixelsSet == 0,
+          "a delta with no keyframe was applied");
+
+    std::array<uint8_t, kNumPixels * 3> key;
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (uint8_t)(i * 7);
+    }
+    PixelFrameHeader header = {};
+    header.flags = kPixelFrameShow;
+    header.sequence = 10;
+    header.count = kNumPixels;
+    std::vector<uint8_t> keyPacket(kPixelFrameMaxSize);
+    keyPacket.resize(pixelEncodeFrame(header, key.data(), keyPacket.data(), keyPacket.size()));
+    check(applyPacket(decoder, keyPacket) && sShown == key, "a keyframe did not apply as sent");
+
+    // on another keyframe's sequence, or over another range
+    check(!applyPacket(decoder, makeDelta(11, 9, kNumPixels, {})) && decoder.deltasSkipped() == 2,
+          "a delta on a keyframe never seen was applied");
+    check(!applyPacket(decoder, makeDelta(11, 10, kNumPixels - 1, {})) && decoder.deltasSkipped() == 3,
+          "a delta over a different range was applied");
+
+    // the longest skip a frame allows, an empty run, and a fill to the last pixel
+    std::array<uint8_t, kNumPixels * 3> expected = key;
+    for (uint16_t i = kNumPixels - 3; i < kNumPixels; i++) {
+        expected[i * 3 + 0] = 1;
+        expected[i * 3 + 1] = 2;
+        expected[i * 3 + 2] = 3;
+    }
+    sShown.fill(0);
+    check(applyPacket(decoder, makeDelta(12, 10, kNumPixels, {100, 0, kNumPixels - 103, kPixelRunFill | 3, 1, 2, 3})) &&
+          sShown == expected, "skips, an empty run and a fill did not apply as sent");
+
+    // a delta back to the keyframe restores every pixel
+    check(applyPacket(decoder, makeDelta(13, 10, kNumPixels, {})) && sShown == key,
+          "an empty delta did not restore the keyframe");
+
+    // runs that reach past the frame, or past the packet, change nothing
+    sPixelsSet = 0;
+    check(!applyPacket(decoder, makeDelta(14, 10, kNumPixels, {0xFF, 1, 9, 9, 9})), "a skip past the frame was applied");
+    check(!applyPacket(decoder, makeDelta(14, 10, kNumPixels, {kNumPixels - 1, 2, 9, 9, 9, 9, 9, 9})), "a run past the frame was applied");
+    check(!applyPacket(decoder, makeDelta(14, 10, kNumPixels, {0, 2, 9, 9, 9, 9})), "a truncated run was applied");
+    check(!applyPacket(decoder, makeDelta(14, 10, kNumPixels, {0})), "half a run header was applied");
+    check(sPixelsSet == 0, "a malformed delta changed pixels");
+
+    // longer than any packet
+    std::vector<uint8_t> huge = makeDelta(15, 10, kNumPixels, std::vector<uint8_t>(kPixelFrameMaxSize, 0));
+    PixelFrameHeader hugeHeader;
+    check(!pixelDecodeHeader(huge.data(), huge.size(), hugeHeader), "a delta longer than a packet decoded");
+
+    // random runs on a good keyframe, each in a buffer exactly its size
+    std::mt19937 random(seed);
+    uint32_t fuzzApplied = 0;
+    for (int i = 0; i < 100000; i++) {
+        std::vector<uint8_t> runs(random() % 48);
+        for (size_t j = 0; j < runs.size(); j++) {
+            // mostly short skips and runs, so some are well formed
+            runs[j] = (uint8_t)(random() % (j % 2 ? 140 : 256));
+        }
+        if (applyPacket(decoder, makeDelta(16, 10, kNumPixels, runs))) {
+            fuzzApplied++;
+        }
+    }
+    printf("pixels: bounds checked; %u of 100000 random deltas were well formed\n", fuzzApplied);
+}
+
+//-------------------------------------------------------------------------------------------------
+//	Tree ribbon
+//-------------------------------------------------------------------------------------------------
+
+static std::array<uint8_t, kTreeRibbonSize> sRibbon;
+
+static void setRibbonPixel(uint8_t index, uint8_t intensity)
+{
+    if (index >= kTreeRibbonSize) {
+        printf("FAIL: ribbon pixel %u set, past the ribbon\n", index);
+        sFailures++;
+        return;
+    }
+    sRibbon[index] = intensity;
+}
+
+static void roundTripRibbon(int frames, double loss, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    TreeRibbonEncoder encoder;
+    TreeFrameDecoder frameDecoder;
+    TreeRibbonDecoder ribbonDecoder;
+
+    std::array<uint8_t, kTreeRibbonSize> intensities = {};
+    std::array<uint8_t, kTreeRibbonSize> expected = {};
+    std::map<uint8_t, std::array<uint8_t, kTreeRibbonSize> > sentRibbons;
+    uint8_t scale = 1;
+    uint8_t sequence = 0;
+    uint32_t sent = 0, keyframes = 0, bytesSent = 0, lost = 0, applied = 0, mismatched = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        // a spectrum that moves a few bands at a time, and gets louder and quieter
+        uint8_t peak = (frame / 100) % 2 ? 255 : 60;
+        for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+            if (random() % 100 < 15) {
+                intensities[i] = random() % (peak + 1);
+            }
+        }
+        uint8_t treeBits = (frame / 30) & 0xF;
+
+        uint8_t payload[kTreeFrameMaxPayload];
+        uint8_t payloadLength = 0;
+        uint8_t type = encoder.encode(treeBits, intensities.data(), sequence, payload, payloadLength);
+        if (type == 0) {
+            continue;
+        }
+
+        // what the strand should show: the levels at the scale of the last key frame
+        if (type == kTreeFrameRibbonKey) {
+            scale = payload[1];
+            keyframes++;
+        }
+        for (uint8_t i = 0; i < kTreeRibbonSize; i++) {
+            unsigned level = std::min<unsigned>((intensities[i] + scale / 2) / scale, kTreeRibbonMaxLevel);
+            expected[i] = level * scale;
+        }
+        sentRibbons[sequence] = expected;
+
+        uint8_t encoded[kTreeFrameMaxEncoded];
+        size_t length = treeEncodeFrame(type, sequence, payload, payloadLength, encoded, sizeof(encoded));
+        sequence++;
+        sent++;
+        bytesSent += length;
+
+        // the serial line never reorders, but frames can go missing whole
+        if (chance(random) < loss) {
+            lost++;
+            continue;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if (!frameDecoder.feed(encoded[i])) {
+                continue;
+            }
+            if (ribbonDecoder.apply(frameDecoder.type(), frameDecoder.sequence(), frameDecoder.payload(),
+                                    frameDecoder.payloadLength(), setRibbonPixel)) {
+                applied++;
+                if (frameDecoder.payload()[0] != treeBits || sRibbon != sentRibbons[frameDecoder.sequence()]) {
+                    mismatched++;
+                }
+            }
+        }
+    }
+
+    printf("ribbon: %u frames sent, %u key frames, %u bytes, %u lost on the way\n", sent, keyframes, bytesSent, lost);
+    printf("ribbon: %u applied, %u mismatched; %u deltas skipped; strand saw %u missed, %u bad\n",
+           applied, mismatched, ribbonDecoder.deltasSkipped(), frameDecoder.framesMissed(), frameDecoder.framesBad());
+
+    check(mismatched == 0, "an applied ribbon differs from the one sent");
+    check(applied > 0 && keyframes > 0 && keyframes < sent, "no mix of ribbon key frames and deltas");
+    check(loss == 0 || ribbonDecoder.deltasSkipped() > 0, "no ribbon delta was skipped for a lost base");
+}
+
+static void checkRibbonBounds()
+{
+    TreeRibbonDecoder decoder;
+    uint8_t payload[kTreeFrameMaxPayload] = {};
+
+    // a delta before any key frame, then ones of the wrong length
+    check(!decoder.apply(kTreeFrameRibbonDelta, 1, payload, 2 + kTreeRibbonBitmapSize, setRibbonPixel) &&
+          decoder.deltasSkipped() == 1, "a ribbon delta with no key frame was applied");
+
+    payload[1] = 1;
+    check(decoder.apply(kTreeFrameRibbonKey, 5, payload, 2 + kTreeRibbonPackedSize, setRibbonPixel),
+          "a ribbon key frame was not applied");
+    check(!decoder.apply(kTreeFrameRibbonKey, 6, payload, 1 + kTreeRibbonPackedSize, setRibbonPixel),
+          "a short ribbon key frame was applied");
+
+    payload[1] = 5;
+    payload[2] = 0xFF;  // eight pixels changed, but no levels for them
+    check(!decoder.apply(kTreeFrameRibbonDelta, 6, payload, 2 + kTreeRibbonBitmapSize, setRibbonPixel),
+          "a ribbon delta missing its levels was applied");
+    check(!decoder.apply(kTreeFrameRibbonDelta, 6, payload, 1 + kTreeRibbonBitmapSize, setRibbonPixel),
+          "a ribbon delta missing its bitmap was applied");
+    printf("ribbon: bounds checked\n");
+}
+
+int main(int argc, const char* argv[])
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 20000;
+    double loss = argc > 2 ? atof(argv[2]) / 100.0 : 0.03;
+    uint32_t seed = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 1;
+
+    roundTripPixels(frames, loss, seed);
+    checkPixelBounds(seed);
+    roundTripRibbon(frames, loss, seed);
+    checkRibbonBounds();
+
+    if (sFailures) {
+        printf("%d checks failed\n", sFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
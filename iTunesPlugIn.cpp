@@ -51,6 +51,9 @@
 
 #include "iTunesPlugIn.h"
 
+#include "LightThread.h"
+#include "PulseRateController.h"
+
 #include <string.h>
 
 //-------------------------------------------------------------------------------------------------
@@ -118,11 +121,28 @@ void UpdateInfoTimeOut( VisualPluginData * visualPluginData )
 //
 void UpdatePulseRate( VisualPluginData * visualPluginData, UInt32 * ioPulseRate )
 {
-	// vary the pulse rate based on whether or not iTunes is currently playing
-	if ( visualPluginData->playing )
-		*ioPulseRate = kPlayingPulseRateInHz;
-	else
-		*ioPulseRate = kStoppedPulseRateInHz;
+	PulseRateController *	controller	= visualPluginData->pulseRateController;
+	LightThread *			lightThread	= visualPluginData->lightThread;
+
+	if ( controller == NULL || lightThread == NULL )
+	{
+		// vary the pulse rate based on whether or not iTunes is currently playing
+		if ( visualPluginData->playing )
+			*ioPulseRate = kPlayingPulseRateInHz;
+		else
+			*ioPulseRate = kStoppedPulseRateInHz;
+		return;
+	}
+
+	// fast for loud music driving lights, slow when there is nothing to show, never more than we can process
+	PulseActivity		activity;
+
+	activity.playing			= visualPluginData->playing;
+	activity.outputsConnected	= LightOutputsConnected( visualPluginData );
+	activity.meanLevel			= lightThread->meanLevel();
+	activity.frameCost			= lightThread->frameCost();
+
+	*ioPulseRate = controller->update( activity );
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -168,6 +188,9 @@ void PulseVisual( VisualPluginData * visualPluginData, UInt32 timeStampID, const
 	// update internal state
 	ProcessRenderData( visualPluginData, timeStampID, renderData );
 
+	// the lights run off the pulse, not off drawing
+	SubmitLightFrame( visualPluginData );
+
 	// if desired, adjust the pulse rate
 	UpdatePulseRate( visualPluginData, ioPulseRate );
 }
@@ -203,6 +226,14 @@ static OSStatus VisualPluginHandler(OSType message,VisualPluginMessageInfo *mess
 			visualPluginData->appCookie	= messageInfo->u.initMessage.appCookie;
 			visualPluginData->appProc	= messageInfo->u.initMessage.appProc;
 
+			CreateLightThread( visualPluginData );
+
+			PulseRateConfig		pulseConfig;
+			pulseConfig.idleRateHz	= kIdlePulseRateInHz;
+			pulseConfig.baseRateHz	= kPlayingPulseRateInHz;
+			pulseConfig.maxRateHz	= kMaxPulseRateInHz;
+			visualPluginData->pulseRateController = new PulseRateController( pulseConfig );
+
 			messageInfo->u.initMessage.refCon = (void *)visualPluginData;
 			break;
 		}
@@ -212,7 +243,12 @@ static OSStatus VisualPluginHandler(OSType message,VisualPluginMessageInfo *mess
 		case kVisualPluginCleanupMessage:
 		{
 			if ( visualPluginData != NULL )
+			{
+				CloseTreeDevices( visualPluginData );
+				DestroyLightThread( visualPluginData );
+				delete visualPluginData->pulseRateController;
 				free( visualPluginData );
+			}
 			break;
 		}
 		/*
@@ -72,6 +72,8 @@
 #define	kTVisualPluginNonFinalRelease	0
 
 struct VisualPluginData;
+class LightThread;
+class PulseRateController;
 
 #if TARGET_OS_MAC
 #import <Cocoa/Cocoa.h>
@@ -86,8 +88,11 @@ struct VisualPluginData;
 #endif
 
 #define kInfoTimeOutInSeconds		10							// draw info/artwork for N seconds when it changes or playback starts
-#define kPlayingPulseRateInHz		10							// when iTunes is playing, draw N times a second
-#define kStoppedPulseRateInHz		5							// when iTunes is not playing, draw N times a second
+#define kPlayingPulseRateInHz		10							// when iTunes is playing quiet music, draw N times a second
+#define kStoppedPulseRateInHz		5							// pulse rate until the first pulse lets us pick one
+#define kIdlePulseRateInHz			1							// when stopped, silent or no lights are attached, draw N times a second
+#define kMaxPulseRateInHz			60							// when the music is loud, draw up to N times a second
+#define kLightOutputRateInHz		60							// the lighting thread updates the ball and ribbon output N times a second
 
 struct VisualPluginData
 {
@@ -113,12 +118,16 @@ struct VisualPluginData
 	// Plugin-specific data
 
 	Boolean				playing;								// is iTunes currently playing audio?
-	Boolean				padding[3];
+	Boolean				lightsSawInfo;							// was info/artwork showing at the last light frame? (track change detection)
+	Boolean				padding[2];
 
 	time_t				drawInfoTimeOut;						// when should we stop showing info/artwork?
 
 	UInt8				minLevel[kVisualMaxDataChannels];		// 0-128
 	UInt8				maxLevel[kVisualMaxDataChannels];		// 0-128
+
+	LightThread *		lightThread;							// light analysis and output, fed from PulseVisual
+	PulseRateController * pulseRateController;					// picks the pulse rate from activity and frame cost
 };
 typedef struct VisualPluginData VisualPluginData;
 
@@ -134,6 +143,7 @@ OSStatus	ResizeVisual( VisualPluginData * visualPluginData );
 void        DisableSerialTree( VisualPluginData * visualPluginData );
 void        EnableSerialTree( VisualPluginData * visualPluginData );
 void        ResetSerialTree( VisualPluginData * visualPluginData );
+void        CloseTreeDevices( VisualPluginData * visualPluginData );
 
 void		ProcessRenderData( VisualPluginData * visualPluginData, UInt32 timeStampID, const RenderVisualData * renderData );
 void		ResetRenderData( VisualPluginData * visualPluginData );
@@ -142,6 +152,11 @@ void		UpdateTrackInfo( VisualPluginData * visualPluginData, ITTrackInfo * trackI
 void		UpdateArtwork( VisualPluginData * visualPluginData, VISUAL_PLATFORM_DATA coverArt, UInt32 coverArtSize, UInt32 coverArtFormat );
 void		UpdatePulseRate( VisualPluginData * visualPluginData, UInt32 * ioPulseRate );
 
+void		CreateLightThread( VisualPluginData * visualPluginData );
+void		DestroyLightThread( VisualPluginData * visualPluginData );
+void		SubmitLightFrame( VisualPluginData * visualPluginData );
+Boolean		LightOutputsConnected( VisualPluginData * visualPluginData );
+
 void		DrawVisual( VisualPluginData * visualPluginData );
 void		PulseVisual( VisualPluginData * visualPluginData, UInt32 timeStampID, const RenderVisualData * renderData, UInt32 * ioPulseRate );
 void		InvalidateVisual( VisualPluginData * visualPluginData );
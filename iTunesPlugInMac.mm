@@ -57,15 +57,17 @@
 #import <string.h>
 #include <stdio.h>
 #import "ORSSerialPort.h"
-#import "ORSSerialPortManager.h"
 #import "GCDAsyncUdpSocket.h"
+#import "TreeDeviceSession.h"
 
-#include <vector>
 #include <algorithm>
-#include <numeric>
 #include <array>
-#include <deque>
-#include <bitset>
+#include <atomic>
+
+#include "LightEngine.h"
+#include "LightThread.h"
+#include "TreeProtocol.h"
+#include "PixelProtocol.h"
 
 #define FORCE_LIGHTS_OFF 0
 
@@ -83,108 +85,13 @@ using namespace std;
 
 extern "C" OSStatus iTunesPluginMainMachO( OSType inMessage, PluginMessageInfo *inMessageInfoPtr, void *refCon ) __attribute__((visibility("default")));
 
-static const size_t kNumTreeBits = 3;
-static const size_t kRibbonSize = 75;
-static const size_t kSmallRibbonSize = 25;
-static const size_t kNumBallLights = 25;
-static const size_t kLPFSize = 10;
-
-static const CFTimeInterval kBallLightAnimationDuration = 0.75;
-static const CFTimeInterval kBallLightAnimationHold = kBallLightAnimationDuration * 4;
-static const CFTimeInterval kBallLightAnimationPeriod = kBallLightAnimationDuration + kBallLightAnimationHold;
-
 #if USE_SUBVIEW
 
-static NSColor* randomBallColor();
-
-struct RGB {
-    uint8_t r = 0;
-    uint8_t g = 0;
-    uint8_t b = 0;
-    
-    RGB() {}
-    
-    RGB(NSColor* col) {
-        r = col.redComponent * 255.0;
-        g = col.greenComponent * 255.0;
-        b = col.blueComponent * 255.0;
-    }
-};
-
-struct BallLight {
-    
-    NSColor* startColor = [NSColor whiteColor];
-    NSColor* endColor = [NSColor whiteColor];
-    
-    CFAbsoluteTime animStart = 0;
-    CFAbsoluteTime animEnd = 0;
-    
-    NSColor* currColor = nil;
-    
-    double getRandomOffset(bool useOffset) const {
-        if (!useOffset) {
-            return 0.0;
-        }
-        
-        uint32_t offset_ms = arc4random_uniform((uint32_t)(kBallLightAnimationPeriod  * 0.75 * 1000.0));
-        double random_offset = (double)offset_ms / 1000.0;
-        return random_offset;
-    }
-    
-    void updateForTime(CFAbsoluteTime t) {
-        
-        if (!startColor || !endColor) {
-            return;
-        }
-        
-        bool bUseOffset = false;
-        
-        if (animStart == 0 || animEnd == 0 || animStart >= animEnd) {
-            animStart = t;
-            animEnd = t + kBallLightAnimationDuration;
-            bUseOffset = true;
-        }
-        
-        if (t <= animStart) {
-            animStart = t;
-            animEnd = t + kBallLightAnimationDuration + getRandomOffset(bUseOffset);
-            currColor = startColor;
-            
-        } else if (t >= animEnd) {
-            
-            currColor = endColor;
-            
-            if (startColor == endColor) {
-                startColor = endColor;
-                while (startColor == endColor) {
-                    endColor = randomBallColor();
-                }
-                animStart = t;
-                animEnd = t + kBallLightAnimationDuration + getRandomOffset(bUseOffset);;
-            } else {
-                startColor = endColor;
-                animStart = t;
-                animEnd = t + (4 * kBallLightAnimationDuration) + getRandomOffset(bUseOffset);
-            }
-
-            
-        } else {
-            
-            CGFloat inter = (t - animStart) / (animEnd - animStart);
-            NSColor* interCol = [startColor blendedColorWithFraction:inter ofColor:endColor];
-            currColor = interCol;
-        }
-    }
-    
-    
-    
-};
-
 //-------------------------------------------------------------------------------------------------
 //	VisualView
 //-------------------------------------------------------------------------------------------------
 
-@interface VisualView : NSView <ORSSerialPortDelegate, GCDAsyncUdpSocketDelegate>
+@interface VisualView : NSView
 {
 	VisualPluginData *	_visualPluginData;
 }
@@ -197,245 +104,115 @@ struct BallLight {
 - (BOOL)resignFirstResponder;
 -(void)keyDown:(NSEvent *)theEvent;
 
-@property (nonatomic, assign) std::vector<BallLight> ballLights;
-
-@property (nonatomic, assign) BOOL bAttemptedSerialInit;
-@property (nonatomic, strong) ORSSerialPort * serialPort;
-
-@property (strong, nonatomic) dispatch_queue_t socket_queue;
-@property (strong, nonatomic) GCDAsyncUdpSocket* udp_socket;
-
-- (void)cleanupSerialPort;
-- (void)setupSerialPort;
-
-- (std::vector<NSColor*>)updateBallLights:(CFAbsoluteTime)t;
-
 @end
 
 #endif	// USE_SUBVIEW
 
 
 
-typedef std::vector<UInt8> SpectrumData;
-typedef std::array<float, kNumTreeBits> OutputLevels;
-typedef std::bitset<kNumTreeBits> TreeDisplayBits;
-typedef std::deque<OutputLevels> OutputLevelsQueue;
-
-static const bool kEmitLEDRibbonIntensity = false;
-
+static const bool kEmitLEDRibbonIntensity = true;
 
+// a ball frame still waiting after this long is too old to show; the socket
+// keeps just one waiting behind the one going out
+static const NSTimeInterval kBallFrameTimeout = 0.1;
 
-static const std::vector<NSColor*>& getDefaultBallColors()
-{
-    static std::vector<NSColor*> cols;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        cols.push_back([[NSColor redColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        cols.push_back([[NSColor orangeColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        //cols.push_back([[NSColor yellowColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        cols.push_back([[NSColor greenColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        cols.push_back([[NSColor blueColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        cols.push_back([[NSColor purpleColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        //cols.push_back([[NSColor whiteColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        //cols.push_back([[NSColor cyanColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-        //cols.push_back([[NSColor magentaColor] colorUsingColorSpace:[NSColorSpace genericRGBColorSpace]]);
-    });
-    return cols;
-}
-
-static NSColor* randomBallColor()
-{
-    const auto& colors = getDefaultBallColors();
-    uint32_t numCols = colors.size();
-    uint32_t idx = arc4random_uniform(numCols);
-    return colors[idx];
-}
+static_assert(kRibbonSize == kTreeRibbonSize, "the strand firmware expects a full ribbon");
+static_assert(kNumBallLights <= kPixelFrameMaxPixels, "the ball frame must fit one packet");
 
-SpectrumData scaleSpectrumData(const SpectrumData& srcData,
-                               size_t srcStart, size_t srcLength,
-                               size_t dstLength)
+// Frames and queues one message for the strand, latest-wins.  Returns NO if
+// the frame could not be queued, or pushed out one that had not gone out
+// yet; either way the strand is missing a frame the next ribbon delta would
+// build on.  A frame sent to replace our own waiting frame only has to be
+// queued, since the one it pushes out is the one it stands in for.
+static BOOL SendTreeFrame( ORSSerialPort* serialPort, uint8_t type, uint8_t sequence, const uint8_t* payload, size_t payloadLength,
+                           BOOL replacesOwnFrame = NO )
 {
-    SpectrumData outData;
-    outData.reserve(dstLength);
-    
-    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceGray();
-    
-    CGContextRef spectrumCtx = CGBitmapContextCreate((void*)(srcData.data() + srcStart),
-                                                     srcLength, 1,
-                                                     8, srcLength,
-                                                     colorSpace, kCGImageAlphaNone);
-    
-    CGContextRef dstCtx = CGBitmapContextCreate(NULL, dstLength, 1, 8, dstLength, colorSpace, kCGImageAlphaNone);
-    
-    if (spectrumCtx && dstCtx) {
-        
-        CGImageRef img = CGBitmapContextCreateImage(spectrumCtx);
-
-        CGContextSetInterpolationQuality(dstCtx, kCGInterpolationLow);
-        CGContextDrawImage(dstCtx, CGRectMake(0, 0, dstLength, 1), img);
-        
-        UInt8* dstCtxBytes = (UInt8*)CGBitmapContextGetData(dstCtx);
-        outData.assign(dstCtxBytes, dstCtxBytes + dstLength);
-        
-        if (img) {
-            CFRelease(img);
-        }
+    uint8_t encoded[kTreeFrameMaxEncoded];
+    size_t length = treeEncodeFrame(type, sequence, payload, payloadLength, encoded, sizeof(encoded));
+    if (length == 0) {
+        return NO;
     }
     
-    if (spectrumCtx) {
-        CFRelease(spectrumCtx);
-    }
-    
-    if (colorSpace) {
-        CFRelease(colorSpace);
-    }
-
-    if (dstCtx) {
-        CFRelease(dstCtx);
-    }
-    
-    if (outData.size() < dstLength) {
-        outData.resize(dstLength);
-    }
-    
-    return outData;
+    unsigned long long dropped = serialPort.droppedFrameCount;
+    BOOL queued = [serialPort sendFrameBytes:encoded length:length];
+    return queued && (replacesOwnFrame || serialPort.droppedFrameCount == dropped);
 }
 
-OutputLevels outputLevelsQueueAverage(const OutputLevelsQueue& queue) {
-    
-    OutputLevels avgLevels;
-    for (int i=0; i<kNumTreeBits; i++) {
-        avgLevels[i]=0;
-    }
-    
-    if (queue.size()) {
-        for (auto lev : queue) {
-            for (int i=0; i<kNumTreeBits; i++) {
-                avgLevels[i] += lev[i];
-            }
-        }
-        for (int i=0; i<kNumTreeBits; i++) {
-            avgLevels[i] /= queue.size();
-        }
+static void SendRibbonFrame( ORSSerialPort* serialPort, StrandLinkEncoder* link, uint8_t treeByte, const uint8_t* ribbon )
+{
+    uint8_t payload[kTreeFrameMaxPayload];
+    uint8_t payloadLength = 0;
+    if (link->needsKeyframe.exchange(false, std::memory_order_relaxed)) {
+        link->ribbon.forceKeyframe();
     }
-    return avgLevels;
-}
-
-OutputLevels outputLevelsQueueMax(const OutputLevelsQueue& queue) {
     
-    OutputLevels maxLevels;
-    for (int i=0; i<kNumTreeBits; i++) {
-        maxLevels[i]=0;
+    uint8_t sequence = link->sequence.fetch_add(1, std::memory_order_relaxed);
+    uint8_t type = link->ribbon.encode(treeByte, ribbon, sequence, payload, payloadLength);
+    if (type == 0) {
+        // the strand already shows this; give the sequence number back
+        uint8_t next = sequence + 1;
+        link->sequence.compare_exchange_strong(next, sequence, std::memory_order_relaxed);
+        return;
     }
     
-    if (queue.size()) {
-        for (auto lev : queue) {
-            for (int i=0; i<kNumTreeBits; i++) {
-                maxLevels[i] = MAX(lev[i], maxLevels[i]);
+    if (!SendTreeFrame(serialPort, type, sequence, payload, payloadLength)) {
+        link->ribbon.forceKeyframe();
+        
+        // a delta that replaced its own base is no use; a key frame in its
+        // place is, and only needs another one if it was refused too
+        if (type == kTreeFrameRibbonDelta) {
+            sequence = link->sequence.fetch_add(1, std::memory_order_relaxed);
+            type = link->ribbon.encode(treeByte, ribbon, sequence, payload, payloadLength);
+            if (!SendTreeFrame(serialPort, type, sequence, payload, payloadLength, YES)) {
+                link->ribbon.forceKeyframe();
             }
         }
     }
-    return maxLevels;
 }
 
-static SpectrumData averageSpectrum(const std::deque<SpectrumData>& queue)
-{
-    size_t num = queue.front().size();
-    SpectrumData res(num, 0);
-    for (const auto& vals : queue) {
-        for (int i=0; i<res.size(); i++) {
-            res[i] += vals[i];
-        }
-    }
-    return res;
-}
 
-static SpectrumData maxSpectrum(const std::deque<SpectrumData>& queue)
-{
-    size_t num = queue.front().size();
-    SpectrumData res(num, 0);
-    for (const auto& vals : queue) {
-        for (int i=0; i<res.size(); i++) {
-            res[i] = MAX(vals[i], res[i]);
-        }
-    }
-    return res;
-}
 
-static SpectrumData minSpectrum(const std::deque<SpectrumData>& queue)
+// Wraps the ball colors in a pixel packet, so the controller can tell late and
+// repeated packets from new ones.  Most frames only change a few balls, so
+// they go as the runs changed since the last keyframe, and a frame the balls
+// already show is not sent at all.  A keyframe that never arrives costs the
+// deltas up to the next one.  Lighting thread only.
+static void SendBallFrame( GCDAsyncUdpSocket* socket, BallLinkEncoder* link, const BallFrame& ballFrame )
 {
-    size_t num = queue.front().size();
-    SpectrumData res(num, 0);
-    for (const auto& vals : queue) {
-        for (int i=0; i<res.size(); i++) {
-            res[i] = MIN(vals[i], res[i]);
-        }
+    PixelFrameHeader header = {};
+    header.flags = kPixelFrameShow;
+    if (link->needsRestart.exchange(false, std::memory_order_relaxed)) {
+        header.flags |= kPixelFrameRestart;
+        link->pixels.forceKeyframe();
     }
-    return res;
-}
-
-static uint8_t GetTreeByte(const TreeDisplayBits& treeBits)
-{
-    uint8_t r = 0;
-    for (int i=0; i<kNumTreeBits; i++) {
-        if (treeBits[i]) {
-            r = r | (1<<i);
-        }
+    header.sequence = link->sequence;
+    header.timestamp = (uint32_t)(CACurrentMediaTime() * 1000.0);
+    header.offset = 0;
+    header.count = kNumBallLights;
+    
+    uint8_t packet[kPixelFrameHeaderSize + kNumBallLights * 3];
+    size_t length = link->pixels.encode(header, ballFrame.data(), packet, sizeof(packet));
+    if (length == 0) {
+        return;
     }
-    return r;
+    link->sequence++;
+    
+    NSData* data = [NSData dataWithBytes:packet length:length];
+    [socket sendData:data withTimeout:kBallFrameTimeout tag:0xDEADBEEF];
 }
 
-static void generateSpectrumData(VisualPluginData * visualPluginData,
-                                 SpectrumData& spectrumData,
-                                 uint32_t& spectSum,
-                                 size_t& fivePercentMin,
-                                 size_t& fivePercentMax)
+
+
+static LightEngineConfig makeLightEngineConfig()
 {
-    vector<UInt8> leftSpectrumData, rightSpectrumData;
-    leftSpectrumData.reserve(kVisualNumSpectrumEntries);
-    rightSpectrumData.reserve(kVisualNumSpectrumEntries);
-    leftSpectrumData.assign(visualPluginData->renderData.spectrumData[0],
-                            visualPluginData->renderData.spectrumData[0] + kVisualNumSpectrumEntries);
-    
-    rightSpectrumData.assign(visualPluginData->renderData.spectrumData[1],
-                             visualPluginData->renderData.spectrumData[1] + kVisualNumSpectrumEntries);
-    
-    for (int i=0; i<kVisualNumSpectrumEntries; i++) {
-        spectrumData.push_back((leftSpectrumData[i] + rightSpectrumData[i]) / 2);
-    }
-    
-    spectSum = accumulate(spectrumData.begin(), spectrumData.end(), 0);
-    
-    {
-        uint32_t sumLimit = 0;
-        for(int i=spectrumData.size()-1;i>=0;i--){
-            sumLimit += spectrumData[i];
-            if(sumLimit >= spectSum*0.05){
-                fivePercentMax = i;
-                break;
-            }
-        }
-    }
-    
-    
-    {
-        uint32_t sumLimit = 0;
-        for(int i=0;i<spectrumData.size();i++){
-            sumLimit += spectrumData[i];
-            if(sumLimit >= spectSum*.05){
-                fivePercentMin = i;
-                break;
-            }
-        }
-    }
-    
-    if (fivePercentMax <= fivePercentMin) {
-        fivePercentMax = fivePercentMin;
-    }
-    
+    LightEngineConfig config;
+    config.emitRibbonIntensity = kEmitLEDRibbonIntensity;
+    config.randomSeed = arc4random();
+    config.outputRateHz = kLightOutputRateInHz;
+    return config;
 }
 
-static void drawSpectrum(const SpectrumData& spectrumData, NSRect viewBounds,
+static void drawSpectrum(const MonoSpectrum& spectrumData, NSRect viewBounds,
                   size_t fivePercentMin,
                   size_t fivePercentMax)
 {
@@ -503,41 +280,35 @@ static void drawSpectrum(const SpectrumData& spectrumData, NSRect viewBounds,
     }
 }
 
-static BOOL updateAndDrawInfo(VisualPluginData * visualPluginData)
+static void drawInfo(VisualPluginData * visualPluginData)
 {
-    if ( time( NULL ) < visualPluginData->drawInfoTimeOut )
+    CGPoint where = CGPointMake( 10, 10 );
+    
+    // if we have a song title, draw it (prefer the stream title over the regular name if we have it)
+    NSString *                theString = NULL;
+    
+    if ( visualPluginData->streamInfo.streamTitle[0] != 0 )
+        theString = [NSString stringWithCharacters:&visualPluginData->streamInfo.streamTitle[1] length:visualPluginData->streamInfo.streamTitle[0]];
+    else if ( visualPluginData->trackInfo.name[0] != 0 )
+        theString = [NSString stringWithCharacters:&visualPluginData->trackInfo.name[1] length:visualPluginData->trackInfo.name[0]];
+    
+    if ( theString != NULL )
     {
-        CGPoint where = CGPointMake( 10, 10 );
+        NSDictionary *        attrs = [NSDictionary dictionaryWithObjectsAndKeys:[NSColor whiteColor], NSForegroundColorAttributeName, NULL];
         
-        // if we have a song title, draw it (prefer the stream title over the regular name if we have it)
-        NSString *                theString = NULL;
-        
-        if ( visualPluginData->streamInfo.streamTitle[0] != 0 )
-            theString = [NSString stringWithCharacters:&visualPluginData->streamInfo.streamTitle[1] length:visualPluginData->streamInfo.streamTitle[0]];
-        else if ( visualPluginData->trackInfo.name[0] != 0 )
-            theString = [NSString stringWithCharacters:&visualPluginData->trackInfo.name[1] length:visualPluginData->trackInfo.name[0]];
-        
-        if ( theString != NULL )
-        {
-            NSDictionary *        attrs = [NSDictionary dictionaryWithObjectsAndKeys:[NSColor whiteColor], NSForegroundColorAttributeName, NULL];
-            
-            [theString drawAtPoint:where withAttributes:attrs];
-        }
-        
-        // draw the artwork
-        if ( visualPluginData->currentArtwork != NULL )
-        {
-            where.y += 40;
-            
-            [visualPluginData->currentArtwork drawAtPoint:where fromRect:NSZeroRect operation:NSCompositingOperationSourceOver fraction:0.75];
-        }
+        [theString drawAtPoint:where withAttributes:attrs];
+    }
+    
+    // draw the artwork
+    if ( visualPluginData->currentArtwork != NULL )
+    {
+        where.y += 40;
         
-        return YES;
+        [visualPluginData->currentArtwork drawAtPoint:where fromRect:NSZeroRect operation:NSCompositingOperationSourceOver fraction:0.75];
     }
-    return NO;
 }
 
-static void drawRibbonSpectrum(NSRect viewBounds, const SpectrumData& ribbon)
+static void drawRibbonSpectrum(NSRect viewBounds, const RibbonData& ribbon)
 {
     NSSize viewSize = viewBounds.size;
     CGFloat widthBase = 10;
@@ -591,12 +362,27 @@ static void drawSimpleLightsDebug(BOOL beatDetected, TreeDisplayBits treeBits, O
     }
 }
 
-static void drawBallLightsDebug(std::vector<NSColor*> colors)
+static void drawStrandLinkStats(const StrandLinkStats& link, NSRect viewBounds)
 {
-    if (colors.size() < 25) {
+    if (link.heartbeats == 0) {
         return;
     }
     
+    const TreeHeartbeat& heartbeat = link.lastHeartbeat;
+    CFAbsoluteTime silence = CFAbsoluteTimeGetCurrent() - link.lastHeartbeatTime;
+    
+    NSString* theString = [NSString stringWithFormat:@"strand %@: %u frames, %u bad, %u missed   loop %.1f ms (max %.1f)   heartbeats %u, %u bad, %u missed, last %.1f s ago",
+                           (heartbeat.flags & kTreeHeartbeatActive) ? @"active" : @"idle",
+                           heartbeat.framesGood, heartbeat.framesBad, heartbeat.framesMissed,
+                           heartbeat.loopMicrosMean / 1000.0, heartbeat.loopMicrosMax / 1000.0,
+                           link.heartbeats, link.heartbeatsBad, link.heartbeatsMissed, silence];
+    
+    NSDictionary* attrs = [NSDictionary dictionaryWithObjectsAndKeys:[NSColor lightGrayColor], NSForegroundColorAttributeName, NULL];
+    [theString drawAtPoint:NSMakePoint(10, NSMaxY(viewBounds) - 20) withAttributes:attrs];
+}
+
+static void drawBallLightsDebug(const BallColors& colors)
+{
     NSRect area;
     area.origin.x = 150;
     area.origin.y = 100;
@@ -613,7 +399,8 @@ static void drawBallLightsDebug(std::vector<NSColor*> colors)
     for (int i=0; i<5; i++) {
         NSRect colBox = rowBox;
         for (int j=0; j<5; j++) {
-            NSColor* col = colors[(i*5) + j];
+            const LightColor& c = colors[(i*5) + j];
+            NSColor* col = [NSColor colorWithDeviceRed:c.r green:c.g blue:c.b alpha:1];
             [col set];
             NSRectFillUsingOperation(colBox, NSCompositingOperationMultiply);
             colBox.origin.x += 20;
@@ -622,441 +409,197 @@ static void drawBallLightsDebug(std::vector<NSColor*> colors)
     }
 }
 
-static void updateSimpleLights(const OutputLevels& outputVals,
-                               uint32_t spectSum,
-                               bool bTrackChanged,
-                               TreeDisplayBits& dispTreeBits,
-                               bool& dispBeatDetected,
-                               bool& bSimpleLightsWantSend)
+//-------------------------------------------------------------------------------------------------
+//	CreateLightThread
+//-------------------------------------------------------------------------------------------------
+//
+void CreateLightThread( VisualPluginData * visualPluginData )
 {
-    TreeDisplayBits treeBits(0);
-    bool beatDetected = false;
-    
-    bSimpleLightsWantSend = NO;
-    
-    static OutputLevelsQueue recentLevelsQueue;
-    static OutputLevelsQueue currentLevelsQueue;
-    static CFTimeInterval prevTime = 0;
-    static std::deque<TreeDisplayBits> prevBits;
-    
-    static std::deque<uint32_t> recentSpectrumSumQueue(1, 0);
-    static std::deque<uint32_t> currentSpectrumSumQueue(1, 0);
-    
-    static OutputLevels lastSetLevels;
-    static OutputLevels lastSetMaxLevels;
-    static TreeDisplayBits lastSetTreeBits;
-    static bool lastSetBeatDetected;
-    
-    if (bTrackChanged) {
-        recentLevelsQueue.clear();
-        currentLevelsQueue.clear();
-        prevBits.clear();
-        recentSpectrumSumQueue.clear();
-        currentSpectrumSumQueue.clear();
-    }
-    
-    CFTimeInterval currTime = CACurrentMediaTime();
-    CFTimeInterval delta = currTime - prevTime;
-    
-    OutputLevels currLevels = outputLevelsQueueMax(currentLevelsQueue);
-    OutputLevels avgRecentLevels = outputLevelsQueueAverage(recentLevelsQueue);
-    OutputLevels maxRecentLevels = outputLevelsQueueMax(recentLevelsQueue);
-    
-    for (int i=0; i<kNumTreeBits; i++) {
-        BOOL bAboveAvg = (currLevels[i] >= avgRecentLevels[i]);
-        //BOOL bAbsoluteThreshold = currLevels[i] > 0.25;
-        BOOL bMinThreshold = currLevels[i] > 0.05;
-        
-        BOOL trigger = (bAboveAvg && bMinThreshold);// || bAbsoluteThreshold;
-        if (trigger) {
-            treeBits.set(i);
-        }
-    }
-    
-    uint32_t currSpectSum = spectSum;
-    if (!recentSpectrumSumQueue.empty() && !currentSpectrumSumQueue.empty())
-    {
-        uint32_t maxSpectSum = *(std::max_element(recentSpectrumSumQueue.begin(), recentSpectrumSumQueue.end()));
-        uint32_t minSpectSum = *(std::min_element(recentSpectrumSumQueue.begin(), recentSpectrumSumQueue.end()));
-        uint32_t avgSpectSum = std::accumulate(recentSpectrumSumQueue.begin(), recentSpectrumSumQueue.end(), 0) / recentSpectrumSumQueue.size();
-        
-        currSpectSum = *(std::max_element(currentSpectrumSumQueue.begin(), currentSpectrumSumQueue.end()));
-        
-        
-        double range = maxSpectSum - minSpectSum;
-        double spectOffset = currSpectSum - minSpectSum;
-        BOOL bThreshold = spectOffset > 0.6 * range;
-        BOOL bAboveAvg = currSpectSum >= avgSpectSum;
-        beatDetected = bAboveAvg && bThreshold;
-        
-        if (beatDetected) {
-            treeBits.set();
-        }
-        
-    }
-    
-    if ((delta * 1000 >= 150)) {
-        
-        prevTime = currTime;
-        
-        recentLevelsQueue.push_front(currLevels);
-        if (recentLevelsQueue.size() >= kLPFSize) {
-            recentLevelsQueue.pop_back();
-        }
-        
-        recentSpectrumSumQueue.push_front(currSpectSum);
-        if (recentSpectrumSumQueue.size() >= 20) {
-            recentSpectrumSumQueue.pop_back();
-        }
-        
-        currentLevelsQueue.clear();
-        currentSpectrumSumQueue.clear();
-        
-        lastSetLevels = currLevels;
-        lastSetTreeBits = treeBits;
-        lastSetMaxLevels = maxRecentLevels;
-        lastSetBeatDetected = beatDetected;
-        
-        bSimpleLightsWantSend = true;
-    }
-    
-    currentLevelsQueue.push_back(outputVals);
-    currentSpectrumSumQueue.push_back(spectSum);
-    
-    dispBeatDetected = lastSetBeatDetected;
-    dispTreeBits = lastSetTreeBits;
-    
-    // Debug Display control levels for simple lights
-    if (1) {
-        drawSimpleLightsDebug(lastSetBeatDetected,
-                              lastSetTreeBits,
-                              lastSetLevels);
-    }
-    
+    visualPluginData->lightThread = new LightThread(makeLightEngineConfig());
 }
 
-static SpectrumData updateRibbonLights(const SpectrumData& ribbonData, NSRect viewBounds,
-                                       bool bTrackChanged, bool bForceUpdate, bool beatDetected)
+//-------------------------------------------------------------------------------------------------
+//	DestroyLightThread
+//-------------------------------------------------------------------------------------------------
+//
+void DestroyLightThread( VisualPluginData * visualPluginData )
 {
-    static CFTimeInterval prevTime = 0;
-    
-    static std::vector<SpectrumData> heldUpData;
-    static float maxAvgIntensity = 0;
-    static SpectrumData maxSpectrumVals;
-    static uint8_t addIntensity = 0;
-    
-    static SpectrumData lastSetRotatedOutput;
-    
-    if (bTrackChanged) {
-        maxAvgIntensity = 0;
-        addIntensity = 0;
-        heldUpData.clear();
-        maxSpectrumVals.clear();
-    }
-    
-    CFTimeInterval currTime = CACurrentMediaTime();
-    CFTimeInterval delta = currTime - prevTime;
-    
-    if ((delta * 1000) >= 50 || bForceUpdate) {
-        
-        prevTime = currTime;
-        
-        // no intensity can be a full 255 since that byte value is reserved
-        SpectrumData outIntensities = ribbonData;
-        
-        if (heldUpData.size()) {
-            
-            heldUpData.push_back(ribbonData);
-            size_t numArr = heldUpData.size();
-            
-            for (int i=0; i<ribbonData.size(); i++) {
-                uint32_t sum = 0;
-                for (auto v : heldUpData ) {
-                    sum += v[i];
-                }
-                uint32_t avg = sum / numArr;
-                outIntensities[i] = avg;
-            }
-        }
-        
-        heldUpData.clear();
-        
-        uint32_t totalIntensity = std::accumulate(outIntensities.begin(), outIntensities.end(), 0);
-        float avgIntensity = (float)totalIntensity / (float)outIntensities.size() / 255.f;
-        maxAvgIntensity = MAX(maxAvgIntensity, avgIntensity);
-        
-        if (avgIntensity >= 0.5 || avgIntensity >= (0.75 * maxAvgIntensity)) {
-            addIntensity = 64;
-        } else {
-            addIntensity = (float)addIntensity * 0.3;
-        }
-        
-        if (addIntensity < 10) {
-            addIntensity = 0;
-        }
-        
-        if (maxSpectrumVals.size() == outIntensities.size()) {
-            for (int i=0; i<outIntensities.size(); i++) {
-                maxSpectrumVals[i] = MAX(outIntensities[i], maxSpectrumVals[i]);
-            }
-        } else {
-            maxSpectrumVals = SpectrumData(outIntensities);
-        }
-        
-        for (int i=0; i<outIntensities.size(); i++) {
-            
-            float maxVal = maxSpectrumVals[i];
-            maxVal = MAX(maxVal, 16);
-            
-            float val = (float)outIntensities[i] / maxVal;
-            
-            if (beatDetected) {
-                val = val * 2;
-            }
-            
-            val = MIN(1.f, MAX(0.f, val));
-            uint8_t inten = (val * 64) + addIntensity;
-            if (inten == 0xDB) {
-                inten = 0xDA;
-            }
-            outIntensities[i] = inten;
-        }
-        
-        std::reverse(outIntensities.begin(),outIntensities.end());
-        
-        lastSetRotatedOutput = outIntensities;
-        return outIntensities;
-        
-    } else {
-        heldUpData.push_back(ribbonData);
-    }
-    
-    if (1) {
-        drawRibbonSpectrum(viewBounds, lastSetRotatedOutput);
-    }
-    
-    return SpectrumData();
+    delete visualPluginData->lightThread;
+    visualPluginData->lightThread = NULL;
 }
 
-static void updateBallLights(const SpectrumData& smallRibbon, VisualView* subview, bool beatDetected, bool bTrackChanged, bool bSilence)
+//-------------------------------------------------------------------------------------------------
+//	SubmitLightFrame
+//-------------------------------------------------------------------------------------------------
+//
+void SubmitLightFrame( VisualPluginData * visualPluginData )
 {
-    static CFTimeInterval prevTimeUpdate = 0;
-    static CFTimeInterval prevTimeAnimate = 0;
-    static std::deque<SpectrumData> currRibbonQueue;
-    static std::deque<SpectrumData> recentRibbonQueue;
-    static std::vector<NSColor*> lastSetBallColors;
-    static std::array<CGFloat, kNumBallLights> lastSetBallIntensities;
-    
-    if (bTrackChanged) {
-        currRibbonQueue.clear();
-        recentRibbonQueue.clear();
-    }
-    
-    
-    currRibbonQueue.push_back(smallRibbon);
-    
-    
-    CFTimeInterval currTime = CFAbsoluteTimeGetCurrent();
-    CFTimeInterval deltaUpdate = currTime - prevTimeUpdate;
-    CFTimeInterval deltaAnimate = currTime - prevTimeAnimate;
-    
-    if ((deltaUpdate * 1000) >= 100) {
-        
-        prevTimeUpdate = currTime;
-        
-        SpectrumData avgRibbon = averageSpectrum(currRibbonQueue);
-        recentRibbonQueue.push_front(avgRibbon);
-        if (recentRibbonQueue.size() > 60) {
-            recentRibbonQueue.pop_back();
-        }
-        currRibbonQueue.clear();
+    LightThread* lightThread = visualPluginData->lightThread;
 
-        SpectrumData recentMaxRibbon = maxSpectrum(recentRibbonQueue);
-        
-        if (avgRibbon.size() == kNumBallLights)
-        {
-            for (int i=0; i<kNumBallLights; i++) {
-                CGFloat maxI = recentMaxRibbon[i] / 255.0;
-                CGFloat avgI = avgRibbon[i] / 255.0;
-                CGFloat inten = (avgI / maxI);
-                if (beatDetected) {
-                    inten *= 1.5;
-                }
-                inten = MIN(1.0, MAX(0.0, inten));
-                lastSetBallIntensities[i] = inten;
-            }
-        }
-    }
-    
-    GCDAsyncUdpSocket* socket = subview.udp_socket;
-    if (socket &&
-        lastSetBallIntensities.size() == kNumBallLights &&
-        (deltaAnimate * 1000) >= 16)
-    {
-        
-        prevTimeAnimate = currTime;
-        
-        auto ballColors = [subview updateBallLights:currTime];
-        if (ballColors.size() != kNumBallLights) {
-            return;
-        }
-        
-        lastSetBallColors.clear();
-        std::vector<uint8_t> msg;
-        for (int i=0; i<kNumBallLights; i++) {
-            NSColor* col = ballColors[i];
-            CGFloat inten = lastSetBallIntensities[i];
-            
-            NSColor* intenCol = [[NSColor clearColor] blendedColorWithFraction:inten ofColor:col];
-            if (bSilence) {
-                intenCol = col;
-            }
-            lastSetBallColors.push_back(intenCol);
-            RGB rgbCol = RGB(intenCol);
-            
-            msg.push_back(rgbCol.r);
-            msg.push_back(rgbCol.g);
-            msg.push_back(rgbCol.b);
+    // nothing drives the lights while the visualizer is not shown
+    if ( lightThread == NULL || visualPluginData->destView == NULL )
+        return;
 
-        }
-        NSData* data = [NSData dataWithBytes:msg.data() length:msg.size() * sizeof(uint8_t)];
-        [socket sendData:data toHost:@"10.0.1.150" port:2390 withTimeout:1.0 tag:0xDEADBEEF];
-    }
-    
-    if (lastSetBallColors.size() == kNumBallLights) {
-        drawBallLightsDebug(lastSetBallColors);
-    }
+    BOOL bDrawArtwork = ( time( NULL ) < visualPluginData->drawInfoTimeOut );
+    BOOL bTrackChanged = !visualPluginData->lightsSawInfo && bDrawArtwork;
+    visualPluginData->lightsSawInfo = bDrawArtwork;
+
+    const RenderVisualData& renderData = visualPluginData->renderData;
+    lightThread->submitFrame(renderData.spectrumData[0], renderData.spectrumData[1],
+                             CACurrentMediaTime(), bTrackChanged);
 }
 
 //-------------------------------------------------------------------------------------------------
-//	DrawVisual
+//	LightOutputsConnected
 //-------------------------------------------------------------------------------------------------
 //
-void DrawVisualView_( VisualPluginData * visualPluginData, ORSSerialPort* serialPort, NSRect viewBounds )
+Boolean LightOutputsConnected( VisualPluginData * visualPluginData )
 {
+    (void) visualPluginData;
 
-    size_t fivePercentMax=0;
-    size_t fivePercentMin=0;
-    uint32_t spectSum=0;
-    vector<UInt8> spectrumData;
-    spectrumData.reserve(kVisualNumSpectrumEntries);
-    generateSpectrumData(visualPluginData, spectrumData,
-                         spectSum, fivePercentMin, fivePercentMax);
-    
-    bool bSilence = (spectSum / (spectrumData.size() + 1)) < 3;
-	
-	// this shouldn't happen but let's be safe
-	if ( visualPluginData->destView == NULL )
-		return;
-    
-    uint32_t specStart = fivePercentMin;
-    uint32_t specWidth = fivePercentMax - fivePercentMin;
-
-    SpectrumData simpleData = scaleSpectrumData(spectrumData, specStart, specWidth, kNumTreeBits);
-    SpectrumData smallRibbon = scaleSpectrumData(spectrumData, specStart, specWidth, kSmallRibbonSize);
-    SpectrumData ribbonData;
-    if (kEmitLEDRibbonIntensity) {
-        ribbonData = scaleSpectrumData(smallRibbon, 0, smallRibbon.size(), kRibbonSize);
-    }
-    
-    drawSpectrum(spectrumData, viewBounds, fivePercentMin, fivePercentMax);
-
-    static BOOL bPrevDidDrawArtwork = NO;
-    BOOL bDrawArtwork = updateAndDrawInfo(visualPluginData);
-    
-    OutputLevels outputVals;
-    for (int i=0; i<kNumTreeBits; i++) {
-        outputVals[i] = simpleData[i]/256.f;
-    }
-    
-    BOOL bTrackChanged = !bPrevDidDrawArtwork && bDrawArtwork;
-    
-    // Compute control bits for simple lights
-    TreeDisplayBits dispTreeBits(0);
-    bool dispBeatDetected = false;
-    bool bSimpleLightsWantSend = false;
+    TreeDeviceSession* session = [TreeDeviceSession sharedSession];
+    return session.serialPort.isOpen || session.udpSocket != nil;
+}
 
-    updateSimpleLights(outputVals, spectSum, bTrackChanged,
-                       dispTreeBits, dispBeatDetected, bSimpleLightsWantSend);
+//-------------------------------------------------------------------------------------------------
+//	SendLightOutput
+//-------------------------------------------------------------------------------------------------
+//
+// Called on the lighting thread for every processed frame.  Serial frames are
+// queued latest-wins, so a tree that cannot keep up skips frames and never
+// holds up the lighting thread.
+//
+static void SendLightOutput( const LightEngineOutput& output, TreeDeviceSession* session )
+{
+    ORSSerialPort* serialPort = session.serialPort;
+    GCDAsyncUdpSocket* socket = session.udpSocket;
+    StrandLinkEncoder* strandLink = session.strandEncoder;
     
-    if (kEmitLEDRibbonIntensity && spectSum > 0) {
+    if (kEmitLEDRibbonIntensity && output.analysis.spectSum > 0) {
         
-        SpectrumData rotatedOutput = updateRibbonLights(ribbonData, viewBounds,
-                                                        bTrackChanged, bSimpleLightsWantSend, dispBeatDetected);
-        if (!rotatedOutput.empty()){
+        if (output.ribbonWantsSend){
+            
+            RibbonData ribbon = output.ribbon;
             
             // add the bits to control the basic lights
-            uint8_t treeByte = GetTreeByte(dispTreeBits);
-            treeByte &= 0xF;
+            uint8_t treeByte = output.treeByte;
             
 #if FORCE_LIGHTS_OFF
-            rotatedOutput.clear();
-            for (int i=0; i<75; i++) {
-                rotatedOutput.push_back(0xAA);
-            }
+            ribbon.fill(0xAA);
             treeByte = 0xf;
 #endif
             
-            rotatedOutput.push_back(treeByte);
-            // add a footer of 0xDB to say we are done with this command
-            rotatedOutput.push_back(0xDB);
-            
-            NSData* data = [NSData dataWithBytes:rotatedOutput.data() length:rotatedOutput.size() * sizeof(uint8_t)];
             if (serialPort) {
-                //NSLog(@"DBS: spew: TreeByte %x", treeByte);
-                //NSLog(@"DBS: spew: Pushing %ld bytes to serial %@\n", rotatedOutput.size(), serialPort);
-                [serialPort sendData:data];
+                SendRibbonFrame(serialPort, strandLink, treeByte, ribbon.data());
             }
         }
-    } else if (bSimpleLightsWantSend) {
+        
+    } else if (output.treeWantsSend) {
         
         // add the bits to control the basic lights
-        uint8_t treeByte = GetTreeByte(dispTreeBits);
-        treeByte &= 0xF;
+        uint8_t treeByte = output.treeByte;
         
 #if FORCE_LIGHTS_OFF
         treeByte = 0xf;
 #endif
         
-        NSData* data = [NSData dataWithBytes:&treeByte length:sizeof(treeByte)];
         if (serialPort) {
             //NSLog(@"DBS: spew: TreeByte %x", treeByte);
-            //NSLog(@"DBS: spew: Pushing %ld bytes to serial %@\n", rotatedOutput.size(), serialPort);
-            [serialPort sendData:data];
+            // a tree frame can push out a ribbon frame still waiting to go
+            if (!SendTreeFrame(serialPort, kTreeFrameTree, strandLink->sequence.fetch_add(1, std::memory_order_relaxed),
+                               &treeByte, sizeof(treeByte))) {
+                strandLink->ribbon.forceKeyframe();
+            }
         }
         
     }
     
-    if (1) {
-        
-        updateBallLights(smallRibbon, visualPluginData->subview, dispBeatDetected, bTrackChanged, bSilence);
-        
+    // the session only hands out the socket once it is connected to the balls
+    if (socket && output.ballsWantSend) {
+        SendBallFrame(socket, session.ballEncoder, output.ballFrame);
     }
-	
-    bPrevDidDrawArtwork = bDrawArtwork;
+}
 
+//-------------------------------------------------------------------------------------------------
+//	DrawVisual
+//-------------------------------------------------------------------------------------------------
+//
+// Only draws; the lights are computed and sent by the lighting thread.
+//
+void DrawVisualView_( VisualPluginData * visualPluginData, NSRect viewBounds )
+{
+	// this shouldn't happen but let's be safe
+	if ( visualPluginData->destView == NULL )
+		return;
+
+    LightThread* lightThread = visualPluginData->lightThread;
+    const LightEngineOutput* latest = (lightThread != NULL) ? lightThread->latestOutput() : NULL;
+    if (latest == NULL) {
+        [[NSColor darkGrayColor] set];
+        NSRectFill( viewBounds );
+        return;
+    }
+
+    const LightEngineOutput& output = *latest;
+
+    const SpectrumAnalysis& analysis = output.analysis;
+
+    drawSpectrum(analysis.spectrum, viewBounds, analysis.fivePercentMin, analysis.fivePercentMax);
+
+    if ( time( NULL ) < visualPluginData->drawInfoTimeOut ) {
+        drawInfo(visualPluginData);
+    }
+
+    // Debug Display control levels for simple lights
+    if (1) {
+        drawSimpleLightsDebug(output.beatDetected,
+                              output.treeBits,
+                              output.treeLevels);
+    }
+    
+    if (kEmitLEDRibbonIntensity && analysis.spectSum > 0) {
+        drawRibbonSpectrum(viewBounds, output.ribbon);
+    }
+    
+    if (output.ballsValid) {
+        drawBallLightsDebug(output.ballColors);
+    }
+    
+#if USE_SUBVIEW
+    drawStrandLinkStats([TreeDeviceSession sharedSession].strandLink, viewBounds);
+#endif
 }
 
 void ResetSerialTree( VisualPluginData * visualPluginData )
 {
-    VisualView* subview = visualPluginData->subview;
-    ORSSerialPort* serialPort = subview.serialPort;
+    (void) visualPluginData;
+
+    TreeDeviceSession* session = [TreeDeviceSession sharedSession];
+    ORSSerialPort* serialPort = session.serialPort;
     
     if (serialPort) {
         
-        std::array<uint8_t, 152> msg;
+        // all tree lights on, the ribbon dimly lit
+        std::array<uint8_t, 1 + kRibbonSize> msg;
+        msg[0] = 0xf;
+        std::fill(msg.begin() + 1, msg.end(), 32);
         
-        for (int i=0; i<75; i++) {
-            msg[i] = 32;
-        }
-        msg[150] = 0xf;
-        msg[151] = 0xDB;
+        uint8_t encoded[1 + kTreeFrameMaxEncoded];
         
-        NSData* data = [NSData dataWithBytes:msg.data() length:msg.size() * sizeof(uint8_t)];
+        // a lone delimiter first ends whatever partial frame the strand is holding
+        encoded[0] = 0;
+        size_t length = treeEncodeFrame(kTreeFrameRibbon, session.strandEncoder->sequence.fetch_add(1, std::memory_order_relaxed),
+                                        msg.data(), msg.size(), encoded + 1, sizeof(encoded) - 1);
+        
+        NSData* data = [NSData dataWithBytes:encoded length:1 + length];
         NSLog(@"DBS: Reseting tree lights to all on");
         [serialPort sendData:data];
+
+        // a plain ribbon clears the strand's delta base; the lighting thread
+        // owns the encoder, so it is only told to send a key frame next
+        session.strandEncoder->needsKeyframe.store(true, std::memory_order_relaxed);
     }
-    
+
 
 }
 
@@ -1110,6 +653,10 @@ OSStatus ActivateVisual( VisualPluginData * visualPluginData, VISUAL_PLATFORM_VI
 
 #if USE_SUBVIEW
 
+    // already open unless this is the first activation, or the devices went away
+    TreeDeviceSession* session = [TreeDeviceSession sharedSession];
+    [session connect];
+
     destView.autoresizingMask = NSViewHeightSizable | NSViewWidthSizable |
     NSViewMinXMargin | NSViewMinYMargin | NSViewMaxXMargin | NSViewMaxYMargin;
     
@@ -1120,6 +667,14 @@ OSStatus ActivateVisual( VisualPluginData * visualPluginData, VISUAL_PLATFORM_VI
 	{
 		[visualPluginData->subview setVisualPluginData:visualPluginData];
 		[destView addSubview:visualPluginData->subview];
+
+		// the lighting thread sends through whatever the session has open
+		if ( visualPluginData->lightThread != NULL )
+		{
+			visualPluginData->lightThread->setOutputHandler([session](const LightEngineOutput& output) {
+				SendLightOutput(output, session);
+			});
+		}
 	}
 	else
 	{
@@ -1148,11 +703,10 @@ OSStatus MoveVisual( VisualPluginData * visualPluginData, OptionBits newOptions
 OSStatus DeactivateVisual( VisualPluginData * visualPluginData )
 {
 #if USE_SUBVIEW
-    NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
-    [nc removeObserver:visualPluginData->subview];
-    [visualPluginData->subview cleanupSerialPort];
+    if ( visualPluginData->lightThread != NULL )
+        visualPluginData->lightThread->setOutputHandler(LightThread::OutputHandler());
 
-    
+	// the devices stay connected for the next activation
 	[visualPluginData->subview removeFromSuperview];
 	visualPluginData->subview = NULL;
 	visualPluginData->currentArtwork = NULL;
@@ -1170,8 +724,6 @@ OSStatus DeactivateVisual( VisualPluginData * visualPluginData )
 //-------------------------------------------------------------------------------------------------
 //
 
-static int currResizeJobID = 0;
-
 OSStatus ResizeVisual( VisualPluginData * visualPluginData )
 {
     NSView* destView = visualPluginData->destView;
@@ -1184,15 +736,23 @@ OSStatus ResizeVisual( VisualPluginData * visualPluginData )
 
 void        EnableSerialTree( VisualPluginData * visualPluginData )
 {
-        VisualView* subview = visualPluginData->subview;
-        [subview setupSerialPort];
+    (void) visualPluginData;
+
+    // nothing to do on play unless a device went away and never came back
+    [[TreeDeviceSession sharedSession] connect];
 }
 
+// Leaves the tree lit and the port open for the next activation
 void        DisableSerialTree( VisualPluginData * visualPluginData )
 {
     ResetSerialTree(visualPluginData);
-    VisualView* subview = visualPluginData->subview;
-    [subview cleanupSerialPort];
+}
+
+void        CloseTreeDevices( VisualPluginData * visualPluginData )
+{
+    (void) visualPluginData;
+
+    [[TreeDeviceSession sharedSession] disconnect];
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -1219,47 +779,6 @@ OSStatus ConfigureVisual( VisualPluginData * visualPluginData )
 
 @synthesize visualPluginData = _visualPluginData;
 
-- (instancetype)initWithFrame:(NSRect)frameRect
-{
-    self = [super initWithFrame:frameRect];
-    if (self) {
-        [self setupSerialPort];
-        
-        for (int i=0; i<kNumBallLights; i++) {
-            BallLight ball;
-            ball.startColor = randomBallColor();
-            ball.endColor = randomBallColor();
-            while (ball.startColor == ball.endColor) {
-                ball.endColor = randomBallColor();
-            }
-            _ballLights.push_back(ball);
-        }
-        
-    }
-    return self;
-}
-
-- (void)dealloc
-{
-    [self cleanupSerialPort];
-    NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
-    [nc removeObserver:self];
-}
-
-- (std::vector<NSColor*>)updateBallLights:(CFAbsoluteTime)t
-{
-    std::vector<NSColor*> ballColors;
-    for (auto& ball : _ballLights) {
-        ball.updateForTime(t);
-        NSColor* c = ball.currColor;
-        if (c == nil) {
-            c = [NSColor whiteColor];
-        }
-        ballColors.push_back(c);
-    }
-    return ballColors;
-}
-
 //-------------------------------------------------------------------------------------------------
 //	isOpaque
 //-------------------------------------------------------------------------------------------------
@@ -1278,7 +797,7 @@ OSStatus ConfigureVisual( VisualPluginData * visualPluginData )
 {
 	if ( _visualPluginData != NULL )
 	{
-        DrawVisualView_( _visualPluginData , self.serialPort, self.bounds);
+        DrawVisualView_( _visualPluginData, self.bounds );
 	}
 }
 
@@ -1291,73 +810,6 @@ OSStatus ConfigureVisual( VisualPluginData * visualPluginData )
 	return YES;
 }
 
-- (void)cleanupSerialPort
-{
-    if (self.serialPort) {
-        NSLog(@"DBS: cleaning up serial connection");
-        [self.serialPort close];
-        self.serialPort.delegate = nil;
-        self.serialPort = nil;
-    }
-}
-
-- (void)setupSerialPort
-{
-    self.bAttemptedSerialInit = YES;
-    
-    static ORSSerialPortManager* sSerialMgr = nil;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        sSerialMgr = [ORSSerialPortManager sharedSerialPortManager];
-    });
-    
-    if (self.serialPort == nil) {
-        
-        NSArray* availablePorts = [[ORSSerialPortManager sharedSerialPortManager] availablePorts];
-        ORSSerialPort* foundPort = nil;
-        NSLog(@"DBS: avaialble serial ports %@", availablePorts);
-        for (ORSSerialPort* port in availablePorts) {
-            
-            NSString* path = port.path;
-            
-            if ([path hasPrefix:@"/dev/tty.usbserial"] ||
-                [path hasPrefix:@"/dev/cu.usbserial"] ||
-                [path hasPrefix:@"/dev/tty.usbmodem"] ||
-                [path hasPrefix:@"/dev/cu.usbmodem"]) {
-                
-                foundPort = port;
-                break;
-            }
-        }
-        
-        if (foundPort) {
-            
-            NSLog(@"DBS: Christmas Tree Visualizer: found serial port name %@, path %@", foundPort.name, foundPort.path);
-            self.serialPort = foundPort;
-            if (self.serialPort) {
-                self.serialPort.delegate = self;
-                self.serialPort.baudRate = [NSNumber numberWithInteger:115200];
-                [self.serialPort open];
-            }
-        } else {
-            NSLog(@"DBS: Could not find valid Serial port\n");
-        }
-        
-        NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
-        [nc addObserver:self selector:@selector(serialPortsWereConnected:) name:ORSSerialPortsWereConnectedNotification object:nil];
-
-    }
-    
-    self.socket_queue = dispatch_queue_create("socket queue",0);
-    self.udp_socket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:self.socket_queue];
-    
-}
-
-- (void)serialPortsWereConnected:(NSNotificationCenter*)notification
-{
-    [self setupSerialPort];
-}
-
 //-------------------------------------------------------------------------------------------------
 //	becomeFirstResponder
 //-------------------------------------------------------------------------------------------------
@@ -1396,24 +848,6 @@ OSStatus ConfigureVisual( VisualPluginData * visualPluginData )
 	[super keyDown:theEvent];
 }
 
-#pragma mark ORSSerialPortDelegate
-
-- (void)serialPort:(ORSSerialPort *)serialPort didReceiveData:(NSData *)data
-{
-    if (data.length >= 1) {
-        const uint8_t* bytes = (const uint8_t*)data.bytes;
-        if (!(bytes[0] == 0xdb) && !(bytes[1] == 0xdb)) {
-            NSLog(@"DBS: Error Received Data (%ld) %x %x", data.length, bytes[0], bytes[1]);
-        }
-    }
-}
-
-- (void)serialPortWasRemovedFromSystem:(ORSSerialPort *)serialPort
-{
-    [self cleanupSerialPort];
-}
-
-
 @end
 
 #endif	// USE_SUBVIEW